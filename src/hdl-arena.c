@@ -0,0 +1,141 @@
+#include "hdl-arena.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Size of the first block
+#define HDL_ARENA_BLOCK_SIZE        (64 << 10)
+// Blocks grow up to this size, bigger allocations get a block of their own
+#define HDL_ARENA_MAX_BLOCK_SIZE    (1 << 20)
+// Alignment of allocations
+#define HDL_ARENA_ALIGN             8
+
+// Start of the memory of a block
+#define HDL_ARENA_DATA(block)       ((char*)(block) + sizeof(struct HDL_ArenaBlock))
+
+void HDL_ArenaInit (struct HDL_Arena *arena) {
+    arena->head = NULL;
+    arena->last = NULL;
+    arena->allocated = 0;
+}
+
+/**
+ * @brief Adds a block with room for at least size bytes
+ *
+ * @param arena
+ * @param size
+ * @return int 0 on success
+ */
+static int _HDL_ArenaGrow (struct HDL_Arena *arena, size_t size) {
+    // Double the block size with each block to keep the block count low
+    size_t block_size = arena->head != NULL ? arena->head->size * 2 : HDL_ARENA_BLOCK_SIZE;
+    if(block_size > HDL_ARENA_MAX_BLOCK_SIZE) {
+        block_size = HDL_ARENA_MAX_BLOCK_SIZE;
+    }
+    if(block_size < size) {
+        block_size = size;
+    }
+
+    struct HDL_ArenaBlock *block = malloc(sizeof(struct HDL_ArenaBlock) + block_size);
+    if(block == NULL) {
+        // Out of memory
+        return 1;
+    }
+    block->size = block_size;
+    block->used = 0;
+
+    if(arena->head != NULL && size > arena->head->size - arena->head->used && block_size == size) {
+        // Big allocation, keep using the current block for small ones
+        block->next = arena->head->next;
+        arena->head->next = block;
+        return 0;
+    }
+    block->next = arena->head;
+    arena->head = block;
+    return 0;
+}
+
+void *HDL_ArenaAlloc (struct HDL_Arena *arena, size_t size) {
+    size = (size + HDL_ARENA_ALIGN - 1) & ~(size_t)(HDL_ARENA_ALIGN - 1);
+    if(size == 0) {
+        size = HDL_ARENA_ALIGN;
+    }
+
+    struct HDL_ArenaBlock *block = arena->head;
+    if(block == NULL || block->size - block->used < size) {
+        if(_HDL_ArenaGrow(arena, size)) {
+            return NULL;
+        }
+        block = arena->head;
+        if(block->size - block->used < size) {
+            // Got a block of its own
+            block = block->next;
+            block->used = size;
+            arena->allocated += size;
+            return HDL_ARENA_DATA(block);
+        }
+    }
+
+    void *ptr = HDL_ARENA_DATA(block) + block->used;
+    block->used += size;
+    arena->allocated += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void *HDL_ArenaRealloc (struct HDL_Arena *arena, void *ptr, size_t old_size, size_t size) {
+    if(ptr == NULL) {
+        return HDL_ArenaAlloc(arena, size);
+    }
+
+    if(ptr == arena->last) {
+        // Last allocation, grow or shrink in place if it fits
+        struct HDL_ArenaBlock *block = arena->head;
+        size_t start = (char*)ptr - HDL_ARENA_DATA(block);
+        size_t n_size = (size + HDL_ARENA_ALIGN - 1) & ~(size_t)(HDL_ARENA_ALIGN - 1);
+        if(start + n_size <= block->size) {
+            arena->allocated += start + n_size - block->used;
+            block->used = start + n_size;
+            return ptr;
+        }
+    }
+
+    if(size <= old_size) {
+        return ptr;
+    }
+
+    void *n_ptr = HDL_ArenaAlloc(arena, size);
+    if(n_ptr == NULL) {
+        // Out of memory
+        return NULL;
+    }
+    memcpy(n_ptr, ptr, old_size);
+    return n_ptr;
+}
+
+void HDL_ArenaReset (struct HDL_Arena *arena) {
+    struct HDL_ArenaBlock *head = arena->head;
+    if(head == NULL) {
+        return;
+    }
+    struct HDL_ArenaBlock *block = head->next;
+    while(block != NULL) {
+        struct HDL_ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    head->next = NULL;
+    head->used = 0;
+    arena->last = NULL;
+    arena->allocated = 0;
+}
+
+void HDL_ArenaFree (struct HDL_Arena *arena) {
+    struct HDL_ArenaBlock *block = arena->head;
+    while(block != NULL) {
+        struct HDL_ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    HDL_ArenaInit(arena);
+}
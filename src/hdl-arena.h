@@ -0,0 +1,65 @@
+#ifndef _HDL_ARENA
+#define _HDL_ARENA
+#include <stddef.h>
+
+// Block of arena memory, allocations follow the header
+struct HDL_ArenaBlock {
+    // Previous block
+    struct HDL_ArenaBlock *next;
+    // Usable size of the block
+    size_t size;
+    // Bytes allocated from the block
+    size_t used;
+};
+
+// Bump allocator, everything allocated from an arena is freed at once
+struct HDL_Arena {
+    // Current block, older blocks are linked behind it
+    struct HDL_ArenaBlock *head;
+    // Last allocation, can be resized in place
+    void *last;
+    // Total bytes allocated from the arena
+    size_t allocated;
+};
+
+/**
+ * @brief Initializes an empty arena, memory is allocated on first use
+ *
+ * @param arena
+ */
+void HDL_ArenaInit (struct HDL_Arena *arena);
+
+/**
+ * @brief Allocates memory from the arena
+ *
+ * @param arena
+ * @param size
+ * @return void* NULL if out of memory
+ */
+void *HDL_ArenaAlloc (struct HDL_Arena *arena, size_t size);
+
+/**
+ * @brief Resizes an allocation, in place if it is the last one in the arena
+ *
+ * @param arena
+ * @param ptr Allocation or NULL
+ * @param old_size Current size of the allocation
+ * @param size New size
+ * @return void* NULL if out of memory, old allocation stays valid
+ */
+void *HDL_ArenaRealloc (struct HDL_Arena *arena, void *ptr, size_t old_size, size_t size);
+
+/**
+ * @brief Frees all memory allocated from the arena, the current block is kept for the next allocations
+ *
+ * @param arena
+ */
+void HDL_ArenaReset (struct HDL_Arena *arena);
+
+/**
+ * @brief Frees all memory allocated from the arena
+ *
+ * @param arena
+ */
+void HDL_ArenaFree (struct HDL_Arena *arena);
+#endif
@@ -3,8 +3,16 @@
 #include <string.h>
 #include "hdl-parse.h"
 #include <math.h>
-#include "hdl-cmp.h"
 #include "hdl-util.h"
+#include "hdl-module.h"
+#include "hdl-output.h"
+#include "hdl-encode.h"
+#include "hdl-schema.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 // Unknown file format
 #define HDL_COMPILER_OUTPUT_FORMAT_UNKNOWN 0xFF
@@ -15,57 +23,78 @@
 // C source file image
 #define HDL_COMPILER_OUTPUT_FORMAT_BMP_C 2
 
-// Maximum output file buffer size
-#define HDL_COMPILER_OUTPUT_BUFFER_SIZE 4096
-
+// Header flags
+#define HDL_HEADER_FLAGS            6
+// Counts, sizes and indices are 32-bit
+#define HDL_HEADER_FLAG_WIDE        0x01
+// Offset directory follows the header: a uint32 file offset of each bitmap by id, then of each element in document order
+#define HDL_HEADER_FLAG_DIRECTORY   0x02
+// String table follows the directory, contents and string attributes are indices in to it
+#define HDL_HEADER_FLAG_STRINGS     0x04
+// Attributes are written in the compact format (see hdl-decode.h)
+#define HDL_HEADER_FLAG_COMPACT     0x08
+// Multi-byte fields are at offsets that are a multiple of their size, bitmap records and data at the payload alignment
+#define HDL_HEADER_FLAG_ALIGNED     0x10
+// Multi-byte fields are big endian
+#define HDL_HEADER_FLAG_BIG_ENDIAN  0x20
+// Payload alignment of the aligned layout, 4 << (flags >> 6)
+#define HDL_HEADER_ALIGN_SHIFT      6
+// Deepest element nesting (uint8), runtime can size its element stack with it
+#define HDL_HEADER_MAX_DEPTH        7
+// Deepest element nesting in the wide format (uint16)
+#define HDL_HEADER_WIDE_MAX_DEPTH   4
+
+// Bitmap encoding option: smallest encoding of each bitmap
+#define HDL_COMPILER_ENCODING_AUTO  0xFF
+
+// Element is laid out by the device
+#define HDL_LAYOUT_NONE             0
+// Position and size of the element are resolved, the device lays out its children
+#define HDL_LAYOUT_BOX              1
+// Position and size of the element and its children are resolved
+#define HDL_LAYOUT_CHILDREN         2
+
+// Interval the input file is checked for changes in watch mode
+#define HDL_WATCH_INTERVAL_US       20000
 
 #define HDL_COMPILER_VERSION_MAJOR  0
 #define HDL_COMPILER_VERSION_MINOR  1
 
-// Input file path
-char input_file_path[128];
-
-const char *tagnames[] = {
-    // Box - standard middle center aligned flex element
-    "box",
-    // Switch - element that switches child disabled state according to "value" attribute
-    "switch"
-};
-enum HDL_AttrIndex {
-    HDL_ATTR_X          = 0, // X position
-    HDL_ATTR_Y          = 1, // Y position
-    HDL_ATTR_WIDTH      = 2, // Width
-    HDL_ATTR_HEIGHT     = 3, // Height
-    HDL_ATTR_FLEX       = 4, // Flex 
-    HDL_ATTR_FLEX_DIR   = 5, // Flex dir
-    HDL_ATTR_BIND       = 6, // Bindings
-    HDL_ATTR_IMG        = 7, // Bitmap image
-    HDL_ATTR_PADDING    = 8, // Padding
-    HDL_ATTR_ALIGN      = 9, // Content alignment
-    HDL_ATTR_SIZE       = 10, // Bitmap/font size
-    HDL_ATTR_DISABLED   = 11, // Disabled
-    HDL_ATTR_VALUE      = 12, // Value
-    HDL_ATTR_SPRITE     = 13, // Sprite index
-    HDL_ATTR_WIDGET     = 14, // Widget
-};
-
-const char *attrnames[] = {
-    "x",
-    "y",
-    "width",
-    "height",
-    "flex",
-    "flexdir",
-    "bind",
-    "img",
-    "padding",
-    "align",
-    "size",
-    "disabled",
-    "value",
-    "sprite",
-    "widget"
-};
+// Built-in tag and attribute schema, used if no schema file is given
+const char *default_schema =
+    "# Box - standard middle center aligned flex element\n"
+    "tag box 0\n"
+    "# Switch - element that switches child disabled state according to \"value\" attribute\n"
+    "tag switch 1\n"
+    "attr x 0 int           # X position\n"
+    "attr y 1 int           # Y position\n"
+    "attr width 2 int       # Width\n"
+    "attr height 3 int      # Height\n"
+    "attr flex 4 int        # Flex\n"
+    "attr flexdir 5 int     # Flex dir, \"col\" or \"row\" is lowered to 1 or 2\n"
+    "attr bind 6 bind       # Bindings\n"
+    "attr img 7 img         # Bitmap image\n"
+    "attr padding 8 int     # Padding\n"
+    "attr align 9 int       # Content alignment, \"<y> <x>\" is lowered to y | x << 4\n"
+    "attr size 10 int       # Bitmap/font size\n"
+    "attr disabled 11 bool  # Disabled\n"
+    "attr value 12 int      # Value\n"
+    "attr sprite 13 int     # Sprite index\n"
+    "attr widget 14 string  # Widget\n";
+
+// Tags and attributes being compiled
+struct HDL_Schema schema;
+// Ids of the attributes the compiler handles itself, 0xFF if not in the schema
+uint8_t attr_flexdir = 0xFF;
+uint8_t attr_align = 0xFF;
+uint8_t attr_img = 0xFF;
+uint8_t attr_sprite = 0xFF;
+uint8_t attr_x = 0xFF;
+uint8_t attr_y = 0xFF;
+uint8_t attr_width = 0xFF;
+uint8_t attr_height = 0xFF;
+uint8_t attr_flex = 0xFF;
+uint8_t attr_padding = 0xFF;
 
 const char *alignment_x[] = {
     "center",
@@ -79,308 +108,2004 @@ const char *alignment_y[] = {
     "bottom"
 };
 
-uint8_t findTag (char *tagname) {
-    for(int x = 0; x < sizeof(tagnames) / sizeof(const char *); x++) {
-        if(strcmp(tagname, tagnames[x]) == 0) {
-            return x;
-        }
+// Values of lowered flexdir and align attributes, lowered attributes point in to these.
+// Align is the Y alignment in the low and the X alignment in the high nibble
+const int32_t flexdir_values[] = { 0, 1, 2 };
+const int32_t align_values[3][3] = {
+    { 0x00, 0x01, 0x02 },
+    { 0x10, 0x11, 0x12 },
+    { 0x20, 0x21, 0x22 }
+};
+
+uint8_t findTag (const char *tagname) {
+    struct HDL_SchemaEntry *entry = HDL_SchemaFind(&schema.tags, tagname, strlen(tagname));
+    return entry != NULL ? entry->id : 0xFF;
+}
+
+uint8_t findAttr (const char *attrname) {
+    struct HDL_SchemaEntry *entry = HDL_SchemaFind(&schema.attrs, attrname, strlen(attrname));
+    return entry != NULL ? entry->id : 0xFF;
+}
+
+/**
+ * @brief Loads the tag and attribute schema
+ * 
+ * @param path Schema file, NULL for the built-in schema
+ * @return int 0 on success
+ */
+int loadSchema (const char *path) {
+    int err = path != NULL ? HDL_SchemaLoadFile(&schema, path) : HDL_SchemaLoad(&schema, default_schema, strlen(default_schema), "built-in schema");
+    if(err) {
+        return 1;
     }
-    return 0xFF;
+    attr_flexdir = findAttr("flexdir");
+    attr_align = findAttr("align");
+    attr_img = findAttr("img");
+    attr_sprite = findAttr("sprite");
+    attr_x = findAttr("x");
+    attr_y = findAttr("y");
+    attr_width = findAttr("width");
+    attr_height = findAttr("height");
+    attr_flex = findAttr("flex");
+    attr_padding = findAttr("padding");
+    return 0;
+}
+
+// Always write the wide format
+uint8_t force_wide_index = 0;
+// Write the offset directory
+uint8_t directory = 0;
+// Write contents and string attributes as indices in to a string table
+uint8_t string_table = 0;
+// Write attributes as a presence bitmask and varints
+uint8_t compact_attrs = 0;
+// Pad multi-byte fields to their size, so they can be read with plain loads
+uint8_t align_fields = 0;
+// Alignment of bitmap records and data in the aligned layout, 4 to 32
+uint32_t payload_alignment = 4;
+// Write multi-byte fields big endian
+uint8_t big_endian = 0;
+// Encoding of bitmap data, HDL_COMPILER_ENCODING_AUTO picks the smallest for each bitmap
+uint8_t bitmap_encoding = HDL_ENCODING_RAW;
+// Screen the flex layout is resolved for, 0 if it is left to the device
+uint32_t screen_width = 0;
+uint32_t screen_height = 0;
+
+// Data of a bitmap as it is written
+struct HDL_EncodedBitmap {
+    // Encoded data, NULL if the bitmap is written raw
+    uint8_t *data;
+    uint32_t size;
+    uint8_t encoding;
+};
+
+// State of compiling a document. Options above are only read while compiling, so documents
+// can be compiled in parallel, each with its own context
+struct HDL_CompileContext {
+    // Maps of the last full compile, reset by the next one so a long watch does not grow the document arena
+    struct HDL_Arena arena;
+
+    // Tag and attribute codes of the document symbols, 0xFF if not a known tag or attribute
+    uint8_t *symbol_tags;
+    uint8_t *symbol_attrs;
+    // Number of symbols mapped to tag and attribute codes, and room for them
+    uint32_t symbol_map_count;
+    uint32_t symbol_alloc_count;
+    // Format being written, counts, sizes and indices are 32-bit if set
+    uint8_t wide_index;
+
+    // Strings of the string table, NULL if strings are written inline
+    struct HDL_SymbolTable *strings;
+    // Offset of each string in the pool
+    uint32_t *string_offsets;
+    // Strings, suffixes of other strings are not stored separately
+    char *string_pool;
+    uint32_t string_pool_size;
+
+    // First bitmap with the same pixels and format for each bitmap, only bitmaps that are their own alias are written
+    uint32_t *bitmap_alias;
+    // Number of bitmaps written
+    uint32_t bitmap_count;
+    // Id each bitmap is written with, bitmaps are numbered densely in write order so the directory is indexed by id
+    uint32_t *bitmap_ids;
+    // First sprite cell with the same pixels for each cell of each bitmap, NULL until needed
+    uint32_t **sprite_alias;
+    // Data of each bitmap of the last compile, encoded before the format is picked so the encoded size decides it
+    struct HDL_EncodedBitmap *encoded_bitmaps;
+    uint32_t encoded_count;
+
+    // Output offset of each element of the last compile, one past the last element is the end of the output
+    uint32_t *element_offsets;
+
+    // Numeric values written with a narrower type than they were parsed with in the last compile
+    uint32_t narrowed_values;
+
+    // Binding slots used by the document in slot order, the vartable count
+    uint8_t binding_slots[256];
+    uint32_t binding_count;
+    // Dependencies of each slot are binding_starts[i] to binding_starts[i + 1], in document order
+    uint32_t binding_starts[257];
+    // Element and attribute key of each dependency
+    uint32_t *binding_elements;
+    uint8_t *binding_keys;
+    // Most dependencies of a slot
+    uint32_t binding_max_count;
+
+    // Layout of each element by the compiler (HDL_LAYOUT_*), laid out elements are written with absolute x, y, width and height
+    // and without flex attributes
+    uint8_t *layout_resolved;
+    // Absolute x, y, width and height of each laid out element
+    int32_t *layout_boxes;
+    // Number of elements laid out and left to the device in the last compile
+    uint32_t layout_count;
+    uint32_t layout_skipped;
+};
+
+/**
+ * @brief Checks if a bitmap fits the compact format
+ * 
+ * @param bmp 
+ * @param size Size of the data as it is written
+ * @return int 1 if the wide format is needed
+ */
+int bitmapNeedsWideIndex (struct HDL_Bitmap *bmp, uint32_t size) {
+    return bmp->id > UINT16_MAX || size > UINT16_MAX || bmp->sprite_width > UINT8_MAX || bmp->sprite_height > UINT8_MAX;
 }
 
-uint8_t findAttr (char *attrname) {
-    for(int x = 0; x < sizeof(attrnames) / sizeof(const char *); x++) {
-        if(strcmp(attrname, attrnames[x]) == 0) {
-            return x;
+/**
+ * @brief Checks if a range of elements and their attributes fit the compact format
+ * 
+ * @param doc 
+ * @param first First element
+ * @param count Number of elements
+ * @return int 1 if the wide format is needed
+ */
+int elementsNeedWideIndex (struct HDL_Document *doc, uint32_t first, uint32_t count) {
+    for(uint32_t i = first; i < first + count; i++) {
+        struct HDL_Element *element = &doc->elements[i];
+        // Laid out elements may get up to 4 more attributes
+        if(element->attrCount + (screen_width != 0 ? 4 : 0) > UINT8_MAX || element->childCount > UINT8_MAX) {
+            return 1;
+        }
+        for(uint32_t a = element->attrStart; a < element->attrStart + element->attrCount; a++) {
+            if(doc->attrs[a].count > UINT8_MAX) {
+                return 1;
+            }
+            if(doc->attrs[a].type == HDL_TYPE_IMG && *(uint32_t*)doc->attrs[a].value > UINT16_MAX) {
+                return 1;
+            }
         }
     }
-    return 0xFF;
+    return 0;
 }
 
-int compileElement (struct HDL_Document *doc, struct HDL_Element *element, uint8_t *buffer, int *pc) {
-    
-    uint8_t tagc = findTag(element->tag);
-    if(tagc == 0xFF) {
-        printf("Tag '%s' not found\r\n", element->tag);
+/**
+ * @brief Checks if a document fits the compact format (8 and 16-bit counts)
+ * 
+ * @param doc 
+ * @return int 1 if the wide format is needed
+ */
+int needsWideIndex (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    if(ctx->bitmap_count > UINT8_MAX || doc->elementCount > UINT16_MAX || doc->maxDepth > UINT8_MAX) {
         return 1;
     }
-    buffer[(*pc)++] = tagc;
-    int str_len = 0;
-    if(element->content != NULL) {
-        str_len = strlen(element->content);
+    if(ctx->strings != NULL && (ctx->strings->count > UINT16_MAX || ctx->string_pool_size > UINT16_MAX)) {
+        return 1;
     }
-    if(str_len == 0) {
-        buffer[(*pc)] = 0;
+    if(ctx->binding_count > UINT8_MAX || ctx->binding_max_count > UINT16_MAX) {
+        return 1;
     }
-    else {
-        memcpy(&buffer[(*pc)], element->content, str_len + 1);
+    for(uint32_t i = 0; i < doc->bitmapCount; i++) {
+        if(ctx->bitmap_alias[i] == i && bitmapNeedsWideIndex(&doc->bitmaps[i], ctx->encoded_bitmaps[i].size)) {
+            return 1;
+        }
     }
-    (*pc) += str_len + 1;
+    return elementsNeedWideIndex(doc, 0, doc->elementCount);
+}
 
-    // Save address count position
-    int attrCountAddr = (*pc);
-    buffer[(*pc)++] = element->attrCount;
-    for(int i = 0; i < element->attrCount; i++) {
-        uint8_t attr = findAttr(element->attrs[i].key);
-        if(attr == 0xFF) {
-            // Attribute not defined
-            buffer[attrCountAddr]--;
-            printf("Skipping attribute '%s' - not defined\r\n", element->attrs[i].key);
+/**
+ * @brief Maps every symbol of the document to a tag and attribute code, so elements are compiled without string compares
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+int mapSymbols (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    uint32_t count = doc->symbols.count;
+    // Maps are reused, an edit only grows them by its new symbols
+    if(count + 1 > ctx->symbol_alloc_count) {
+        uint8_t *tags = realloc(ctx->symbol_tags, count + 1);
+        if(tags == NULL) {
+            return 1;
         }
-        else {
-            buffer[(*pc)++] = attr;
-            void *val = element->attrs[i].value;
-            float ftemp = 0;
-            if(attr == HDL_ATTR_FLEX_DIR) {
+        ctx->symbol_tags = tags;
+        uint8_t *attrs = realloc(ctx->symbol_attrs, count + 1);
+        if(attrs == NULL) {
+            return 1;
+        }
+        ctx->symbol_attrs = attrs;
+        ctx->symbol_alloc_count = count + 1;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        const char *name = HDL_SymbolName(&doc->symbols, i);
+        ctx->symbol_tags[i] = findTag(name);
+        ctx->symbol_attrs[i] = findAttr(name);
+    }
+    ctx->symbol_map_count = count;
+    return 0;
+}
+
+/**
+ * @brief Checks if any attribute of a range of elements is a binding
+ * 
+ * @param doc 
+ * @param first First element
+ * @param count Number of elements
+ * @return int 1 if an attribute is bound
+ */
+int elementsHaveBindings (struct HDL_Document *doc, uint32_t first, uint32_t count) {
+    for(uint32_t i = first; i < first + count; i++) {
+        struct HDL_Element *element = &doc->elements[i];
+        for(uint32_t a = element->attrStart; a < element->attrStart + element->attrCount; a++) {
+            if(doc->attrs[a].type == HDL_TYPE_BIND) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Collects the elements and attribute keys that depend on each binding slot
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+int buildBindings (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    uint32_t counts[256] = { 0 };
+    uint32_t total = 0;
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        struct HDL_Element *element = &doc->elements[i];
+        for(uint32_t a = element->attrStart; a < element->attrStart + element->attrCount; a++) {
+            if(doc->attrs[a].type == HDL_TYPE_BIND && ctx->symbol_attrs[doc->attrs[a].key] != 0xFF) {
+                counts[*(uint8_t*)doc->attrs[a].value]++;
+                total++;
+            }
+        }
+    }
+
+    ctx->binding_count = 0;
+    ctx->binding_max_count = 0;
+    ctx->binding_starts[0] = 0;
+    for(uint32_t slot = 0; slot < 256; slot++) {
+        if(counts[slot] == 0) {
+            continue;
+        }
+        ctx->binding_slots[ctx->binding_count] = slot;
+        ctx->binding_starts[ctx->binding_count + 1] = ctx->binding_starts[ctx->binding_count] + counts[slot];
+        if(counts[slot] > ctx->binding_max_count) {
+            ctx->binding_max_count = counts[slot];
+        }
+        // Counts become the next free dependency of the slot
+        counts[slot] = ctx->binding_starts[ctx->binding_count];
+        ctx->binding_count++;
+    }
+    ctx->binding_elements = NULL;
+    ctx->binding_keys = NULL;
+    if(total == 0) {
+        return 0;
+    }
+
+    ctx->binding_elements = HDL_ArenaAlloc(&ctx->arena, sizeof(uint32_t) * total);
+    ctx->binding_keys = HDL_ArenaAlloc(&ctx->arena, total);
+    if(ctx->binding_elements == NULL || ctx->binding_keys == NULL) {
+        return 1;
+    }
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        struct HDL_Element *element = &doc->elements[i];
+        for(uint32_t a = element->attrStart; a < element->attrStart + element->attrCount; a++) {
+            uint8_t key = ctx->symbol_attrs[doc->attrs[a].key];
+            if(doc->attrs[a].type == HDL_TYPE_BIND && key != 0xFF) {
+                uint32_t dep = counts[*(uint8_t*)doc->attrs[a].value]++;
+                ctx->binding_elements[dep] = i;
+                ctx->binding_keys[dep] = key;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads an integer value of an attribute array
+ * 
+ * @param val Values
+ * @param type Integer type of the values
+ * @param index 
+ * @return int64_t 
+ */
+int64_t attrInt (void *val, enum HDL_Type type, uint32_t index) {
+    switch(type) {
+        case HDL_TYPE_I8:
+            return ((int8_t*)val)[index];
+        case HDL_TYPE_I16:
+            return ((int16_t*)val)[index];
+        case HDL_TYPE_I32:
+            return ((int32_t*)val)[index];
+        case HDL_TYPE_I64:
+            return ((int64_t*)val)[index];
+        case HDL_TYPE_U8:
+            return ((uint8_t*)val)[index];
+        case HDL_TYPE_U16:
+            return ((uint16_t*)val)[index];
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Finds a name in a list
+ * 
+ * @param names 
+ * @param count 
+ * @param name Name, does not need to be null terminated
+ * @param len Length of the name
+ * @return int Index, -1 if not found
+ */
+int findName (const char **names, int count, const char *name, size_t len) {
+    for(int i = 0; i < count; i++) {
+        if(strlen(names[i]) == len && strncmp(names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Converts string values of attributes with a fixed set of values (flexdir, align) to integers
+ * 
+ * Done before compiling, so every string that is left is written as a string
+ * 
+ * @param doc 
+ * @param first First element
+ * @param count Number of elements
+ * @return int 0 on success
+ */
+int lowerAttributes (struct HDL_CompileContext *ctx, struct HDL_Document *doc, uint32_t first, uint32_t count) {
+    for(uint32_t e = first; e < first + count; e++) {
+        struct HDL_Element *element = &doc->elements[e];
+        struct HDL_Attr *attrs = &doc->attrs[element->attrStart];
+        for(uint32_t i = 0; i < element->attrCount; i++) {
+            uint8_t attr = ctx->symbol_attrs[attrs[i].key];
+            if(attrs[i].type != HDL_TYPE_STRING || attr == 0xFF || (attr != attr_flexdir && attr != attr_align)) {
+                continue;
+            }
+            // Value may be shared with a variable, it is not modified
+            const char *str = attrs[i].value;
+            const int32_t *ival;
+            if(attr == attr_flexdir) {
                 // Flex direction attribute
-                if(element->attrs[i].type == HDL_TYPE_STRING) {
-                    val = &ftemp;
-                    ftemp = 1;
-                    element->attrs[i].type = HDL_TYPE_FLOAT;
-                    if(strcmp((char*)element->attrs[i].value, "col") == 0) {
-                        ftemp = 1;
-                    }
-                    else if(strcmp((char*)element->attrs[i].value, "row") == 0) {
-                        ftemp = 2;
-                    }
-                    else {
-                        printf("Unknown value '%s' given for 'flexdir'\r\n");
-                    }
+                ival = &flexdir_values[1];
+                if(strcmp(str, "col") == 0) {
+                    ival = &flexdir_values[1];
+                }
+                else if(strcmp(str, "row") == 0) {
+                    ival = &flexdir_values[2];
+                }
+                else {
+                    printf("Unknown value '%s' given for 'flexdir'\r\n", str);
                 }
             }
-            else if(attr == HDL_ATTR_ALIGN) {
+            else {
                 // Alignment
                 // 2 part string in format "yalign xalign"
                 // Example "middle center", "top right", "bottom center"
-                if(element->attrs[i].type == HDL_TYPE_STRING) {
-                    char *y_string = element->attrs[i].value;
-                    char *x_string = NULL;
-                    int slen = strlen(y_string);
-                    element->attrs[i].type = HDL_TYPE_FLOAT;
-                    ftemp = 0;
-                    val = &ftemp;
-                    for(int i = 0; slen; i++) {
-                        if(y_string[i] == ' ') {
-                            y_string[i] = 0;
-                            x_string = &y_string[i + 1];
-                            break;
-                        }
+                ival = &align_values[0][0];
+                const char *x_string = strchr(str, ' ');
+                if(x_string != NULL) {
+                    int y_align = findName(alignment_y, sizeof(alignment_y) / sizeof(const char *), str, x_string - str);
+                    x_string++;
+                    int x_align = findName(alignment_x, sizeof(alignment_x) / sizeof(const char *), x_string, strlen(x_string));
+                    if(y_align < 0) {
+                        printf("Error: Unknown Y axis value given for 'align'\r\n");
                     }
-                    if(x_string != NULL) {
-                        uint8_t y_align = 0;
-                        uint8_t x_align = 0;
-                        int found = 0;
-                        for(int i = 0; i < sizeof(alignment_y) / sizeof(const char *); i++) {
-                            if(strcmp(alignment_y[i], y_string) == 0) {
-                                y_align = i;
-                                found = 1;
-                                break;
-                            }
-                        }
-                        if(!found) {
-                            printf("Error: Unknown Y axis value given for 'align'\r\n");
-                        }
-                        else {
-                            found = 0;
-                            for(int i = 0; i < sizeof(alignment_x) / sizeof(const char *); i++) {
-                                if(strcmp(alignment_x[i], x_string) == 0) {
-                                    x_align = i;
-                                    found = 1;
-                                    break;
-                                }
-                            }
-                            if(!found) {
-                                printf("Error: Unknown X axis value given for 'align'\r\n");
-                            }
-                            else {
-                                ftemp = (uint8_t)((y_align) | ((x_align) << 4));
-                            }
-                        }
+                    else if(x_align < 0) {
+                        printf("Error: Unknown X axis value given for 'align'\r\n");
                     }
                     else {
-                        printf("Error: 'align' requires vertical and horizontal alignment ex. 'middle center'\r\n");
+                        ival = &align_values[x_align][y_align];
                     }
                 }
+                else {
+                    printf("Error: 'align' requires vertical and horizontal alignment ex. 'middle center'\r\n");
+                }
+            }
+            attrs[i].type = HDL_TYPE_I32;
+            attrs[i].value = (void*)ival;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Hashes the pixels and format of a bitmap
+ * 
+ * @param bmp 
+ * @return uint64_t 
+ */
+uint64_t bitmapHash (struct HDL_Bitmap *bmp) {
+    uint16_t format[5] = { bmp->width, bmp->height, bmp->sprite_width, bmp->sprite_height, bmp->colorMode };
+    uint64_t hash = HDL_Hash(format, sizeof(format), HDL_HASH_INIT);
+    return HDL_Hash(bmp->data, bmp->size, hash);
+}
+
+/**
+ * @brief Allocates an empty open addressing index, entry + 1 or 0 if empty, kept at most half full like the symbol index
+ * 
+ * @param count Number of entries
+ * @param mask_out Size of the index - 1, the size is a power of 2
+ * @return uint32_t* Index, NULL if out of memory
+ */
+uint32_t *hashIndexAlloc (uint32_t count, uint32_t *mask_out) {
+    uint32_t size = 16;
+    while(size < (uint64_t)count * 2) {
+        size *= 2;
+    }
+    *mask_out = size - 1;
+    return calloc(size, sizeof(uint32_t));
+}
+
+/**
+ * @brief Finds bitmaps with the same pixels and format, each unique bitmap is written once
+ * 
+ * Image attributes of a duplicate are written with the id of the first equal bitmap
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+int dedupBitmaps (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    ctx->bitmap_alias = HDL_ArenaAlloc(&ctx->arena, sizeof(uint32_t) * (doc->bitmapCount + 1));
+    ctx->bitmap_ids = HDL_ArenaAlloc(&ctx->arena, sizeof(uint32_t) * (doc->bitmapCount + 1));
+    ctx->sprite_alias = HDL_ArenaAlloc(&ctx->arena, sizeof(uint32_t*) * (doc->bitmapCount + 1));
+    uint64_t *hashes = malloc(sizeof(uint64_t) * (doc->bitmapCount + 1));
+    uint32_t mask;
+    uint32_t *slots = hashIndexAlloc(doc->bitmapCount, &mask);
+    if(ctx->bitmap_alias == NULL || ctx->bitmap_ids == NULL || ctx->sprite_alias == NULL || hashes == NULL || slots == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        free(hashes);
+        free(slots);
+        return 1;
+    }
 
+    ctx->bitmap_count = 0;
+    uint32_t saved = 0;
+    for(uint32_t i = 0; i < doc->bitmapCount; i++) {
+        struct HDL_Bitmap *bmp = &doc->bitmaps[i];
+        hashes[i] = bitmapHash(bmp);
+        ctx->bitmap_alias[i] = i;
+        ctx->sprite_alias[i] = NULL;
+
+        // Only unique bitmaps are in the index, so at most one of them is equal
+        uint32_t slot = hashes[i] & mask;
+        while(slots[slot] != 0) {
+            uint32_t j = slots[slot] - 1;
+            struct HDL_Bitmap *other = &doc->bitmaps[j];
+            if(hashes[j] == hashes[i] && other->size == bmp->size 
+                && other->width == bmp->width && other->height == bmp->height 
+                && other->sprite_width == bmp->sprite_width && other->sprite_height == bmp->sprite_height
+                && other->colorMode == bmp->colorMode && memcmp(other->data, bmp->data, bmp->size) == 0) {
+                ctx->bitmap_alias[i] = j;
+                saved += bmp->size;
+                break;
             }
-            int type_addr = (*pc);
-            buffer[(*pc)++] = element->attrs[i].type;
-            buffer[(*pc)++] = element->attrs[i].count;
+            // Linear probing
+            slot = (slot + 1) & mask;
+        }
 
-            switch(element->attrs[i].type) {
-                case HDL_TYPE_NULL:
-                {
-                    buffer[(*pc)++] = 0;
-                    break;
-                }
-                case HDL_TYPE_BOOL:
-                case HDL_TYPE_BIND:
-                {
-                    buffer[(*pc)++] = *(uint8_t*)val;
-                    break;
-                }
-                case HDL_TYPE_IMG:
-                {
-                    buffer[(*pc)] = *(uint16_t*)val;
-                    (*pc) += 2;
-                    break;
-                }
-                case HDL_TYPE_FLOAT:
-                {
-                    // Optimize value
-                    float _mod = fmodf(*(float*)val, 1);
-                    uint8_t ntype = HDL_TYPE_FLOAT;
-                    if(_mod == 0) {
-                        float nval = fabsf(*(float*)val);
-                        // Integer
-                        if(nval < 0x100) {
-                            ntype = HDL_TYPE_I8;
-                        }
-                        else if(nval < 0x10000) {
-                            ntype = HDL_TYPE_I16;
-                        }
-                        else {
-                            ntype = HDL_TYPE_I32;
-                        }
-                    }
-                    for(int z = 0; z < element->attrs[i].count; z++) {
-                        switch(ntype) {
-                            case HDL_TYPE_FLOAT:
-                            {
-                                *(float*)&buffer[*pc] = (float)((float*)val)[z];
-                                (*pc) += sizeof(float);
-                                break;
-                            }
-                            case HDL_TYPE_I8:
-                            {
-                                *(int8_t*)&buffer[*pc] = (int8_t)((float*)val)[z];
-                                (*pc) += sizeof(int8_t);
-                                break;
-                            }
-                            case HDL_TYPE_I16:
-                            {
-                                *(int16_t*)&buffer[*pc] = (int16_t)((float*)val)[z];
+        if(ctx->bitmap_alias[i] == i) {
+            slots[slot] = i + 1;
+            ctx->bitmap_ids[i] = ctx->bitmap_count++;
+        }
+        else {
+            ctx->bitmap_ids[i] = ctx->bitmap_ids[ctx->bitmap_alias[i]];
+        }
+    }
+    free(hashes);
+    free(slots);
 
-                                (*pc) += sizeof(int16_t);
-                                break;
-                            }
-                            case HDL_TYPE_I32:
-                            {
-                                *(int32_t*)&buffer[*pc] = (int32_t)((float*)val)[z];
-                                (*pc) += sizeof(int32_t);
-                                break;
-                            }
-                        }
-                    }
-                    buffer[type_addr] = ntype;
-                    break;
-                }
-                case HDL_TYPE_STRING:
-                {
-                    int len = strlen((char*)val);
-                    memcpy((char*)&buffer[*pc], (char*)val, len + 1);
-                    (*pc) += len + 1;
-                    break;
-                }
+    if(ctx->bitmap_count != doc->bitmapCount) {
+        printf("Note: %u duplicate bitmaps written once, %uB saved\r\n", doc->bitmapCount - ctx->bitmap_count, saved);
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies the pixels of a sprite cell of a mono bitmap, rows are packed to whole bytes
+ * 
+ * @param bmp 
+ * @param cell Cell index, cells are numbered row by row
+ * @param out (sprite_width + 7) / 8 * sprite_height bytes
+ */
+void spriteCell (struct HDL_Bitmap *bmp, uint32_t cell, uint8_t *out) {
+    uint32_t columns = bmp->width / bmp->sprite_width;
+    uint32_t x0 = (cell % columns) * bmp->sprite_width;
+    uint32_t y0 = (cell / columns) * bmp->sprite_height;
+    uint32_t row = (bmp->width + 7) / 8;
+    uint32_t cellRow = (bmp->sprite_width + 7) / 8;
+    memset(out, 0, cellRow * bmp->sprite_height);
+    for(uint32_t y = 0; y < bmp->sprite_height; y++) {
+        const uint8_t *src = &bmp->data[(y0 + y) * row];
+        for(uint32_t x = 0; x < bmp->sprite_width; x++) {
+            uint32_t sx = x0 + x;
+            if(src[sx / 8] & (1 << (7 - sx % 8))) {
+                out[y * cellRow + x / 8] |= 1 << (7 - x % 8);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Finds the first equal cell of every sprite cell of a bitmap
+ * 
+ * @param doc 
+ * @param index Bitmap index
+ * @return uint32_t* Index of the first equal cell for each cell, NULL on failure
+ */
+uint32_t *spriteCellAliases (struct HDL_CompileContext *ctx, struct HDL_Document *doc, uint32_t index) {
+    struct HDL_Bitmap *bmp = &doc->bitmaps[index];
+    uint32_t cells = (bmp->width / bmp->sprite_width) * (bmp->height / bmp->sprite_height);
+    size_t cellSize = (bmp->sprite_width + 7) / 8 * bmp->sprite_height;
+    uint32_t *alias = HDL_ArenaAlloc(&ctx->arena, sizeof(uint32_t) * (cells + 1));
+    uint64_t *hashes = malloc(sizeof(uint64_t) * (cells + 1));
+    uint8_t *pixels = malloc(cellSize * cells + 1);
+    uint32_t mask;
+    uint32_t *slots = hashIndexAlloc(cells, &mask);
+    if(alias == NULL || hashes == NULL || pixels == NULL || slots == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        free(hashes);
+        free(pixels);
+        free(slots);
+        return NULL;
+    }
+    for(uint32_t i = 0; i < cells; i++) {
+        uint8_t *cell = pixels + i * cellSize;
+        spriteCell(bmp, i, cell);
+        hashes[i] = HDL_Hash(cell, cellSize, HDL_HASH_INIT);
+        alias[i] = i;
+
+        // Only unique cells are in the index
+        uint32_t slot = hashes[i] & mask;
+        while(slots[slot] != 0) {
+            uint32_t j = slots[slot] - 1;
+            if(hashes[j] == hashes[i] && memcmp(pixels + j * cellSize, cell, cellSize) == 0) {
+                alias[i] = j;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if(alias[i] == i) {
+            slots[slot] = i + 1;
+        }
+    }
+    free(hashes);
+    free(pixels);
+    free(slots);
+    return alias;
+}
+
+/**
+ * @brief Finds the sprite attribute of an element that shows a cell of a mono sprite sheet
+ * 
+ * @param element 
+ * @param sprite_out Sprite attribute
+ * @return int64_t Index of the written bitmap of the sheet, -1 if the element shows no such cell
+ */
+int64_t spriteSheet (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Element *element, struct HDL_Attr **sprite_out) {
+    struct HDL_Attr *img = NULL;
+    struct HDL_Attr *sprite = NULL;
+    for(uint32_t i = element->attrStart; i < element->attrStart + element->attrCount; i++) {
+        struct HDL_Attr *attr = &doc->attrs[i];
+        if(attr_img != 0xFF && ctx->symbol_attrs[attr->key] == attr_img && attr->type == HDL_TYPE_IMG) {
+            img = attr;
+        }
+        else if(attr_sprite != 0xFF && ctx->symbol_attrs[attr->key] == attr_sprite && attr->count == 1 && attrInt(attr->value, attr->type, 0) > 0) {
+            sprite = attr;
+        }
+    }
+    if(img == NULL || sprite == NULL || *(uint32_t*)img->value >= doc->bitmapCount) {
+        return -1;
+    }
+
+    uint32_t index = ctx->bitmap_alias[*(uint32_t*)img->value];
+    struct HDL_Bitmap *bmp = &doc->bitmaps[index];
+    if(bmp->colorMode != HDL_COLORS_MONO || bmp->sprite_width == 0 || bmp->sprite_height == 0
+        || (bmp->sprite_width == bmp->width && bmp->sprite_height == bmp->height)) {
+        return -1;
+    }
+    *sprite_out = sprite;
+    return index;
+}
+
+/**
+ * @brief Finds the equal cells of the sprite sheets shown by a range of elements
+ * 
+ * @param doc 
+ * @param first First element
+ * @param count Number of elements
+ * @return int 0 on success
+ */
+int aliasSprites (struct HDL_CompileContext *ctx, struct HDL_Document *doc, uint32_t first, uint32_t count) {
+    for(uint32_t e = first; e < first + count; e++) {
+        struct HDL_Attr *sprite;
+        int64_t index = spriteSheet(ctx, doc, &doc->elements[e], &sprite);
+        if(index >= 0 && ctx->sprite_alias[index] == NULL) {
+            ctx->sprite_alias[index] = spriteCellAliases(ctx, doc, index);
+            if(ctx->sprite_alias[index] == NULL) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Points the sprite attribute of an element to the first cell with the same pixels, so a runtime decodes and caches each cell once
+ * 
+ * @param element 
+ * @param alias_out Sprite attribute as it is written
+ * @param value_out Value of alias_out
+ * @return struct HDL_Attr* Sprite attribute of the element that alias_out replaces, NULL if it is written as is
+ */
+struct HDL_Attr *spriteAlias (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Element *element, struct HDL_Attr *alias_out, int64_t *value_out) {
+    struct HDL_Attr *sprite;
+    int64_t index = spriteSheet(ctx, doc, element, &sprite);
+    if(index < 0 || ctx->sprite_alias[index] == NULL) {
+        return NULL;
+    }
+    struct HDL_Bitmap *bmp = &doc->bitmaps[index];
+    int64_t cell = attrInt(sprite->value, sprite->type, 0);
+    uint32_t cells = (bmp->width / bmp->sprite_width) * (bmp->height / bmp->sprite_height);
+    if(cell >= cells || ctx->sprite_alias[index][cell] == cell) {
+        return NULL;
+    }
+    // Value may be shared with a variable, the document is not modified
+    *value_out = ctx->sprite_alias[index][cell];
+    *alias_out = *sprite;
+    alias_out->value = value_out;
+    alias_out->type = HDL_TYPE_I64;
+    return sprite;
+}
+
+// String of the string table and its id, sorted without the table
+struct HDL_StringRef {
+    const char *str;
+    uint32_t id;
+};
+
+/**
+ * @brief Orders strings by their reversed text, a string comes right before the strings it is a suffix of
+ * 
+ * @param a struct HDL_StringRef
+ * @param b struct HDL_StringRef
+ * @return int 
+ */
+int compareReversed (const void *a, const void *b) {
+    const char *sa = ((const struct HDL_StringRef*)a)->str;
+    const char *sb = ((const struct HDL_StringRef*)b)->str;
+    size_t la = strlen(sa);
+    size_t lb = strlen(sb);
+    while(la > 0 && lb > 0) {
+        uint8_t ca = sa[--la];
+        uint8_t cb = sb[--lb];
+        if(ca != cb) {
+            return ca - cb;
+        }
+    }
+    return (la > 0) - (lb > 0);
+}
+
+/**
+ * @brief Collects element contents and string attributes in to a string table
+ * 
+ * Equal strings are stored once, and a string that is the end of another string
+ * points in to it ("ok" is stored in "look")
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+int buildStringTable (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    ctx->strings = HDL_ArenaAlloc(&ctx->arena, sizeof(struct HDL_SymbolTable));
+    if(ctx->strings == NULL || HDL_SymbolsInit(ctx->strings, &ctx->arena)) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
+
+    // String 0 is the empty string, used for elements without content
+    int err = HDL_SymbolIntern(ctx->strings, "", 0) < 0;
+    for(uint32_t e = 0; e < doc->elementCount && !err; e++) {
+        if(doc->contents[e] != NULL) {
+            err |= HDL_SymbolIntern(ctx->strings, doc->contents[e], strlen(doc->contents[e])) < 0;
+        }
+        struct HDL_Element *element = &doc->elements[e];
+        for(uint32_t i = element->attrStart; i < element->attrStart + element->attrCount; i++) {
+            struct HDL_Attr *attr = &doc->attrs[i];
+            if(attr->type == HDL_TYPE_STRING && ctx->symbol_attrs[attr->key] != 0xFF) {
+                err |= HDL_SymbolIntern(ctx->strings, attr->value, strlen(attr->value)) < 0;
+            }
+        }
+    }
+
+    uint32_t count = ctx->strings->count;
+    struct HDL_StringRef *order = malloc(sizeof(struct HDL_StringRef) * count);
+    ctx->string_offsets = HDL_ArenaAlloc(&ctx->arena, sizeof(uint32_t) * count);
+    ctx->string_pool = HDL_ArenaAlloc(&ctx->arena, ctx->strings->stringSize + 1);
+    if(err || order == NULL || ctx->string_offsets == NULL || ctx->string_pool == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        free(order);
+        return 1;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        order[i].str = HDL_SymbolName(ctx->strings, i);
+        order[i].id = i;
+    }
+    qsort(order, count, sizeof(struct HDL_StringRef), compareReversed);
+
+    // Longest string of each suffix chain is stored, the others point in to its end
+    ctx->string_pool_size = 0;
+    for(int32_t i = count - 1; i >= 0; i--) {
+        const char *str = order[i].str;
+        size_t len = strlen(str);
+        if((uint32_t)i + 1 < count) {
+            const char *next = order[i + 1].str;
+            size_t nlen = strlen(next);
+            if(nlen >= len && memcmp(next + nlen - len, str, len) == 0) {
+                ctx->string_offsets[order[i].id] = ctx->string_offsets[order[i + 1].id] + (nlen - len);
+                continue;
+            }
+        }
+        ctx->string_offsets[order[i].id] = ctx->string_pool_size;
+        memcpy(ctx->string_pool + ctx->string_pool_size, str, len + 1);
+        ctx->string_pool_size += len + 1;
+    }
+    free(order);
+    return 0;
+}
+
+/**
+ * @brief Writes a multi-byte field, padded to its size in the aligned layout
+ * 
+ * @param out 
+ * @param value 
+ * @param size 
+ * @return int 0 on success
+ */
+int compileField (struct HDL_Output *out, uint64_t value, int size) {
+    if(align_fields && HDL_OutputAlign(out, size)) {
+        return 1;
+    }
+    return HDL_OutputUint(out, value, size);
+}
+
+/**
+ * @brief Writes the string table: string count, pool size, offset of each string in the pool and the pool
+ * 
+ * @param out 
+ * @return int 0 on success
+ */
+int compileStrings (struct HDL_CompileContext *ctx, struct HDL_Output *out) {
+    int size = ctx->wide_index ? 4 : 2;
+    compileField(out, ctx->strings->count, size);
+    compileField(out, ctx->string_pool_size, size);
+    for(uint32_t i = 0; i < ctx->strings->count; i++) {
+        compileField(out, ctx->string_offsets[i], size);
+    }
+    HDL_OutputWrite(out, ctx->string_pool, ctx->string_pool_size);
+    return out->error;
+}
+
+/**
+ * @brief Writes a string, as an index in to the string table if it is written
+ * 
+ * @param out 
+ * @param str String, NULL for an empty string
+ * @return int 0 on success
+ */
+int compileString (struct HDL_CompileContext *ctx, struct HDL_Output *out, const char *str) {
+    if(str == NULL) {
+        str = "";
+    }
+    if(ctx->strings != NULL) {
+        return compileField(out, HDL_SymbolFind(ctx->strings, str, strlen(str)), ctx->wide_index ? 4 : 2);
+    }
+    return HDL_OutputWrite(out, str, strlen(str) + 1);
+}
+
+/**
+ * @brief Returns the smallest type the values of a numeric attribute can be written with without loss
+ * 
+ * Every value is checked. Integers get the smallest signed or unsigned type their range fits,
+ * floats are written as integers if they are all whole numbers and that is smaller
+ * 
+ * @param val Values
+ * @param type Integer or float type of the values
+ * @param count Number of values
+ * @return uint8_t 
+ */
+uint8_t numericStorageType (void *val, enum HDL_Type type, uint32_t count) {
+    int64_t min = 0;
+    int64_t max = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        int64_t v;
+        if(type == HDL_TYPE_FLOAT) {
+            float f = ((float*)val)[i];
+            // Integers wider than 16 bits are no smaller than the float, NaN and -0 are kept
+            if(!(f >= INT16_MIN && f <= UINT16_MAX) || f != (float)(int32_t)f || (f == 0 && signbit(f))) {
+                return HDL_TYPE_FLOAT;
+            }
+            v = (int32_t)f;
+        }
+        else {
+            v = attrInt(val, type, i);
+        }
+        if(i == 0 || v < min) {
+            min = v;
+        }
+        if(i == 0 || v > max) {
+            max = v;
+        }
+    }
+
+    // Signed types are preferred at the same size, unsigned ones only add the upper half
+    if(min >= INT8_MIN && max <= INT8_MAX) {
+        return HDL_TYPE_I8;
+    }
+    if(min >= 0 && max <= UINT8_MAX) {
+        return HDL_TYPE_U8;
+    }
+    if(min >= INT16_MIN && max <= INT16_MAX) {
+        return HDL_TYPE_I16;
+    }
+    if(min >= 0 && max <= UINT16_MAX) {
+        return HDL_TYPE_U16;
+    }
+    if(type == HDL_TYPE_FLOAT) {
+        return HDL_TYPE_FLOAT;
+    }
+    if(min >= INT32_MIN && max <= INT32_MAX) {
+        return HDL_TYPE_I32;
+    }
+    return HDL_TYPE_I64;
+}
+
+/**
+ * @brief Returns a value of a numeric attribute as an integer
+ * 
+ * @param attr 
+ * @param index 
+ * @return int64_t 
+ */
+int64_t attrNumber (struct HDL_Attr *attr, uint32_t index) {
+    if(attr->type == HDL_TYPE_FLOAT) {
+        return (int64_t)((float*)attr->value)[index];
+    }
+    return attrInt(attr->value, attr->type, index);
+}
+
+/**
+ * @brief Returns the type an attribute is written with
+ * 
+ * @param attr 
+ * @return uint8_t 
+ */
+uint8_t attrStorageType (struct HDL_Attr *attr) {
+    // Numbers are written with the smallest type that keeps every value
+    if(attr->type == HDL_TYPE_FLOAT || attr->type == HDL_TYPE_I8 || attr->type == HDL_TYPE_I16 || attr->type == HDL_TYPE_I32 || attr->type == HDL_TYPE_I64
+        || attr->type == HDL_TYPE_U8 || attr->type == HDL_TYPE_U16) {
+        return numericStorageType(attr->value, attr->type, attr->count);
+    }
+    return attr->type;
+}
+
+/**
+ * @brief Reads a numeric layout attribute of an element, the last one if it is repeated
+ * 
+ * @param doc 
+ * @param element 
+ * @param key Attribute code
+ * @param value_out Value, unchanged if the attribute is not set
+ * @return int 1 if the attribute is set
+ */
+int layoutValue (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Element *element, uint8_t key, int64_t *value_out) {
+    int found = 0;
+    for(uint32_t a = element->attrStart; a < element->attrStart + element->attrCount; a++) {
+        if(key != 0xFF && ctx->symbol_attrs[doc->attrs[a].key] == key) {
+            *value_out = attrNumber(&doc->attrs[a], 0);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Checks if the compiler can lay out an element, without looking at its children
+ * 
+ * Elements with bindings are left to the device, layout attributes must be single numbers and only a root may be positioned
+ * 
+ * @param doc 
+ * @param index Element
+ * @return int 1 if the element can be laid out
+ */
+int layoutIsStatic (struct HDL_CompileContext *ctx, struct HDL_Document *doc, uint32_t index) {
+    struct HDL_Element *element = &doc->elements[index];
+    for(uint32_t a = element->attrStart; a < element->attrStart + element->attrCount; a++) {
+        struct HDL_Attr *attr = &doc->attrs[a];
+        uint8_t key = ctx->symbol_attrs[attr->key];
+        if(attr->type == HDL_TYPE_BIND) {
+            return 0;
+        }
+        if(key == 0xFF || (key != attr_x && key != attr_y && key != attr_width && key != attr_height && key != attr_flex
+                && key != attr_flexdir && key != attr_padding && key != attr_align)) {
+            continue;
+        }
+        if((key == attr_x || key == attr_y) && doc->parents[index] >= 0) {
+            return 0;
+        }
+        if(attr->count != 1 || (attr->type != HDL_TYPE_FLOAT && attr->type != HDL_TYPE_I8 && attr->type != HDL_TYPE_I16
+                && attr->type != HDL_TYPE_I32 && attr->type != HDL_TYPE_I64)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Offset of content in a larger space
+ * 
+ * @param space Space left
+ * @param align Alignment of one axis: 0 center, 1 start, 2 end
+ * @return int32_t 
+ */
+int32_t alignOffset (int32_t space, int64_t align) {
+    if(align == 1) {
+        return 0;
+    }
+    if(align == 2) {
+        return space;
+    }
+    return space / 2;
+}
+
+/**
+ * @brief Lays out the children of an element in its box
+ * 
+ * Children are placed along the flex direction (column by default) in the box inset by the padding. Children with a size
+ * on that axis keep it, the others share the rest by their flex (1 if not set). Children with a size across the axis and
+ * any space left when no child is flexible are placed by the alignment of the element
+ * 
+ * @param doc 
+ * @param index Element, its box is set
+ */
+void layoutChildren (struct HDL_CompileContext *ctx, struct HDL_Document *doc, uint32_t index) {
+    struct HDL_Element *element = &doc->elements[index];
+    const int32_t *box = &ctx->layout_boxes[index * 4];
+    int64_t padding = 0;
+    int64_t flexdir = 1;
+    int64_t align = 0;
+    layoutValue(ctx, doc, element, attr_padding, &padding);
+    layoutValue(ctx, doc, element, attr_flexdir, &flexdir);
+    layoutValue(ctx, doc, element, attr_align, &align);
+
+    // Axes are swapped for rows, so the main axis is always the first
+    int row = flexdir == 2;
+    int32_t size[2] = { box[row ? 2 : 3] - 2 * padding, box[row ? 3 : 2] - 2 * padding };
+    int32_t origin[2] = { box[row ? 0 : 1] + padding, box[row ? 1 : 0] + padding };
+    int64_t alignment[2] = { row ? align >> 4 : align & 0x0F, row ? align & 0x0F : align >> 4 };
+    uint8_t sizeKey[2] = { row ? attr_width : attr_height, row ? attr_height : attr_width };
+    for(int axis = 0; axis < 2; axis++) {
+        if(size[axis] < 0) {
+            size[axis] = 0;
+        }
+    }
+
+    int64_t fixed = 0;
+    int64_t weights = 0;
+    for(uint32_t c = 0; c < element->childCount; c++) {
+        struct HDL_Element *child = &doc->elements[doc->children[element->childStart + c]];
+        int64_t value = 0;
+        if(layoutValue(ctx, doc, child, sizeKey[0], &value)) {
+            fixed += value > 0 ? value : 0;
+        }
+        else {
+            value = 1;
+            layoutValue(ctx, doc, child, attr_flex, &value);
+            weights += value > 0 ? value : 0;
+        }
+    }
+
+    int64_t space = size[0] - fixed > 0 ? size[0] - fixed : 0;
+    int64_t pos = weights == 0 ? alignOffset(space, alignment[0]) : 0;
+    int64_t weight = 0;
+    for(uint32_t c = 0; c < element->childCount; c++) {
+        uint32_t childIndex = doc->children[element->childStart + c];
+        struct HDL_Element *child = &doc->elements[childIndex];
+        int32_t *childBox = &ctx->layout_boxes[childIndex * 4];
+
+        int64_t main = 0;
+        if(layoutValue(ctx, doc, child, sizeKey[0], &main)) {
+            main = main > 0 ? main : 0;
+        }
+        else {
+            // Rounded at both ends, so flexible children fill the space without gaps
+            int64_t flex = 1;
+            layoutValue(ctx, doc, child, attr_flex, &flex);
+            if(flex > 0) {
+                int64_t start = space * weight / weights;
+                weight += flex;
+                main = space * weight / weights - start;
+            }
+        }
+        int64_t cross = size[1];
+        int64_t crossPos = 0;
+        if(layoutValue(ctx, doc, child, sizeKey[1], &cross)) {
+            cross = cross > 0 ? cross : 0;
+            crossPos = alignOffset(size[1] - cross, alignment[1]);
+        }
+
+        childBox[row ? 0 : 1] = origin[0] + pos;
+        childBox[row ? 1 : 0] = origin[1] + crossPos;
+        childBox[row ? 2 : 3] = main;
+        childBox[row ? 3 : 2] = cross;
+        pos += main;
+    }
+}
+
+/**
+ * @brief Lays out the elements whose position and size do not depend on bindings for the screen size
+ * 
+ * Roots fill the screen unless they are positioned or sized. An element with a binding may change size or be hidden,
+ * so the device lays out the children of its parent and everything below them. The children of any other laid out
+ * element are laid out by the compiler
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+int resolveLayout (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    ctx->layout_count = 0;
+    ctx->layout_skipped = 0;
+    ctx->layout_resolved = HDL_ArenaAlloc(&ctx->arena, doc->elementCount + 1);
+    ctx->layout_boxes = HDL_ArenaAlloc(&ctx->arena, sizeof(int32_t) * 4 * (doc->elementCount + 1));
+    uint8_t *staticChildren = HDL_ArenaAlloc(&ctx->arena, doc->elementCount + 1);
+    if(ctx->layout_resolved == NULL || ctx->layout_boxes == NULL || staticChildren == NULL) {
+        return 1;
+    }
+
+    // Children of an element are static if it and all of them can be laid out
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        ctx->layout_resolved[i] = layoutIsStatic(ctx, doc, i) ? HDL_LAYOUT_BOX : HDL_LAYOUT_NONE;
+        staticChildren[i] = ctx->layout_resolved[i];
+    }
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        if(!ctx->layout_resolved[i] && doc->parents[i] >= 0) {
+            staticChildren[doc->parents[i]] = 0;
+        }
+    }
+
+    // Parents come before their children
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        int32_t parent = doc->parents[i];
+        if(parent >= 0 && ctx->layout_resolved[parent] != HDL_LAYOUT_CHILDREN) {
+            ctx->layout_resolved[i] = HDL_LAYOUT_NONE;
+        }
+        else if(parent < 0 && ctx->layout_resolved[i]) {
+            struct HDL_Element *root = &doc->elements[i];
+            int64_t x = 0;
+            int64_t y = 0;
+            layoutValue(ctx, doc, root, attr_x, &x);
+            layoutValue(ctx, doc, root, attr_y, &y);
+            int64_t width = (int64_t)screen_width - x;
+            int64_t height = (int64_t)screen_height - y;
+            layoutValue(ctx, doc, root, attr_width, &width);
+            layoutValue(ctx, doc, root, attr_height, &height);
+            ctx->layout_boxes[i * 4] = x;
+            ctx->layout_boxes[i * 4 + 1] = y;
+            ctx->layout_boxes[i * 4 + 2] = width > 0 ? width : 0;
+            ctx->layout_boxes[i * 4 + 3] = height > 0 ? height : 0;
+        }
+        if(ctx->layout_resolved[i] && staticChildren[i]) {
+            ctx->layout_resolved[i] = HDL_LAYOUT_CHILDREN;
+            layoutChildren(ctx, doc, i);
+        }
+        if(ctx->layout_resolved[i]) {
+            ctx->layout_count++;
+        }
+        else {
+            ctx->layout_skipped++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if an attribute of an element is replaced by the resolved layout
+ * 
+ * @param index Element
+ * @param key Attribute code
+ * @return int 1 if the attribute is not written
+ */
+int layoutDropsAttr (struct HDL_CompileContext *ctx, uint32_t index, uint8_t key) {
+    if(ctx->layout_resolved == NULL || !ctx->layout_resolved[index] || key == 0xFF) {
+        return 0;
+    }
+    // Flex direction is kept for the device if it lays out the children
+    return key == attr_x || key == attr_y || key == attr_width || key == attr_height || key == attr_flex
+        || (key == attr_flexdir && ctx->layout_resolved[index] == HDL_LAYOUT_CHILDREN);
+}
+
+/**
+ * @brief Returns a resolved x, y, width or height of an element as an attribute
+ * 
+ * @param index Element
+ * @param field 0 x, 1 y, 2 width, 3 height
+ * @param attr_out 
+ * @return uint8_t Attribute code
+ */
+uint8_t layoutAttr (struct HDL_CompileContext *ctx, uint32_t index, int field, struct HDL_Attr *attr_out) {
+    const uint8_t keys[4] = { attr_x, attr_y, attr_width, attr_height };
+    attr_out->value = &ctx->layout_boxes[index * 4 + field];
+    attr_out->key = 0;
+    attr_out->type = HDL_TYPE_I32;
+    attr_out->count = 1;
+    return keys[field];
+}
+
+/**
+ * @brief Writes the values of an attribute with fixed width values
+ * 
+ * @param doc 
+ * @param attr 
+ * @param out 
+ * @return int 0 on success
+ */
+int compileAttrValues (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Attr *attr, struct HDL_Output *out) {
+    void *val = attr->value;
+    switch(attr->type) {
+        case HDL_TYPE_NULL:
+        {
+            HDL_OutputByte(out, 0);
+            break;
+        }
+        case HDL_TYPE_BOOL:
+        case HDL_TYPE_BIND:
+        {
+            HDL_OutputWrite(out, val, attr->count);
+            break;
+        }
+        case HDL_TYPE_IMG:
+        {
+            // Duplicate bitmaps are written with the id of the first equal one
+            for(uint32_t z = 0; z < attr->count; z++) {
+                uint32_t id = ((uint32_t*)val)[z];
+                if(id < doc->bitmapCount) {
+                    id = ctx->bitmap_ids[id];
+                }
+                compileField(out, id, ctx->wide_index ? 4 : 2);
+            }
+            break;
+        }
+        case HDL_TYPE_FLOAT:
+        case HDL_TYPE_I8:
+        case HDL_TYPE_I16:
+        case HDL_TYPE_I32:
+        case HDL_TYPE_I64:
+        case HDL_TYPE_U8:
+        case HDL_TYPE_U16:
+        {
+            uint8_t type = attrStorageType(attr);
+            if(type == HDL_TYPE_FLOAT) {
+                // Written as their bits, so they follow the byte order of the output
+                for(uint32_t z = 0; z < attr->count; z++) {
+                    uint32_t bits;
+                    memcpy(&bits, &((float*)val)[z], sizeof(bits));
+                    compileField(out, bits, sizeof(bits));
+                }
+                break;
+            }
+            for(uint32_t z = 0; z < attr->count; z++) {
+                compileField(out, attrNumber(attr, z), HDL_TYPE_SIZES[type]);
+            }
+            if(HDL_TYPE_SIZES[type] < HDL_TYPE_SIZES[attr->type]) {
+                ctx->narrowed_values += attr->count;
+            }
+            break;
+        }
+        case HDL_TYPE_STRING:
+        {
+            compileString(ctx, out, val);
+            break;
+        }
+        case HDL_TYPE_COUNT:
+        {
+            break;
+        }
+    }
+    return out->error;
+}
+
+/**
+ * @brief Checks if an attribute is set to the default value of its schema, those are not written
+ * 
+ * @param attr 
+ * @param entry Schema of the attribute
+ * @return int 1 if the attribute has the default value
+ */
+int attrIsDefault (struct HDL_Attr *attr, struct HDL_SchemaEntry *entry) {
+    if(!entry->hasDefault || attr->count != 1) {
+        return 0;
+    }
+    switch(entry->type) {
+        case HDL_TYPE_I32:
+        {
+            uint8_t type = attr->type;
+            if(type != HDL_TYPE_FLOAT && type != HDL_TYPE_I8 && type != HDL_TYPE_I16 && type != HDL_TYPE_I32 && type != HDL_TYPE_I64) {
+                return 0;
+            }
+            // Floats only if they are whole numbers
+            return attrStorageType(attr) != HDL_TYPE_FLOAT && attrNumber(attr, 0) == entry->defaultInt;
+        }
+        case HDL_TYPE_BOOL:
+            return attr->type == HDL_TYPE_BOOL && *(uint8_t*)attr->value == entry->defaultInt;
+        case HDL_TYPE_STRING:
+            return attr->type == HDL_TYPE_STRING && strcmp(attr->value, entry->defaultString) == 0;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Writes an attribute in the compact format, with the encoding of its schema if the value matches it
+ * 
+ * @param doc 
+ * @param attr 
+ * @param key Attribute code
+ * @param out 
+ * @return int 0 on success
+ */
+int compileAttrCompact (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Attr *attr, uint8_t key, struct HDL_Output *out) {
+    uint8_t encoding = schema.attrs.byId[key]->encoding;
+    uint8_t type = attr->type;
+    // Floats match integers if they are all whole numbers
+    int match = (encoding == HDL_ATTR_ENC_INT && (type == HDL_TYPE_I8 || type == HDL_TYPE_I16 || type == HDL_TYPE_I32 || type == HDL_TYPE_I64
+            || (type == HDL_TYPE_FLOAT && attrStorageType(attr) != HDL_TYPE_FLOAT)))
+        || (encoding == HDL_ATTR_ENC_BYTE && (type == HDL_TYPE_BOOL || type == HDL_TYPE_BIND))
+        || (encoding == HDL_ATTR_ENC_UINT && type == HDL_TYPE_IMG)
+        || (encoding == HDL_ATTR_ENC_STRING && type == HDL_TYPE_STRING);
+    if(!match) {
+        HDL_OutputVarint(out, ((uint64_t)attr->count << 1) | 1);
+        HDL_OutputByte(out, attrStorageType(attr));
+        return compileAttrValues(ctx, doc, attr, out);
+    }
+
+    switch(encoding) {
+        case HDL_ATTR_ENC_INT:
+        {
+            HDL_OutputVarint(out, (uint64_t)attr->count << 1);
+            for(uint32_t z = 0; z < attr->count; z++) {
+                int64_t v = attrNumber(attr, z);
+                HDL_OutputVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+            }
+            break;
+        }
+        case HDL_ATTR_ENC_BYTE:
+        {
+            HDL_OutputVarint(out, (uint64_t)attr->count << 1);
+            HDL_OutputWrite(out, attr->value, attr->count);
+            break;
+        }
+        case HDL_ATTR_ENC_UINT:
+        {
+            HDL_OutputVarint(out, (uint64_t)attr->count << 1);
+            for(uint32_t z = 0; z < attr->count; z++) {
+                uint32_t id = ((uint32_t*)attr->value)[z];
+                if(id < doc->bitmapCount) {
+                    id = ctx->bitmap_ids[id];
+                }
+                HDL_OutputVarint(out, id);
+            }
+            break;
+        }
+        case HDL_ATTR_ENC_STRING:
+        {
+            const char *str = attr->value;
+            if(ctx->strings != NULL) {
+                HDL_OutputVarint(out, (uint64_t)HDL_SymbolFind(ctx->strings, str, strlen(str)) << 1);
+            }
+            else {
+                HDL_OutputVarint(out, (uint64_t)strlen(str) << 1);
+                HDL_OutputWrite(out, str, strlen(str));
+            }
+            break;
+        }
+    }
+    return out->error;
+}
+
+/**
+ * @brief Writes the attributes of an element in the compact format: presence bitmask, offsets and varint values
+ * 
+ * @param doc 
+ * @param element 
+ * @param out 
+ * @return int 0 on success
+ */
+int compileAttrsCompact (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Element *element, struct HDL_Output *out) {
+    // Attribute of each key, the last one if a key is repeated
+    struct HDL_Attr *present[HDL_SCHEMA_MAX_ID + 1];
+    uint8_t mask[(HDL_SCHEMA_MAX_ID + 8) / 8] = { 0 };
+    uint32_t keyCount = schema.attrs.idCount;
+    for(uint32_t k = 0; k < keyCount; k++) {
+        present[k] = NULL;
+    }
+    uint32_t index = element - doc->elements;
+    struct HDL_Attr *attrs = &doc->attrs[element->attrStart];
+    struct HDL_Attr sprite;
+    int64_t spriteValue;
+    struct HDL_Attr *aliased = spriteAlias(ctx, doc, element, &sprite, &spriteValue);
+    for(uint32_t i = 0; i < element->attrCount; i++) {
+        uint8_t attr = ctx->symbol_attrs[attrs[i].key];
+        if(attr == 0xFF) {
+            printf("Skipping attribute '%s' - not defined\r\n", HDL_SymbolName(&doc->symbols, attrs[i].key));
+            continue;
+        }
+        if(present[attr] != NULL) {
+            printf("Attribute '%s' set more than once, using the last value\r\n", schema.attrs.byId[attr]->name);
+        }
+        if(layoutDropsAttr(ctx, index, attr)) {
+            present[attr] = NULL;
+        }
+        else {
+            present[attr] = &attrs[i] == aliased ? &sprite : &attrs[i];
+        }
+    }
+    // Position and size of laid out elements
+    struct HDL_Attr box[4];
+    for(int f = 0; ctx->layout_resolved != NULL && ctx->layout_resolved[index] && f < 4; f++) {
+        present[layoutAttr(ctx, index, f, &box[f])] = &box[f];
+    }
+    for(uint32_t k = 0; k < keyCount; k++) {
+        if(present[k] != NULL && attrIsDefault(present[k], schema.attrs.byId[k])) {
+            present[k] = NULL;
+        }
+        if(present[k] != NULL) {
+            mask[k / 8] |= 1 << (k % 8);
+        }
+    }
+    HDL_OutputWrite(out, mask, (keyCount + 7) / 8);
+
+    // Values are written first, the offsets depend on their size
+    struct HDL_Output values;
+    if(HDL_OutputInitBuffer(&values, 64)) {
+        return 1;
+    }
+    uint32_t offsets[HDL_SCHEMA_MAX_ID + 1];
+    uint32_t count = 0;
+    for(uint32_t k = 0; k < keyCount; k++) {
+        if(present[k] != NULL) {
+            offsets[count++] = values.size;
+            compileAttrCompact(ctx, doc, present[k], k, &values);
+        }
+    }
+    if(count > 0) {
+        uint32_t size = values.size;
+        int offsetSize = size < 0x100 ? 1 : size < 0x10000 ? 2 : 4;
+        HDL_OutputVarint(out, size);
+        for(uint32_t i = 1; i < count; i++) {
+            HDL_OutputUint(out, offsets[i], offsetSize);
+        }
+        HDL_OutputWrite(out, values.data, size);
+    }
+    int err = values.error;
+    HDL_OutputClose(&values);
+    return err || out->error;
+}
+
+int compileElement (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Element *element, struct HDL_Output *out) {
+    
+    uint8_t tagc = ctx->symbol_tags[element->tag];
+    if(tagc == 0xFF) {
+        printf("Tag '%s' not found\r\n", HDL_SymbolName(&doc->symbols, element->tag));
+        return 1;
+    }
+    HDL_OutputByte(out, tagc);
+    compileString(ctx, out, doc->contents[element - doc->elements]);
+
+    if(compact_attrs) {
+        if(compileAttrsCompact(ctx, doc, element, out)) {
+            return 1;
+        }
+        HDL_OutputUint(out, element->childCount, ctx->wide_index ? 4 : 1);
+        return out->error;
+    }
+
+    // Count is written before the attributes, so skipped attributes are counted first
+    uint32_t index = element - doc->elements;
+    uint32_t attrCount = element->attrCount;
+    struct HDL_Attr *attrs = &doc->attrs[element->attrStart];
+    // Sprite may be written with its first equal cell
+    struct HDL_Attr sprite;
+    int64_t spriteValue;
+    struct HDL_Attr *aliased = spriteAlias(ctx, doc, element, &sprite, &spriteValue);
+    for(uint32_t i = 0; i < element->attrCount; i++) {
+        struct HDL_Attr *value = &attrs[i] == aliased ? &sprite : &attrs[i];
+        uint8_t attr = ctx->symbol_attrs[value->key];
+        if(attr == 0xFF) {
+            // Attribute not defined
+            attrCount--;
+            printf("Skipping attribute '%s' - not defined\r\n", HDL_SymbolName(&doc->symbols, value->key));
+        }
+        else if(layoutDropsAttr(ctx, index, attr) || attrIsDefault(value, schema.attrs.byId[attr])) {
+            attrCount--;
+        }
+    }
+
+    // Laid out elements are written with their position and size first
+    struct HDL_Attr box[4];
+    uint8_t boxKeys[4];
+    int boxCount = 0;
+    for(int f = 0; ctx->layout_resolved != NULL && ctx->layout_resolved[index] && f < 4; f++) {
+        boxKeys[boxCount] = layoutAttr(ctx, index, f, &box[boxCount]);
+        if(!attrIsDefault(&box[boxCount], schema.attrs.byId[boxKeys[boxCount]])) {
+            boxCount++;
+        }
+    }
+    compileField(out, attrCount + boxCount, ctx->wide_index ? 4 : 1);
+    for(int i = 0; i < boxCount; i++) {
+        HDL_OutputByte(out, boxKeys[i]);
+        HDL_OutputByte(out, attrStorageType(&box[i]));
+        compileField(out, 1, ctx->wide_index ? 4 : 1);
+        compileAttrValues(ctx, doc, &box[i], out);
+    }
+    for(uint32_t i = 0; i < element->attrCount; i++) {
+        struct HDL_Attr *value = &attrs[i] == aliased ? &sprite : &attrs[i];
+        uint8_t attr = ctx->symbol_attrs[value->key];
+        if(attr != 0xFF && !layoutDropsAttr(ctx, index, attr) && !attrIsDefault(value, schema.attrs.byId[attr])) {
+            HDL_OutputByte(out, attr);
+            HDL_OutputByte(out, attrStorageType(value));
+            compileField(out, value->count, ctx->wide_index ? 4 : 1);
+            compileAttrValues(ctx, doc, value, out);
+        }
+    }
+    compileField(out, element->childCount, ctx->wide_index ? 4 : 1);
+
+    // Children follow as the next elements
+    return out->error;
+}
+
+/**
+ * @brief Encodes the data of a bitmap with the smallest of the selected encodings
+ * 
+ * Data is only encoded if it gets smaller, so the encoded size fits wherever the raw size does
+ * 
+ * @param bmp 
+ * @param encoding Encoding to try, HDL_COMPILER_ENCODING_AUTO tries every encoding
+ * @param data_out Encoded data, freed by the caller. NULL if the bitmap is written raw
+ * @param size_out Size of the data
+ * @param encoding_out Encoding of the data
+ * @return int 0 on success
+ */
+int encodeBitmap (struct HDL_Bitmap *bmp, uint8_t encoding, uint8_t **data_out, uint32_t *size_out, uint8_t *encoding_out) {
+    *data_out = NULL;
+    *size_out = bmp->size;
+    *encoding_out = HDL_ENCODING_RAW;
+    if(encoding == HDL_ENCODING_RAW || bmp->size == 0) {
+        return 0;
+    }
+
+    size_t bound = HDL_EncodeBound(bmp->size);
+    uint8_t *best = malloc(bound);
+    uint8_t *scratch = malloc(bound);
+    if(best == NULL || scratch == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        free(best);
+        free(scratch);
+        return 1;
+    }
+    for(uint8_t e = HDL_ENCODING_PACKBITS; e < HDL_ENCODING_COUNT; e++) {
+        if(encoding != HDL_COMPILER_ENCODING_AUTO && encoding != e) {
+            continue;
+        }
+        size_t size = HDL_Encode(e, bmp->data, bmp->size, scratch);
+        if(size < *size_out) {
+            uint8_t *tmp = best;
+            best = scratch;
+            scratch = tmp;
+            *size_out = size;
+            *encoding_out = e;
+        }
+    }
+    free(scratch);
+    if(*encoding_out == HDL_ENCODING_RAW) {
+        free(best);
+        return 0;
+    }
+    *data_out = best;
+    return 0;
+}
+
+/**
+ * @brief Frees the encoded data of the last compile
+ * 
+ */
+void freeEncodedBitmaps (struct HDL_CompileContext *ctx) {
+    for(uint32_t i = 0; i < ctx->encoded_count; i++) {
+        free(ctx->encoded_bitmaps[i].data);
+    }
+    free(ctx->encoded_bitmaps);
+    ctx->encoded_bitmaps = NULL;
+    ctx->encoded_count = 0;
+}
+
+/**
+ * @brief Initializes an empty compile context
+ * 
+ */
+void compileContextInit (struct HDL_CompileContext *ctx) {
+    memset(ctx, 0, sizeof(struct HDL_CompileContext));
+    HDL_ArenaInit(&ctx->arena);
+}
+
+/**
+ * @brief Frees the memory of a compile context
+ * 
+ */
+void compileContextFree (struct HDL_CompileContext *ctx) {
+    freeEncodedBitmaps(ctx);
+    free(ctx->element_offsets);
+    free(ctx->symbol_tags);
+    free(ctx->symbol_attrs);
+    HDL_ArenaFree(&ctx->arena);
+    compileContextInit(ctx);
+}
+
+/**
+ * @brief Encodes the data of every written bitmap
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+int encodeBitmaps (struct HDL_CompileContext *ctx, struct HDL_Document *doc) {
+    freeEncodedBitmaps(ctx);
+    ctx->encoded_bitmaps = calloc(doc->bitmapCount + 1, sizeof(struct HDL_EncodedBitmap));
+    if(ctx->encoded_bitmaps == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
+    ctx->encoded_count = doc->bitmapCount;
+    for(uint32_t i = 0; i < doc->bitmapCount; i++) {
+        struct HDL_EncodedBitmap *enc = &ctx->encoded_bitmaps[i];
+        // Aliases are not written
+        uint8_t encoding = ctx->bitmap_alias[i] == i ? bitmap_encoding : HDL_ENCODING_RAW;
+        if(encodeBitmap(&doc->bitmaps[i], encoding, &enc->data, &enc->size, &enc->encoding)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int compileBitmap (struct HDL_CompileContext *ctx, struct HDL_Bitmap *bmp, uint32_t id, const struct HDL_EncodedBitmap *enc, struct HDL_Output *out) {
+    compileField(out, id, ctx->wide_index ? 4 : 2);
+    compileField(out, enc->size, ctx->wide_index ? 4 : 2);
+    compileField(out, bmp->width, 2);
+    compileField(out, bmp->height, 2);
+    compileField(out, bmp->sprite_width, ctx->wide_index ? 2 : 1);
+    compileField(out, bmp->sprite_height, ctx->wide_index ? 2 : 1);
+
+    // Encoding is in the high 4 bits, raw bitmaps are unchanged
+    HDL_OutputByte(out, bmp->colorMode | (enc->encoding << 4));
+    if(align_fields) {
+        HDL_OutputAlign(out, payload_alignment);
+    }
+
+    // Big bitmaps are written straight to the output file
+    HDL_OutputWrite(out, enc->data != NULL ? enc->data : bmp->data, enc->size);
+    return out->error;
+}
+
+/**
+ * @brief Fills the offset directory after the header, placeholders for it are written before the bitmaps
+ * 
+ * @param doc 
+ * @param out 
+ * @param bitmapOffsets Output offset of each bitmap, element offsets are from element_offsets
+ * @return int 0 on success
+ */
+int writeDirectory (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Output *out, const uint32_t *bitmapOffsets) {
+    uint32_t count = ctx->bitmap_count + doc->elementCount;
+    uint8_t *entries = malloc(4 * (size_t)count + 1);
+    if(entries == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t offset = i < ctx->bitmap_count ? bitmapOffsets[i] : ctx->element_offsets[i - ctx->bitmap_count];
+        for(int b = 0; b < 4; b++) {
+            entries[i * 4 + (big_endian ? 3 - b : b)] = offset >> (b * 8);
+        }
+    }
+    // Patched at once, so a file output is written with one call
+    int err = HDL_OutputPatch(out, 16, entries, 4 * (size_t)count);
+    free(entries);
+    return err;
+}
+
+/**
+ * @brief Fills the element offsets of the vartables, placeholders for them are written before the elements
+ * 
+ * @param out 
+ * @param vartableOffsets Output offset of the element offsets of each vartable
+ * @return int 0 on success
+ */
+int writeVartables (struct HDL_CompileContext *ctx, struct HDL_Output *out, const uint32_t *vartableOffsets) {
+    if(ctx->binding_count == 0) {
+        return 0;
+    }
+    uint8_t *entries = malloc(4 * (size_t)ctx->binding_max_count);
+    if(entries == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
+    int err = 0;
+    for(uint32_t i = 0; i < ctx->binding_count && !err; i++) {
+        uint32_t count = ctx->binding_starts[i + 1] - ctx->binding_starts[i];
+        for(uint32_t d = 0; d < count; d++) {
+            uint32_t offset = ctx->element_offsets[ctx->binding_elements[ctx->binding_starts[i] + d]];
+            for(int b = 0; b < 4; b++) {
+                entries[d * 4 + (big_endian ? 3 - b : b)] = offset >> (b * 8);
             }
         }
+        err = HDL_OutputPatch(out, vartableOffsets[i], entries, 4 * (size_t)count);
     }
-    buffer[(*pc)++] = element->childCount;
-    for(int i = 0; i < element->childCount; i++) {
-        compileElement(doc, &doc->elements[element->children[i]], buffer, pc);
-    }
+    free(entries);
+    return err;
+}
 
-    return 0;
+/**
+ * @brief Returns the header flags of the format being written
+ * 
+ * @return uint8_t 
+ */
+uint8_t headerFlags (struct HDL_CompileContext *ctx) {
+    uint8_t flags = 0;
+    if(ctx->wide_index) {
+        flags |= HDL_HEADER_FLAG_WIDE;
+    }
+    if(directory) {
+        flags |= HDL_HEADER_FLAG_DIRECTORY;
+    }
+    if(ctx->strings != NULL) {
+        flags |= HDL_HEADER_FLAG_STRINGS;
+    }
+    if(compact_attrs) {
+        flags |= HDL_HEADER_FLAG_COMPACT;
+    }
+    if(align_fields) {
+        flags |= HDL_HEADER_FLAG_ALIGNED;
+        // Alignments are 4 << 0..3
+        for(uint32_t a = payload_alignment; a > 4; a >>= 1) {
+            flags += 1 << HDL_HEADER_ALIGN_SHIFT;
+        }
+    }
+    if(big_endian) {
+        flags |= HDL_HEADER_FLAG_BIG_ENDIAN;
+    }
+    return flags;
 }
 
-int compileBitmap (struct HDL_Document *doc, struct HDL_Bitmap *bmp, uint8_t *buffer, int *pc) {
-    *(uint16_t*)&buffer[*pc] = bmp->id;
-    (*pc) += 2;
-    *(uint16_t*)&buffer[*pc] = bmp->size;
-    (*pc) += 2;
-    *(uint16_t*)&buffer[*pc] = bmp->width;
-    (*pc) += 2;
-    *(uint16_t*)&buffer[*pc] = bmp->height;
-    (*pc) += 2;
-    *(uint8_t*)&buffer[*pc] = bmp->sprite_width;
-    (*pc) += 1;
-    *(uint8_t*)&buffer[*pc] = bmp->sprite_height;
-    (*pc) += 1;
+int compile (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Output *out) {
 
-    buffer[*pc] = bmp->colorMode;
-    (*pc) += 1;
+    if(doc == NULL) {
+        return 1;
+    }
 
-    memcpy(&buffer[*pc], bmp->data, bmp->size);
+    // Maps of the last compile are built again
+    HDL_ArenaReset(&ctx->arena);
+    if(mapSymbols(ctx, doc) || lowerAttributes(ctx, doc, 0, doc->elementCount)) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
 
-    (*pc) += bmp->size;
+    if(dedupBitmaps(ctx, doc) || aliasSprites(ctx, doc, 0, doc->elementCount) || encodeBitmaps(ctx, doc)) {
+        return 1;
+    }
 
-    return 0;
-}
+    ctx->layout_resolved = NULL;
+    if(buildBindings(ctx, doc) || (screen_width != 0 && resolveLayout(ctx, doc))) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
 
-int compile (struct HDL_Document *doc, uint8_t *buffer, int *pc) {
+    ctx->narrowed_values = 0;
+    out->bigEndian = big_endian;
 
-    if(doc == NULL) {
+    ctx->strings = NULL;
+    if(string_table && buildStringTable(ctx, doc)) {
         return 1;
     }
 
-    memset(buffer, 0, 16);
+    ctx->wide_index = force_wide_index;
+    if(!ctx->wide_index && needsWideIndex(ctx, doc)) {
+        printf("Note: Document does not fit 8/16-bit counts, writing wide format\r\n");
+        ctx->wide_index = 1;
+    }
 
     // Major and minor versions
-    buffer[(*pc)++] = (uint8_t)HDL_COMPILER_VERSION_MAJOR;
-    buffer[(*pc)++] = (uint8_t)HDL_COMPILER_VERSION_MINOR;
+    HDL_OutputByte(out, HDL_COMPILER_VERSION_MAJOR);
+    HDL_OutputByte(out, HDL_COMPILER_VERSION_MINOR);
+
+    if(!ctx->wide_index) {
+        // Bitmap count
+        HDL_OutputByte(out, ctx->bitmap_count);
+
+        // Vartable count
+        HDL_OutputByte(out, ctx->binding_count);
+
+        // Element count
+        HDL_OutputUint(out, doc->elementCount, 2);
+
+        // Flags and max depth
+        HDL_OutputByte(out, headerFlags(ctx));
+        HDL_OutputByte(out, doc->maxDepth);
+
+        // Padding
+        HDL_OutputUint(out, 0, 8);
+    }
+    else {
+        if(doc->maxDepth > UINT16_MAX) {
+            printf("ERROR: Elements nested too deep (%u levels)\r\n", doc->maxDepth);
+            return 1;
+        }
+
+        // Vartable count and max depth
+        HDL_OutputUint(out, ctx->binding_count, 2);
+        HDL_OutputUint(out, doc->maxDepth, 2);
+
+        // Counts are after the flags
+        HDL_OutputByte(out, headerFlags(ctx));
+        HDL_OutputByte(out, 0);
 
-    // Bitmap count
-    buffer[(*pc)++] = doc->bitmapCount;
+        // Bitmap count
+        HDL_OutputUint(out, ctx->bitmap_count, 4);
 
-    // Vartable count
-    buffer[(*pc)++] = 0;
+        // Element count
+        HDL_OutputUint(out, doc->elementCount, 4);
+    }
+
+    if(ctx->element_offsets != NULL)
+        free(ctx->element_offsets);
+    ctx->element_offsets = malloc(sizeof(uint32_t) * (doc->elementCount + 1));
+    uint32_t *bitmapOffsets = malloc(sizeof(uint32_t) * (doc->bitmapCount + 1));
+    if(ctx->element_offsets == NULL || bitmapOffsets == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        free(bitmapOffsets);
+        return 1;
+    }
 
-    // Element count
-    *(uint16_t*)&buffer[(*pc)] = doc->elementCount;
-    (*pc) += 2;
+    // Directory is filled when the offsets are known
+    if(directory) {
+        for(uint32_t i = 0; i < ctx->bitmap_count + doc->elementCount; i++) {
+            HDL_OutputUint(out, 0, 4);
+        }
+    }
 
-    // Padding
-    (*pc) = 16;
+    if(ctx->strings != NULL && compileStrings(ctx, out)) {
+        free(bitmapOffsets);
+        return 1;
+    }
 
     // Bitmaps...
-    for(int i = 0; i < doc->bitmapCount; i++) {
-        if(compileBitmap(doc, &doc->bitmaps[i], buffer, pc)) {
+    uint32_t written = 0;
+    for(uint32_t i = 0; i < doc->bitmapCount; i++) {
+        if(ctx->bitmap_alias[i] != i) {
+            continue;
+        }
+        if(align_fields) {
+            HDL_OutputAlign(out, payload_alignment);
+        }
+        bitmapOffsets[written++] = out->size;
+        if(compileBitmap(ctx, &doc->bitmaps[i], ctx->bitmap_ids[i], &ctx->encoded_bitmaps[i], out)) {
             printf("ERROR: Failed to compile bitmap\r\n");
+            free(bitmapOffsets);
+            return 1;
+        }
+    }
+
+    // Vartables: slot, dependency count, uint32 file offset of each dependent element, then the key of each bound attribute.
+    // Offsets are filled when the elements are written
+    uint32_t vartableOffsets[256];
+    for(uint32_t i = 0; i < ctx->binding_count; i++) {
+        HDL_OutputByte(out, ctx->binding_slots[i]);
+        compileField(out, ctx->binding_starts[i + 1] - ctx->binding_starts[i], ctx->wide_index ? 4 : 2);
+        if(align_fields) {
+            HDL_OutputAlign(out, 4);
+        }
+        vartableOffsets[i] = out->size;
+        for(uint32_t d = ctx->binding_starts[i]; d < ctx->binding_starts[i + 1]; d++) {
+            HDL_OutputUint(out, 0, 4);
+        }
+        HDL_OutputWrite(out, &ctx->binding_keys[ctx->binding_starts[i]], ctx->binding_starts[i + 1] - ctx->binding_starts[i]);
+    }
+
+    // Elements are stored in document order, each followed by its children
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        ctx->element_offsets[i] = out->size;
+        if(compileElement(ctx, doc, &doc->elements[i], out)) {
+            // Fail
+            printf("ERROR: Failed to compile element\r\n");
+            free(bitmapOffsets);
             return 1;
         }
     }
+    ctx->element_offsets[doc->elementCount] = out->size;
+
+    int err = directory && writeDirectory(ctx, doc, out, bitmapOffsets);
+    free(bitmapOffsets);
+    err = err || writeVartables(ctx, out, vartableOffsets);
+    return err || out->error;
+}
+
+/**
+ * @brief Compiles a document after an incremental re-parse, only the replaced elements are compiled
+ * 
+ * Output of the other elements is copied from the previous compile, the header counts are updated.
+ * Everything is compiled again if the whole document was parsed again or the format changes
+ * 
+ * @param doc Re-parsed document
+ * @param edit Elements replaced by the re-parse
+ * @param old Output of the previous compile
+ * @param out Empty output
+ * @param first_out First byte after the header that may differ from the previous output
+ * @return int 0 on success
+ */
+int compileEdit (struct HDL_CompileContext *ctx, struct HDL_Document *doc, struct HDL_Edit *edit, const uint8_t *old, struct HDL_Output *out, size_t *first_out) {
+    // Replaced elements are enough to check the compact format still fits
+    uint8_t wide = force_wide_index;
+    if(!wide && (ctx->wide_index || edit->full)) {
+        wide = needsWideIndex(ctx, doc);
+    }
+    else if(!wide) {
+        wide = doc->elementCount > UINT16_MAX || doc->maxDepth > UINT8_MAX || elementsNeedWideIndex(doc, edit->element, edit->newCount);
+    }
+    // String table changes with the strings of the new elements, moved elements would lose their alignment,
+    // header counts are patched little endian, vartables hold the offsets of the moved elements and an edit moves its laid out siblings
+    if(edit->full || ctx->element_offsets == NULL || wide != ctx->wide_index || ctx->strings != NULL || align_fields || big_endian ||
+       ctx->binding_count > 0 || elementsHaveBindings(doc, edit->element, edit->newCount) || screen_width != 0) {
+        *first_out = 16;
+        return compile(ctx, doc, out);
+    }
 
-    // Vartables...
+    if((doc->symbols.count != ctx->symbol_map_count && mapSymbols(ctx, doc)) || lowerAttributes(ctx, doc, edit->element, edit->newCount)) {
+        printf("ERROR: Out of memory\r\n");
+        return 1;
+    }
+    if(aliasSprites(ctx, doc, edit->element, edit->newCount)) {
+        return 1;
+    }
 
-    // Elements
-    if(compileElement(doc, &doc->elements[0], buffer, pc)) {
-        // Fail
-        printf("ERROR: Failed to compile element\r\n");
+    uint32_t first = edit->element;
+    uint32_t oldEnd = ctx->element_offsets[first + edit->oldCount];
+    uint32_t oldCount = doc->elementCount - edit->newCount + edit->oldCount;
+    uint32_t oldLen = ctx->element_offsets[oldCount];
+    uint32_t *offsets = malloc(sizeof(uint32_t) * (doc->elementCount + 1));
+    uint32_t *bitmapOffsets = malloc(sizeof(uint32_t) * (doc->bitmapCount + 1));
+    if(offsets == NULL || bitmapOffsets == NULL) {
+        printf("ERROR: Out of memory\r\n");
+        free(offsets);
+        free(bitmapOffsets);
         return 1;
     }
 
+    // Directory grows or shrinks with the element count, everything after it moves
+    uint32_t dirSize = directory ? 4 * (ctx->bitmap_count + doc->elementCount) : 0;
+    uint32_t oldDirSize = directory ? 4 * (ctx->bitmap_count + oldCount) : 0;
+    int32_t shift = (int32_t)dirSize - (int32_t)oldDirSize;
 
-    return 0;
+    // Header, directory placeholders, bitmaps and elements before the edit
+    HDL_OutputWrite(out, old, 16);
+    for(uint32_t i = 0; i < dirSize; i += 4) {
+        HDL_OutputUint(out, 0, 4);
+    }
+    HDL_OutputWrite(out, &old[16 + oldDirSize], ctx->element_offsets[first] - 16 - oldDirSize);
+    for(uint32_t i = 0; i < first; i++) {
+        offsets[i] = ctx->element_offsets[i] + shift;
+    }
+    for(uint32_t i = 0; directory && i < ctx->bitmap_count; i++) {
+        const uint8_t *entry = &old[16 + 4 * i];
+        bitmapOffsets[i] = (entry[0] | (entry[1] << 8) | (entry[2] << 16) | ((uint32_t)entry[3] << 24)) + shift;
+    }
+
+    for(uint32_t i = first; i < first + edit->newCount; i++) {
+        offsets[i] = out->size;
+        if(compileElement(ctx, doc, &doc->elements[i], out)) {
+            printf("ERROR: Failed to compile element\r\n");
+            free(offsets);
+            free(bitmapOffsets);
+            return 1;
+        }
+    }
+
+    // Elements after the edit moved
+    int32_t delta = (int32_t)out->size - (int32_t)oldEnd;
+    HDL_OutputWrite(out, &old[oldEnd], oldLen - oldEnd);
+    for(uint32_t i = first + edit->oldCount; i <= oldCount; i++) {
+        offsets[i - edit->oldCount + edit->newCount] = ctx->element_offsets[i] + delta;
+    }
+
+    uint8_t count[4];
+    if(!ctx->wide_index) {
+        count[0] = doc->elementCount;
+        count[1] = doc->elementCount >> 8;
+        HDL_OutputPatch(out, 4, count, 2);
+        count[0] = doc->maxDepth;
+        HDL_OutputPatch(out, HDL_HEADER_MAX_DEPTH, count, 1);
+    }
+    else {
+        count[0] = doc->maxDepth;
+        count[1] = doc->maxDepth >> 8;
+        HDL_OutputPatch(out, HDL_HEADER_WIDE_MAX_DEPTH, count, 2);
+        for(int i = 0; i < 4; i++) {
+            count[i] = doc->elementCount >> (i * 8);
+        }
+        HDL_OutputPatch(out, 12, count, 4);
+    }
+
+    free(ctx->element_offsets);
+    ctx->element_offsets = offsets;
+    int err = directory && writeDirectory(ctx, doc, out, bitmapOffsets);
+    free(bitmapOffsets);
+
+    // Nothing changed if no elements were replaced, directory entries change with any edit
+    if(edit->oldCount + edit->newCount == 0) {
+        *first_out = out->size;
+    }
+    else {
+        *first_out = directory ? 16 : offsets[first];
+    }
+    return err || out->error;
 }
 
-uint8_t output_buffer[HDL_COMPILER_OUTPUT_BUFFER_SIZE];
+/**
+ * @brief Prints how many numeric values were narrowed and the elements laid out in the last compile
+ * 
+ */
+void printNarrowing (struct HDL_CompileContext *ctx) {
+    if(ctx->narrowed_values > 0) {
+        printf("Narrowed %u numeric values to a smaller type\r\n", ctx->narrowed_values);
+    }
+    if(screen_width != 0) {
+        printf("Laid out %u elements for %ux%u, %u left to the device\r\n", ctx->layout_count, screen_width, screen_height, ctx->layout_skipped);
+    }
+}
 
-void writeBinFile (struct HDL_Document *doc, FILE *file, int original_size) {
+int writeBinFile (struct HDL_CompileContext *ctx, struct HDL_Document *doc, FILE *file, int original_size) {
     
-    int len = 0;
+    // Output is written to the file while compiling, nothing is buffered in full
+    struct HDL_Output out;
+    fflush(file);
+    if(HDL_OutputInitFd(&out, fileno(file))) {
+        printf("Out of memory\r\n");
+        return 1;
+    }
 
-    if(compile(doc, output_buffer, &len)) {
+    int err = compile(ctx, doc, &out);
+    err |= HDL_OutputClose(&out);
+    if(err) {
         // Error
         printf("Failed to compile\r\n");
+        return 1;
     }
-    else {
-        printf("Original: %iB, Compiled: %iB\r\n", original_size, len);
-        fwrite(output_buffer, 1, len, file);
-    }
-
+    printf("Original: %iB, Compiled: %zuB\r\n", original_size, out.size);
+    printNarrowing(ctx);
+    return 0;
 }
 
-void writeCFile (struct HDL_Document *doc, FILE *file, const char *filename, int original_size, int comment) {
+int writeCFile (struct HDL_CompileContext *ctx, struct HDL_Document *doc, FILE *file, const char *filename, int original_size, int comment) {
 
     // Get base name from file
     char *f_cpy = malloc(strlen(filename) + 1);
@@ -397,21 +2122,37 @@ void writeCFile (struct HDL_Document *doc, FILE *file, const char *filename, int
         }
     }
 
-    int len = 0;
+    // Output is printed from memory, buffer grows with it
+    struct HDL_Output out;
+    if(HDL_OutputInitBuffer(&out, 4096)) {
+        printf("Out of memory\r\n");
+        free(f_cpy);
+        return 1;
+    }
 
-    if(compile(doc, output_buffer, &len)) {
+    int err = compile(ctx, doc, &out);
+    if(err) {
         // Error
         printf("Failed to compile\r\n");
     }
     else {
+        const uint8_t *output_buffer = out.data;
+        int len = out.size;
         printf("Original: %iB, Compiled: %iB\r\n", original_size, len);
+        printNarrowing(ctx);
         
         fprintf(file, "// HDL output file\n// Original size: %iB, Compiled size: %iB\n\n", original_size, len);
 
         fprintf(file, "// HDL output size\n");
         fprintf(file, "const unsigned long HDL_PAGE_SIZE_%s = %i;\n", f_ptr, len);
 
-        fprintf(file, "// Output\nunsigned char HDL_PAGE_%s[] = {\n", f_ptr);
+        if(align_fields) {
+            // Fields are aligned from the start of the output, 64-bit ones to 8
+            fprintf(file, "// Output\n_Alignas(%u) unsigned char HDL_PAGE_%s[] = {\n", payload_alignment > 8 ? payload_alignment : 8, f_ptr);
+        }
+        else {
+            fprintf(file, "// Output\nunsigned char HDL_PAGE_%s[] = {\n", f_ptr);
+        }
 
         if(!comment) {
             for(int i = 0; i < len; i++) {
@@ -528,56 +2269,659 @@ void writeCFile (struct HDL_Document *doc, FILE *file, const char *filename, int
             }
         }
 
-        fputs("\n};\n\n", file);
+        fputs("\n};\n\n", file);
+
+    }
+
+    HDL_OutputClose(&out);
+    free(f_cpy);
+    return err;
+}
+
+void writeBMPCFile (FILE *file, const char *filename, struct HDL_Bitmap *bmp) {
+    // Get base name from file
+    char *f_cpy = malloc(strlen(filename) + 1);
+    strcpy(f_cpy, filename);
+    f_cpy[strlen(filename)] = 0;
+    const char *f_ptr = f_cpy;
+    for(int i = strlen(f_cpy) - 1; i > 0; i--) {
+        if(f_cpy[i] == '/') {
+            f_ptr = &f_cpy[i + 1];
+            break;
+        }
+        if(f_cpy[i] == '.' || f_cpy[i] == '-') {
+            f_cpy[i] = '_';
+        }
+    }
+    struct HDL_Output out;
+    struct HDL_EncodedBitmap enc;
+    if(encodeBitmap(bmp, bitmap_encoding, &enc.data, &enc.size, &enc.encoding)) {
+        free(f_cpy);
+        return;
+    }
+    // Only the format is used by compileBitmap
+    struct HDL_CompileContext ctx;
+    compileContextInit(&ctx);
+    ctx.wide_index = force_wide_index || bitmapNeedsWideIndex(bmp, enc.size);
+    int err = HDL_OutputInitBuffer(&out, 17 + bmp->size);
+    out.bigEndian = big_endian;
+    if(err || compileBitmap(&ctx, bmp, bmp->id, &enc, &out)) {
+        printf("Out of memory\r\n");
+        HDL_OutputClose(&out);
+        free(enc.data);
+        free(f_cpy);
+        return;
+    }
+    free(enc.data);
+    const uint8_t *output_buffer = out.data;
+    int len = out.size;
+
+    fprintf(file, "// Filename: %s\n", f_ptr);
+    fprintf(file, "// Width: %i Height: %i Sprite width: %i Sprite height: %i\n", bmp->width, bmp->height, bmp->sprite_width, bmp->sprite_height);
+    fprintf(file, "// File size\n");
+    fprintf(file, "const unsigned long HDL_IMG_SIZE_%s = %i;\n", f_ptr, len);
+    fprintf(file, "// File output\n");
+    if(align_fields) {
+        fprintf(file, "_Alignas(%u) const unsigned char HDL_IMG_%s[] = {\n", payload_alignment, f_ptr);
+    }
+    else {
+        fprintf(file, "const unsigned char HDL_IMG_%s[] = {\n", f_ptr);
+    }
+    
+
+    for(int i = 0; i < len; i++) {
+        fprintf(file, "0x%02X", output_buffer[i]);
+        if(i != len - 1) {
+            fputs(", ", file);
+        }
+        if((i + 1) % 16 == 0) {
+            // Newline after every 16 bytes
+            fputc('\n', file);
+        }
+    }
+
+    fprintf(file, "\n};\n");
+
+    HDL_OutputClose(&out);
+    free(f_cpy);
+}
+
+/**
+ * @brief Measures the lexer throughput with the current settings
+ * 
+ * @param data Input data
+ * @param len Length of the data
+ * @param count Number of tokens
+ * @return double MB/s
+ */
+double benchmarkTokenize (struct HDL_ParseContext *ctx, const char *data, size_t len, uint32_t *count) {
+    int iterations = 0;
+    double elapsed = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Run for at least half a second
+    do {
+        HDL_Tokenize(ctx, data, len, NULL, count);
+        iterations++;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    while(elapsed < 0.5 || iterations < 3);
+
+    return (double)len * iterations / elapsed / 1e6;
+}
+
+/**
+ * @brief Benchmarks the lexer in every fast path mode and with 1 to N threads
+ * 
+ * @param data Input data
+ * @param len Length of the data
+ * @param threads Max number of threads
+ */
+void benchmarkLexer (struct HDL_ParseContext *ctx, const char *data, size_t len, int threads) {
+    const char *modes[] = { "none", "scalar", "sse2", "avx2" };
+    uint32_t count = 0;
+
+    printf("Lexer benchmark, %zuB input\r\n", len);
+    HDL_SetLexThreads(ctx, 1);
+    for(int mode = HDL_LEX_NONE; mode <= HDL_LEX_AVX2; mode++) {
+        if(HDL_SetLexMode(ctx, mode)) {
+            printf("\t%-8s not supported\r\n", modes[mode]);
+            continue;
+        }
+        double speed = benchmarkTokenize(ctx, data, len, &count);
+        printf("\t%-8s %9.1f MB/s (%u tokens)\r\n", modes[mode], speed, count);
+    }
+    HDL_SetLexMode(ctx, HDL_LEX_AUTO);
+
+    // Tokens lexed on one thread, parallel results must match them
+    struct HDL_Token *reference = NULL;
+    uint32_t reference_count = 0;
+    if(HDL_Tokenize(ctx, data, len, &reference, &reference_count)) {
+        printf("Error: Tokenizing failed\r\n");
+        return;
+    }
+
+    if(threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(threads < 2) {
+        // Show the threading overhead on a single CPU
+        threads = 2;
+    }
+
+    printf("Thread scaling, %ld CPUs\r\n", sysconf(_SC_NPROCESSORS_ONLN));
+    double base = 0;
+    for(int t = 1; t <= threads; t++) {
+        if(HDL_SetLexThreads(ctx, t)) {
+            break;
+        }
+        double speed = benchmarkTokenize(ctx, data, len, &count);
+        if(t == 1) {
+            base = speed;
+        }
+
+        // Check the tokens against the single threaded lexer
+        struct HDL_Token *tokens = NULL;
+        int same = HDL_Tokenize(ctx, data, len, &tokens, &count) == 0 && count == reference_count;
+        for(uint32_t i = 0; same && i < count; i++) {
+            same = tokens[i].offset == reference[i].offset && tokens[i].length == reference[i].length
+                && tokens[i].kind == reference[i].kind && tokens[i].quotes == reference[i].quotes
+                && tokens[i].decode == reference[i].decode;
+        }
+        if(tokens != NULL)
+            free(tokens);
+
+        printf("\t%2i threads %9.1f MB/s %5.2fx %s\r\n", t, speed, speed / base, same ? "ok" : "MISMATCH");
+    }
+    HDL_SetLexThreads(ctx, 0);
+
+    if(reference != NULL)
+        free(reference);
+}
+
+/**
+ * @brief Measures the decode throughput of an encoded bitmap, decoded row by row
+ * 
+ * @param bmp 
+ * @param encoding 
+ * @param data Encoded data
+ * @param size Size of the encoded data
+ * @param same_out 1 if the decoded bitmap matches the raw data
+ * @return double MB/s of decoded data
+ */
+double benchmarkDecode (struct HDL_Bitmap *bmp, uint8_t encoding, const uint8_t *data, uint32_t size, int *same_out) {
+    struct HDL_BitmapDecoder dec;
+    uint32_t rowBytes = (bmp->width + 7) / 8;
+    uint8_t *row = malloc(rowBytes + 1);
+    if(row == NULL) {
+        *same_out = 0;
+        return 0;
+    }
+
+    // Check the rows against the raw data
+    int same = HDL_DecoderInit(&dec, encoding << 4, data, size, bmp->width) == 0;
+    for(uint32_t y = 0; same && y < bmp->height; y++) {
+        same = HDL_DecodeRow(&dec, row) == 0 && memcmp(row, bmp->data + (size_t)y * rowBytes, rowBytes) == 0;
+    }
+    *same_out = same && (size_t)rowBytes * bmp->height == bmp->size;
+
+    int iterations = 0;
+    double elapsed = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Bitmaps are small, run each for at least a tenth of a second
+    do {
+        HDL_DecoderInit(&dec, encoding << 4, data, size, bmp->width);
+        for(uint32_t y = 0; y < bmp->height; y++) {
+            HDL_DecodeRow(&dec, row);
+        }
+        iterations++;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    while(elapsed < 0.1 || iterations < 3);
+
+    free(row);
+    return (double)bmp->size * iterations / elapsed / 1e6;
+}
+
+/**
+ * @brief Benchmarks the compression ratio and decode throughput of every bitmap encoding
+ * 
+ * @param doc 
+ */
+void benchmarkBitmaps (struct HDL_Document *doc) {
+    const char *encodings[] = { "raw", "packbits", "lz" };
+    size_t raw_total = 0;
+    size_t totals[HDL_ENCODING_COUNT] = { 0 };
+    size_t best_total = 0;
+
+    printf("Bitmap benchmark, %u bitmaps\r\n", doc->bitmapCount);
+    for(uint32_t i = 0; i < doc->bitmapCount; i++) {
+        struct HDL_Bitmap *bmp = &doc->bitmaps[i];
+        if(bmp->colorMode != HDL_COLORS_MONO) {
+            printf("\t%-16s not a mono bitmap\r\n", bmp->name);
+            continue;
+        }
+        printf("\t%-16s %ux%u, %uB\r\n", bmp->name, bmp->width, bmp->height, bmp->size);
+        raw_total += bmp->size;
+        uint32_t best = bmp->size;
+
+        uint8_t *data = malloc(HDL_EncodeBound(bmp->size));
+        if(data == NULL) {
+            printf("Error: Out of memory\r\n");
+            return;
+        }
+        for(uint8_t e = HDL_ENCODING_RAW; e < HDL_ENCODING_COUNT; e++) {
+            uint32_t size = HDL_Encode(e, bmp->data, bmp->size, data);
+            int same = 0;
+            double speed = benchmarkDecode(bmp, e, data, size, &same);
+            totals[e] += size;
+            if(size < best) {
+                best = size;
+            }
+            printf("\t\t%-8s %9uB %6.2fx %9.1f MB/s %s\r\n", encodings[e], size, size ? (double)bmp->size / size : 0,
+                speed, same ? "ok" : "MISMATCH");
+        }
+        best_total += best;
+        free(data);
+    }
+
+    printf("Total\r\n");
+    for(uint8_t e = HDL_ENCODING_RAW; e < HDL_ENCODING_COUNT; e++) {
+        printf("\t%-8s %9zuB %6.2fx\r\n", encodings[e], totals[e], totals[e] ? (double)raw_total / totals[e] : 0);
+    }
+    printf("\t%-8s %9zuB %6.2fx\r\n", "smallest", best_total, best_total ? (double)raw_total / best_total : 0);
+}
+
+/**
+ * @brief Maps a file to memory
+ * 
+ * @param filename 
+ * @param buffer_out Mapped data, NULL if the file is empty. Unmapped by the caller
+ * @param size_out Size of the file
+ * @return int 0 on success
+ */
+int mapFile (const char *filename, char **buffer_out, size_t *size_out) {
+    int fd = open(filename, O_RDONLY);
+
+    if(fd < 0) {
+        printf("Failed to open file %s\r\n", filename);
+        return 1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        printf("Failed to read file %s\r\n", filename);
+        close(fd);
+        return 1;
+    }
+
+    size_t filesize = st.st_size;
+
+    // Map the file instead of reading it, the parser works directly on the mapped data
+    char *buffer = NULL;
+    if(filesize > 0) {
+        buffer = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(buffer == MAP_FAILED) {
+            printf("Failed to map file %s\r\n", filename);
+            close(fd);
+            return 1;
+        }
+        madvise(buffer, filesize, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    *buffer_out = buffer;
+    *size_out = filesize;
+    return 0;
+}
+
+/**
+ * @brief Parses an HDL file and writes the compiled output
+ * 
+ * @param modules Cache of included modules, NULL to parse every include
+ * @param filename Input file
+ * @param fpath Output file, NULL if not set
+ * @param format Output format
+ * @param stream Stream the input file in chunks instead of mapping it
+ * @param threads Lexer threads
+ * @param comment Comment the output file
+ * @return int 0 on success
+ */
+int compileFile (struct HDL_ModuleCache *modules, const char *filename, const char *fpath, uint8_t format, uint8_t stream, int threads, uint8_t comment) {
+    // Images and includes of a document are relative to the document
+    struct HDL_ParseContext ctx;
+    HDL_ParseContextInit(&ctx, filename);
+    HDL_SetModuleCache(&ctx, modules);
+    if(HDL_SetLexThreads(&ctx, threads)) {
+        printf("Error: Invalid thread count: %i\r\n", threads);
+        return 1;
+    }
+
+    // Parse file
+    struct HDL_Document doc;
+    size_t filesize = 0;
+    int err = 0;
+
+    if(stream) {
+        // Read and parse the file in chunks
+        FILE *f = fopen(filename, "r");
+
+        if(f == NULL) {
+            printf("Failed to open file %s\r\n", filename);
+            return 1;
+        }
+
+        err = HDL_ParseFile(&ctx, f, &doc);
+        filesize = ftell(f);
+
+        fclose(f);
+    }
+    else {
+        char *buffer = NULL;
+        if(mapFile(filename, &buffer, &filesize)) {
+            return 1;
+        }
+
+        err = HDL_Parse(&ctx, buffer, filesize, &doc);
+
+        if(buffer != NULL)
+            munmap(buffer, filesize);
+    }
+
+    if(!err) {
+        int depth = 0;
+        //_HDL_PrintBlocks();
+        //HDL_PrintVars(&doc);
+        //HDL_PrintElement(&doc, &doc.elements[0], depth);
+    }
+    else {
+        printf("Parse failed\r\n");
+        HDL_DocumentFree(&doc);
+        return 1;
+    }
+
+    // Nothing is allocated in the context before the document is compiled
+    struct HDL_CompileContext compiler;
+    compileContextInit(&compiler);
+
+    // Write output file
+    if(fpath != NULL) {
+
+        if(format == HDL_COMPILER_OUTPUT_FORMAT_UNKNOWN) {
+            printf("Unknown file output format\r\n");
+            HDL_DocumentFree(&doc);
+            return 1;
+        }
+
+        // Written next to the output and renamed over it, a failed compile leaves no partial file
+        char *tmpPath = malloc(strlen(fpath) + 5);
+        if(tmpPath == NULL) {
+            printf("Error: Out of memory\r\n");
+            HDL_DocumentFree(&doc);
+            return 1;
+        }
+        sprintf(tmpPath, "%s.tmp", fpath);
+        FILE *fo = fopen(tmpPath, "w");
+
+        if(fo == NULL) {
+            printf("Could not open '%s' for writing\r\n", tmpPath);
+            free(tmpPath);
+            HDL_DocumentFree(&doc);
+            return 1;
+        }
+
+        if(format == HDL_COMPILER_OUTPUT_FORMAT_BIN) {
+            err = writeBinFile(&compiler, &doc, fo, filesize);
+        }
+        else {
+            err = writeCFile(&compiler, &doc, fo, filename, filesize, comment);
+        }
 
+        err |= fclose(fo) != 0;
+        if(!err && rename(tmpPath, fpath) != 0) {
+            printf("Could not write '%s'\r\n", fpath);
+            err = 1;
+        }
+        if(err) {
+            unlink(tmpPath);
+        }
+        free(tmpPath);
+    }
+    else {
+        // Dry run, only the compiled size is reported
+        struct HDL_Output out;
+        HDL_OutputInitCount(&out);
+        err = compile(&compiler, &doc, &out);
+        if(err) {
+            printf("Failed to compile\r\n");
+        }
+        else {
+            printf("Output file not set, compiled size: %zuB\r\n", out.size);
+            printNarrowing(&compiler);
+        }
     }
 
-    free(f_cpy);
+    compileContextFree(&compiler);
+    HDL_DocumentFree(&doc);
+    return err;
 }
 
-void writeBMPCFile (FILE *file, const char *filename, struct HDL_Bitmap *bmp) {
-    // Get base name from file
-    char *f_cpy = malloc(strlen(filename) + 1);
-    strcpy(f_cpy, filename);
-    f_cpy[strlen(filename)] = 0;
-    const char *f_ptr = f_cpy;
-    for(int i = strlen(f_cpy) - 1; i > 0; i--) {
-        if(f_cpy[i] == '/') {
-            f_ptr = &f_cpy[i + 1];
-            break;
-        }
-        if(f_cpy[i] == '.' || f_cpy[i] == '-') {
-            f_cpy[i] = '_';
+/**
+ * @brief Reads a whole file in to memory
+ * 
+ * @param filename 
+ * @param buffer_out File data, freed by the caller
+ * @param size_out Size of the file
+ * @return int 0 on success
+ */
+int readFile (const char *filename, char **buffer_out, size_t *size_out) {
+    char *mapped = NULL;
+    size_t size = 0;
+    if(mapFile(filename, &mapped, &size)) {
+        return 1;
+    }
+    char *buffer = malloc(size + 1);
+    if(buffer == NULL) {
+        printf("Error: Out of memory\r\n");
+        if(mapped != NULL)
+            munmap(mapped, size);
+        return 1;
+    }
+    if(mapped != NULL) {
+        memcpy(buffer, mapped, size);
+        munmap(mapped, size);
+    }
+    *buffer_out = buffer;
+    *size_out = size;
+    return 0;
+}
+
+/**
+ * @brief Compiles a file to a binary and keeps compiling it when it changes
+ * 
+ * Only the edited element is parsed and compiled again, the output file is rewritten from the first changed byte
+ * 
+ * @param filename Input file
+ * @param fpath Output binary file
+ * @param threads Lexer threads
+ * @return int 1 on failure, runs until interrupted otherwise
+ */
+int watchFile (const char *filename, const char *fpath, int threads) {
+    struct HDL_ParseContext ctx;
+    HDL_ParseContextInit(&ctx, filename);
+    if(HDL_SetLexThreads(&ctx, threads)) {
+        printf("Error: Invalid thread count: %i\r\n", threads);
+        return 1;
+    }
+
+    // Text the document was parsed from, edits are found by comparing against it
+    char *text = NULL;
+    size_t len = 0;
+    struct stat st;
+    if(stat(filename, &st) != 0 || readFile(filename, &text, &len)) {
+        printf("Failed to read file %s\r\n", filename);
+        return 1;
+    }
+
+    struct HDL_Document doc;
+    if(HDL_Parse(&ctx, text, len, &doc)) {
+        printf("Parse failed\r\n");
+        HDL_DocumentFree(&doc);
+        free(text);
+        return 1;
+    }
+
+    // Output is kept in memory, the next compile copies the unchanged parts from it.
+    // File is opened after the first compile, so a failed compile leaves the old output
+    struct HDL_Output output;
+    // Element offsets of the last compile are kept in the context for the next edit
+    struct HDL_CompileContext compiler;
+    compileContextInit(&compiler);
+    int fd = -1;
+    if(HDL_OutputInitBuffer(&output, 4096) || compile(&compiler, &doc, &output)
+        || (fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 || write(fd, output.data, output.size) != (ssize_t)output.size) {
+        printf("Failed to write '%s'\r\n", fpath);
+        if(fd >= 0) {
+            close(fd);
         }
+        HDL_OutputClose(&output);
+        compileContextFree(&compiler);
+        HDL_DocumentFree(&doc);
+        free(text);
+        return 1;
     }
-    int len = 0;
-    compileBitmap(NULL, bmp, output_buffer, &len);
+    printf("Watching %s, compiled %zuB\r\n", filename, output.size);
 
-    fprintf(file, "// Filename: %s\n", f_ptr);
-    fprintf(file, "// Width: %i Height: %i Sprite width: %i Sprite height: %i\n", bmp->width, bmp->height, bmp->sprite_width, bmp->sprite_height);
-    fprintf(file, "// File size\n");
-    fprintf(file, "const unsigned long HDL_IMG_SIZE_%s = %i;\n", f_ptr, len);
-    fprintf(file, "// File output\n");
-    fprintf(file, "const unsigned char HDL_IMG_%s[] = {\n", f_ptr);
-    
+    while(1) {
+        usleep(HDL_WATCH_INTERVAL_US);
 
-    for(int i = 0; i < len; i++) {
-        fprintf(file, "0x%02X", output_buffer[i]);
-        if(i != len - 1) {
-            fputs(", ", file);
+        struct stat n_st;
+        if(stat(filename, &n_st) != 0 || (n_st.st_mtim.tv_sec == st.st_mtim.tv_sec
+            && n_st.st_mtim.tv_nsec == st.st_mtim.tv_nsec && n_st.st_size == st.st_size)) {
+            continue;
         }
-        if((i + 1) % 16 == 0) {
-            // Newline after every 16 bytes
-            fputc('\n', file);
+        st = n_st;
+
+        char *n_text = NULL;
+        size_t n_len = 0;
+        if(readFile(filename, &n_text, &n_len)) {
+            continue;
+        }
+
+        struct timespec t_start, t_end;
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+        // Document and output stay at the last text that parsed
+        struct HDL_Edit edit;
+        if(HDL_Reparse(&ctx, &doc, text, len, n_text, n_len, &edit)) {
+            printf("Parse failed, keeping the previous output\r\n");
+            free(n_text);
+            continue;
+        }
+        free(text);
+        text = n_text;
+        len = n_len;
+
+        struct HDL_Output n_output;
+        size_t first = 0;
+        int err = HDL_OutputInitBuffer(&n_output, output.size) || compileEdit(&compiler, &doc, &edit, output.data, &n_output, &first);
+        if(err) {
+            // Document already holds the edit, the old output can not be patched with it
+            printf("Incremental compile failed, compiling in full\r\n");
+            HDL_OutputClose(&n_output);
+            first = 16;
+            err = HDL_OutputInitBuffer(&n_output, output.size) || compile(&compiler, &doc, &n_output);
+        }
+        if(err) {
+            printf("Failed to compile, keeping the previous output\r\n");
+            HDL_OutputClose(&n_output);
+            // Offsets no longer match the document, the next edit is compiled in full
+            free(compiler.element_offsets);
+            compiler.element_offsets = NULL;
+            continue;
         }
+        HDL_OutputClose(&output);
+        output = n_output;
+
+        // Header counts and the changed tail
+        size_t outLen = output.size;
+        if(pwrite(fd, output.data, 16, 0) != 16 || pwrite(fd, output.data + first, outLen - first, first) != (ssize_t)(outLen - first)
+            || ftruncate(fd, outLen) != 0) {
+            printf("Failed to write '%s'\r\n", fpath);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t_end);
+        double ms = (t_end.tv_sec - t_start.tv_sec) * 1000.0 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6;
+        printf("%s: %u elements -> %u, wrote %zuB of %zuB in %.3f ms\r\n", edit.full ? "Full" : "Incremental",
+            edit.oldCount, edit.newCount, outLen - first, outLen, ms);
+    }
+    return 0;
+}
+
+/**
+ * @brief Compiles several files, included modules are parsed once and shared by all of them
+ * 
+ * Output of each file is named after the input, with the extension of the format
+ * 
+ * @param filenames Input files
+ * @param count Number of input files
+ * @param outdir Output directory, NULL to write next to the inputs
+ * @param format Output format, binary if unknown
+ * @param stream Stream the input files in chunks instead of mapping them
+ * @param threads Lexer threads
+ * @param comment Comment the output files
+ * @return int 0 if all files compiled
+ */
+int compileBatch (char **filenames, int count, const char *outdir, uint8_t format, uint8_t stream, int threads, uint8_t comment) {
+    struct HDL_ModuleCache modules;
+    if(HDL_ModuleCacheInit(&modules)) {
+        printf("Error: Failed to create module cache\r\n");
+        return 1;
+    }
+    if(format == HDL_COMPILER_OUTPUT_FORMAT_UNKNOWN) {
+        format = HDL_COMPILER_OUTPUT_FORMAT_BIN;
     }
 
-    fprintf(file, "\n};\n");
+    int failed = 0;
+    for(int i = 0; i < count; i++) {
+        const char *filename = filenames[i];
+        const char *base = strrchr(filename, '/');
+        base = base != NULL ? base + 1 : filename;
+        // Input name without the extension
+        int baselen = strlen(base);
+        const char *ext = strrchr(base, '.');
+        if(ext != NULL && ext != base) {
+            baselen = ext - base;
+        }
 
+        char fpath[512];
+        int n;
+        if(outdir != NULL) {
+            n = snprintf(fpath, sizeof(fpath), "%s/%.*s", outdir, baselen, base);
+        }
+        else {
+            n = snprintf(fpath, sizeof(fpath), "%.*s%.*s", (int)(base - filename), filename, baselen, base);
+        }
+        if(n < 0 || (size_t)n + 5 >= sizeof(fpath)) {
+            printf("Error: Output path too long for %s\r\n", filename);
+            failed++;
+            continue;
+        }
+        strcat(fpath, format == HDL_COMPILER_OUTPUT_FORMAT_BIN ? ".bin" : ".c");
 
-    
+        printf("%s -> %s\r\n", filename, fpath);
+        if(compileFile(&modules, filename, fpath, format, stream, threads, comment)) {
+            failed++;
+        }
+    }
 
-    free(f_cpy);
+    printf("Compiled %i/%i files, modules parsed %u, reused %u\r\n", count - failed, count, modules.misses, modules.hits);
+    HDL_ModuleCacheFree(&modules);
+    return failed != 0;
 }
 
 /**
@@ -588,6 +2932,7 @@ void printHelp () {
     printf("HDL-CMP - HDL Compiler\r\n");
     printf("Usage: \r\n");
     printf("\thdl-cmp [options] <file>\r\n");
+    printf("\thdl-cmp [options] <file> <file>...\t\tCompile every file, -o is the output directory\r\n");
     printf("Options:\r\n");
     printf("\t-h\t\tPrint this help\r\n");
     printf("\t-o <file>\t\tOutput file path\r\n");
@@ -595,6 +2940,19 @@ void printHelp () {
     printf("\t-c\t\tComment the output file\r\n");
     printf("\t-x <width>\t\tWidth of a sprite\r\n");
     printf("\t-y <height>\t\tHeight of a sprite\r\n");
+    printf("\t-b\t\tBenchmark the lexer and the bitmap encodings on the input file\r\n");
+    printf("\t-s\t\tStream the input file in chunks instead of mapping it\r\n");
+    printf("\t-j <threads>\t\tNumber of lexer threads, 0 = one per CPU (default)\r\n");
+    printf("\t-d\t\tWrite a directory of bitmap and element offsets after the header, for random access\r\n");
+    printf("\t-t\t\tWrite contents and string attributes in to a deduplicated string table\r\n");
+    printf("\t-l\t\tWatch the input file and recompile only the edited elements when it changes (binary output)\r\n");
+    printf("\t-S <file>\t\tTag and attribute schema: lines of 'tag <name> <id>' and 'attr <name> <id> <int|bool|bind|img|string|any> [default]'\r\n");
+    printf("\t-a\t\tWrite attributes compactly: presence bitmask over the attribute keys, varint values\r\n");
+    printf("\t-z <encoding>\t\tBitmap encoding: 'raw'(default), 'packbits', 'lz', 'auto'(smallest for each bitmap)\r\n");
+    printf("\t--align[=N]\t\tPad multi-byte fields to their size and bitmap records and data to N bytes (4, 8, 16 or 32, default 4)\r\n");
+    printf("\t--endian=<little|big>\t\tByte order of multi-byte fields, little endian by default\r\n");
+    printf("\t--screen <W>x<H>\t\tLay out elements that do not depend on bindings for the screen size, they are written with absolute x, y, width and height and no flex attributes\r\n");
+    printf("\t-w\t\tWrite 32-bit counts, sizes and indices (wide format) even if the document fits 8/16-bit\r\n");
 }
 
 
@@ -606,6 +2964,13 @@ int main (int argc, char *argv[]) {
     }
 
     char *filename = NULL;
+    // Input files, more than one compiles them all with a shared module cache
+    char **filenames = malloc(sizeof(char*) * argc);
+    int filecount = 0;
+    if(filenames == NULL) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
 
     // Output file path
     char *argf_fpath = NULL;
@@ -613,9 +2978,19 @@ int main (int argc, char *argv[]) {
     uint8_t argf_format = HDL_COMPILER_OUTPUT_FORMAT_UNKNOWN;
     // Comment output file
     uint8_t arg_comment = 0;
+    // Benchmark lexer
+    uint8_t arg_bench = 0;
+    // Stream input file
+    uint8_t arg_stream = 0;
+    // Watch input file
+    uint8_t arg_watch = 0;
 
     uint16_t argf_width = 0;
     uint16_t argf_height = 0;
+    // Lexer threads
+    int argf_threads = 0;
+    // Tag and attribute schema file
+    char *argf_schema = NULL;
 
 
     /*
@@ -624,6 +2999,10 @@ int main (int argc, char *argv[]) {
         2: expect file format
         3: expect sprite width
         4: expect sprite height
+        5: expect thread count
+        6: expect bitmap encoding
+        7: expect schema file
+        8: expect screen size
     */
     uint8_t arg_state = 0;
     for(int i = 1; i < argc; i++) {
@@ -670,17 +3049,100 @@ int main (int argc, char *argv[]) {
                             arg_state = 4;
                             break;
                         }
+                        case 'b':
+                        {
+                            // Benchmark lexer
+                            arg_bench = 1;
+                            break;
+                        }
+                        case 's':
+                        {
+                            // Stream input file
+                            arg_stream = 1;
+                            break;
+                        }
+                        case 'j':
+                        {
+                            // Lexer threads
+                            arg_state = 5;
+                            break;
+                        }
+                        case 'w':
+                        {
+                            // Wide format
+                            force_wide_index = 1;
+                            break;
+                        }
+                        case 'd':
+                        {
+                            // Offset directory
+                            directory = 1;
+                            break;
+                        }
+                        case 't':
+                        {
+                            // String table
+                            string_table = 1;
+                            break;
+                        }
+                        case 'l':
+                        {
+                            // Watch input file
+                            arg_watch = 1;
+                            break;
+                        }
+                        case 'a':
+                        {
+                            // Compact attributes
+                            compact_attrs = 1;
+                            break;
+                        }
+                        case '-':
+                        {
+                            // Long options
+                            if(strcmp(argv[i], "--align") == 0 || strncmp(argv[i], "--align=", 8) == 0) {
+                                align_fields = 1;
+                                if(argv[i][7] == '=') {
+                                    payload_alignment = atoi(&argv[i][8]);
+                                    if(payload_alignment != 4 && payload_alignment != 8 && payload_alignment != 16 && payload_alignment != 32) {
+                                        printf("Error: Alignment must be 4, 8, 16 or 32\r\n");
+                                        return 1;
+                                    }
+                                }
+                            }
+                            else if(strcmp(argv[i], "--endian=little") == 0) {
+                                big_endian = 0;
+                            }
+                            else if(strcmp(argv[i], "--endian=big") == 0) {
+                                big_endian = 1;
+                            }
+                            else if(strcmp(argv[i], "--screen") == 0) {
+                                // Screen size
+                                arg_state = 8;
+                            }
+                            else {
+                                printf("Error: Unknown option %s\r\n", argv[i]);
+                                return 1;
+                            }
+                            break;
+                        }
+                        case 'S':
+                        {
+                            // Schema file
+                            arg_state = 7;
+                            break;
+                        }
+                        case 'z':
+                        {
+                            // Bitmap encoding
+                            arg_state = 6;
+                            break;
+                        }
                     }
                 }
                 else {
                     // File
-                    if(filename != NULL) {
-                        printf("Error: Compiler expects only single input file\r\n");
-                        return 1;
-                    }
-                    else {
-                        filename = argv[i];
-                    }
+                    filenames[filecount++] = argv[i];
                 }
                 break;
             }
@@ -734,6 +3196,51 @@ int main (int argc, char *argv[]) {
                 arg_state = 0;
                 break;
             }
+            case 5:
+            {
+                argf_threads = atoi(argv[i]);
+                arg_state = 0;
+                break;
+            }
+            case 6:
+            {
+                if(strcmp(argv[i], "raw") == 0) {
+                    bitmap_encoding = HDL_ENCODING_RAW;
+                }
+                else if(strcmp(argv[i], "packbits") == 0) {
+                    bitmap_encoding = HDL_ENCODING_PACKBITS;
+                }
+                else if(strcmp(argv[i], "lz") == 0) {
+                    bitmap_encoding = HDL_ENCODING_LZ;
+                }
+                else if(strcmp(argv[i], "auto") == 0) {
+                    bitmap_encoding = HDL_COMPILER_ENCODING_AUTO;
+                }
+                else {
+                    printf("Error: Unknown bitmap encoding: '%s'\r\n", argv[i]);
+                    return 1;
+                }
+                arg_state = 0;
+                break;
+            }
+            case 7:
+            {
+                argf_schema = argv[i];
+                arg_state = 0;
+                break;
+            }
+            case 8:
+            {
+                char *end = NULL;
+                screen_width = strtoul(argv[i], &end, 10);
+                screen_height = *end == 'x' ? strtoul(end + 1, &end, 10) : 0;
+                if(*end != 0 || screen_width == 0 || screen_height == 0 || screen_width > UINT16_MAX || screen_height > UINT16_MAX) {
+                    printf("Error: Screen size must be <width>x<height>, ex. 320x240\r\n");
+                    return 1;
+                }
+                arg_state = 0;
+                break;
+            }
         }
     }
 
@@ -742,11 +3249,37 @@ int main (int argc, char *argv[]) {
         return 1;
     }
 
-    if(filename == NULL) {
+    if(filecount == 0) {
         printf("Error: Expected an input file\r\n");
         return 1;
     }
 
+    if(loadSchema(argf_schema)) {
+        return 1;
+    }
+
+    if(screen_width != 0 && (attr_x == 0xFF || attr_y == 0xFF || attr_width == 0xFF || attr_height == 0xFF)) {
+        printf("Error: Laying out for a screen needs the x, y, width and height attributes in the schema\r\n");
+        return 1;
+    }
+
+    if(compact_attrs && (align_fields || big_endian)) {
+        printf("Error: Compact attributes are byte packed little endian, they can not be aligned or big endian\r\n");
+        return 1;
+    }
+
+    if(filecount > 1) {
+        if(arg_bench || arg_watch || argf_format == HDL_COMPILER_OUTPUT_FORMAT_BMP_C) {
+            printf("Error: Benchmark, watch and 'bmpc' format take a single input file\r\n");
+            return 1;
+        }
+        int err = compileBatch(filenames, filecount, argf_fpath, argf_format, arg_stream, argf_threads, arg_comment);
+        free(filenames);
+        return err;
+    }
+    filename = filenames[0];
+    free(filenames);
+
     // Detect format from file extension
     if(argf_format == HDL_COMPILER_OUTPUT_FORMAT_UNKNOWN && argf_fpath != NULL) {
         char *extension = NULL;
@@ -789,53 +3322,11 @@ int main (int argc, char *argv[]) {
         }
     }
 
-    input_file_path[0] = 0;
-
-    if(argf_format != HDL_COMPILER_OUTPUT_FORMAT_BMP_C) {
-        // Set filename path
-        for(int i = strlen(filename) - 1; i > 0; i--) {
-            if(filename[i] == '/') {
-                memcpy(input_file_path, filename, i + 1);
-                input_file_path[i + 1] = 0;
-                break;
-            }
-        }
-    }
-    
-    FILE *f = fopen(filename, "r");
-
-    if(f == NULL) {
-        printf("Failed to open file %s\r\n", filename);
-        return 1;
-    }
-
-    // Seek to end to find the length of the file
-    fseek(f, 0, SEEK_END);
-
-    size_t filesize = ftell(f);
-
-    // Seek back to start
-    fseek(f, 0, SEEK_SET);
-
-    // Allocate buffer
-    char *buffer = malloc(filesize + 1);
-
-    if(buffer == NULL) {
-        printf("Failed to allocate enough memory\r\n");
-        fclose(f);
-        return 1;
-    }
-
-    // Read file into buffer
-    fread(buffer, 1, filesize, f);
-
-    // Zero terminate
-    buffer[filesize] = 0;
-
-    fclose(f);
-
     if(argf_format == HDL_COMPILER_OUTPUT_FORMAT_BMP_C) {
-        // Parse image
+        // Parse image, path is used as is
+        struct HDL_ParseContext ctx;
+        HDL_ParseContextInit(&ctx, NULL);
+
         struct HDL_Bitmap bmp;
         if(argf_width != 0) {
             bmp.sprite_width = argf_width;
@@ -844,12 +3335,14 @@ int main (int argc, char *argv[]) {
             bmp.sprite_height = argf_height;
         }
 
-        int err = HDL_BitmapFromBMP(filename, &bmp);
+        struct HDL_Arena arena;
+        HDL_ArenaInit(&arena);
+
+        int err = HDL_BitmapFromBMP(&ctx, filename, &bmp, &arena);
 
 
         if(err) {
             printf("BMP Parse failed \r\n");
-            free(buffer);
             return 1;
         }
 
@@ -872,57 +3365,35 @@ int main (int argc, char *argv[]) {
             printf("Output file not set\r\n");
         }
 
-        free(buffer);
+        HDL_ArenaFree(&arena);
     }
-    else {
-        // Parse file
-        struct HDL_Document doc;
-
-        int err = HDL_Parse(buffer, &doc);
-        if(!err) {
-            int depth = 0;
-            //_HDL_PrintBlocks();
-            //HDL_PrintVars(&doc);
-            //HDL_PrintElement(&doc, &doc.elements[0], depth);
-        }
-        else {
-            printf("Parse failed\r\n");
-            free(buffer);
-
+    else if(arg_bench) {
+        struct HDL_ParseContext ctx;
+        HDL_ParseContextInit(&ctx, filename);
+        char *buffer = NULL;
+        size_t filesize = 0;
+        if(mapFile(filename, &buffer, &filesize)) {
             return 1;
         }
+        benchmarkLexer(&ctx, buffer, filesize, argf_threads);
 
-        free(buffer);
-
-
-        // Write output file
-        if(argf_fpath != NULL) {
-
-            if(argf_format == HDL_COMPILER_OUTPUT_FORMAT_UNKNOWN) {
-                printf("Unknown file output format\r\n");
-                return 1;
-            }
-
-            FILE *fo = fopen(argf_fpath, "w");
-
-            if(fo == NULL) {
-                printf("Could not open '%s' for writing\r\n", argf_fpath);
-                return 1;
-            }
-
-            if(argf_format == HDL_COMPILER_OUTPUT_FORMAT_BIN) {
-                writeBinFile(&doc, fo, filesize);
-            }
-            else {
-                writeCFile(&doc, fo, filename, filesize, arg_comment);
-            }
-
-            fclose(fo);
+        struct HDL_Document doc;
+        if(HDL_Parse(&ctx, buffer, filesize, &doc) == 0) {
+            benchmarkBitmaps(&doc);
         }
-        else {
-            // TODO: Output file not set
-            printf("Output file not set\r\n");
+        HDL_DocumentFree(&doc);
+        if(buffer != NULL)
+            munmap(buffer, filesize);
+    }
+    else if(arg_watch) {
+        if(argf_fpath == NULL || argf_format != HDL_COMPILER_OUTPUT_FORMAT_BIN) {
+            printf("Error: Watch mode writes a binary file, set it with -o\r\n");
+            return 1;
         }
+        return watchFile(filename, argf_fpath, argf_threads);
+    }
+    else {
+        return compileFile(NULL, filename, argf_fpath, argf_format, arg_stream, argf_threads, arg_comment);
     }
 
     return 0;
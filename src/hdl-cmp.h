@@ -1,7 +0,0 @@
-#ifndef _HDL_CMP_H
-#define _HDL_CMP_H
-
-// Input file path
-extern char input_file_path[128];
-
-#endif
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include "hdl-decode.h"
+#include <string.h>
+
+// Kinds of runs
+#define HDL_RUN_LITERAL     0
+#define HDL_RUN_REPEAT      1
+#define HDL_RUN_MATCH       2
+
+int HDL_DecoderInit (struct HDL_BitmapDecoder *dec, uint8_t colorMode, const uint8_t *data, size_t size, uint16_t width) {
+    dec->data = data;
+    dec->size = size;
+    dec->pos = 0;
+    dec->encoding = HDL_BITMAP_ENCODING(colorMode);
+    dec->rowBytes = (width + 7) / 8;
+    dec->runKind = HDL_RUN_LITERAL;
+    dec->runLeft = 0;
+    dec->runValue = 0;
+    dec->runOffset = 0;
+    dec->written = 0;
+    return dec->encoding >= HDL_ENCODING_COUNT;
+}
+
+/**
+ * @brief Reads the control byte of the next run
+ *
+ * @param dec
+ * @return int 0 on success
+ */
+static int _HDL_DecodeRun (struct HDL_BitmapDecoder *dec) {
+    if(dec->pos >= dec->size) {
+        return 1;
+    }
+    uint8_t n = dec->data[dec->pos++];
+    if(n < 128) {
+        dec->runKind = HDL_RUN_LITERAL;
+        dec->runLeft = n + 1;
+        return dec->size - dec->pos < dec->runLeft;
+    }
+    if(dec->encoding == HDL_ENCODING_PACKBITS) {
+        if(n == 128 || dec->pos >= dec->size) {
+            // 128 is not written by the encoder
+            return 1;
+        }
+        dec->runKind = HDL_RUN_REPEAT;
+        dec->runLeft = 257 - n;
+        dec->runValue = dec->data[dec->pos++];
+        return 0;
+    }
+    if(dec->size - dec->pos < 2) {
+        return 1;
+    }
+    dec->runKind = HDL_RUN_MATCH;
+    dec->runLeft = n - 125;
+    dec->runOffset = dec->data[dec->pos] | (dec->data[dec->pos + 1] << 8);
+    dec->pos += 2;
+    // Match must be within the window and the output
+    return dec->runOffset == 0 || dec->runOffset > HDL_LZ_WINDOW || dec->runOffset > dec->written;
+}
+
+int HDL_DecodeBytes (struct HDL_BitmapDecoder *dec, uint8_t *out, size_t len) {
+    if(dec->encoding == HDL_ENCODING_RAW) {
+        if(dec->size - dec->pos < len) {
+            return 1;
+        }
+        memcpy(out, dec->data + dec->pos, len);
+        dec->pos += len;
+        return 0;
+    }
+
+    while(len > 0) {
+        if(dec->runLeft == 0 && _HDL_DecodeRun(dec)) {
+            return 1;
+        }
+        uint32_t n = dec->runLeft < len ? dec->runLeft : len;
+        switch(dec->runKind) {
+            case HDL_RUN_LITERAL:
+                memcpy(out, dec->data + dec->pos, n);
+                dec->pos += n;
+                break;
+            case HDL_RUN_REPEAT:
+                memset(out, dec->runValue, n);
+                break;
+            case HDL_RUN_MATCH:
+                // Byte by byte, a match may overlap the bytes it writes
+                for(uint32_t i = 0; i < n; i++) {
+                    uint8_t b = dec->window[(dec->written - dec->runOffset) % HDL_LZ_WINDOW];
+                    dec->window[dec->written % HDL_LZ_WINDOW] = b;
+                    dec->written++;
+                    out[i] = b;
+                }
+                break;
+        }
+        if(dec->encoding == HDL_ENCODING_LZ && dec->runKind != HDL_RUN_MATCH) {
+            for(uint32_t i = 0; i < n; i++) {
+                dec->window[(dec->written + i) % HDL_LZ_WINDOW] = out[i];
+            }
+            dec->written += n;
+        }
+        dec->runLeft -= n;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int HDL_DecodeRow (struct HDL_BitmapDecoder *dec, uint8_t *row) {
+    return HDL_DecodeBytes(dec, row, dec->rowBytes);
+}
+
+uint64_t HDL_ReadVarint (const uint8_t **data) {
+    const uint8_t *p = *data;
+    uint64_t value = 0;
+    int shift = 0;
+    do {
+        value |= (uint64_t)(*p & 0x7F) << shift;
+        shift += 7;
+    }
+    while(*p++ & 0x80);
+    *data = p;
+    return value;
+}
+
+int64_t HDL_ReadZigzag (const uint8_t **data) {
+    uint64_t value = HDL_ReadVarint(data);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * @brief Counts set bits in a byte
+ *
+ * @param b
+ * @return uint32_t
+ */
+static inline uint32_t _HDL_BitCount (uint8_t b) {
+    static const uint8_t nibble[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    return nibble[b & 0x0F] + nibble[b >> 4];
+}
+
+size_t HDL_AttrBlockInit (struct HDL_AttrBlock *block, const uint8_t *data, const uint8_t *schema, uint32_t attrCount) {
+    block->mask = data;
+    block->maskBytes = (attrCount + 7) / 8;
+    block->schema = schema;
+    block->offsets = NULL;
+    block->offsetSize = 0;
+    block->data = NULL;
+    block->size = 0;
+
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < block->maskBytes; i++) {
+        count += _HDL_BitCount(data[i]);
+    }
+    const uint8_t *p = data + block->maskBytes;
+    if(count == 0) {
+        return p - data;
+    }
+    block->size = HDL_ReadVarint(&p);
+    block->offsetSize = block->size < 0x100 ? 1 : block->size < 0x10000 ? 2 : 4;
+    block->offsets = p;
+    block->data = p + (count - 1) * block->offsetSize;
+    return block->data + block->size - data;
+}
+
+int HDL_AttrFind (const struct HDL_AttrBlock *block, uint32_t key, struct HDL_AttrValue *value_out) {
+    if(key / 8 >= block->maskBytes || !(block->mask[key / 8] & (1 << (key % 8)))) {
+        return 1;
+    }
+    // Attributes are stored in key order, rank of the key is its index
+    uint32_t rank = _HDL_BitCount(block->mask[key / 8] & ((1 << (key % 8)) - 1));
+    for(uint32_t i = 0; i < key / 8; i++) {
+        rank += _HDL_BitCount(block->mask[i]);
+    }
+    uint32_t offset = 0;
+    if(rank > 0) {
+        const uint8_t *o = block->offsets + (rank - 1) * block->offsetSize;
+        for(int b = 0; b < block->offsetSize; b++) {
+            offset |= (uint32_t)o[b] << (b * 8);
+        }
+    }
+
+    const uint8_t *p = block->data + offset;
+    uint64_t head = HDL_ReadVarint(&p);
+    value_out->count = head >> 1;
+    value_out->encoding = block->schema[key];
+    value_out->type = 0;
+    if(head & 1) {
+        value_out->encoding = HDL_ATTR_ENC_TYPED;
+        value_out->type = *p++;
+    }
+    value_out->data = p;
+    return 0;
+}
@@ -0,0 +1,171 @@
+#ifndef _HDL_DECODE
+#define _HDL_DECODE
+#include <stdint.h>
+#include <stddef.h>
+
+// Reference decoder of compressed bitmaps and compact attributes. Does not allocate and only depends on the C library,
+// so it can be copied to a runtime as is
+
+// Encoding of bitmap data, stored in the high 4 bits of the color mode byte
+enum HDL_BitmapEncoding {
+    // Rows as they are
+    HDL_ENCODING_RAW        = 0,
+    // PackBits: n < 128 copies n + 1 bytes, n > 128 repeats the next byte 257 - n times
+    HDL_ENCODING_PACKBITS   = 1,
+    // LZ: n < 128 copies n + 1 bytes, n >= 128 copies n - 125 bytes from uint16 offset back in the output
+    HDL_ENCODING_LZ         = 2,
+    HDL_ENCODING_COUNT
+};
+
+// Color mode byte: color mode in the low 4 bits, encoding in the high 4 bits
+#define HDL_BITMAP_COLOR_MODE(byte)     ((byte) & 0x0F)
+#define HDL_BITMAP_ENCODING(byte)       ((byte) >> 4)
+
+// Farthest back an LZ match can copy from, the decoder keeps this much output
+#define HDL_LZ_WINDOW                   1024
+// Shortest and longest LZ match
+#define HDL_LZ_MIN_MATCH                3
+#define HDL_LZ_MAX_MATCH                130
+
+// State of decoding a bitmap row by row
+struct HDL_BitmapDecoder {
+    // Encoded data
+    const uint8_t *data;
+    size_t size;
+    // Next encoded byte
+    size_t pos;
+    enum HDL_BitmapEncoding encoding;
+    // Bytes in a row of 1bpp pixels
+    uint32_t rowBytes;
+
+    // Current run: 0 = literal, 1 = repeat, 2 = match
+    uint8_t runKind;
+    // Bytes left in the run
+    uint32_t runLeft;
+    // Repeated byte
+    uint8_t runValue;
+    // Distance back of a match
+    uint32_t runOffset;
+
+    // Last HDL_LZ_WINDOW bytes of output (LZ only)
+    uint8_t window[HDL_LZ_WINDOW];
+    // Bytes written in total, window position is this modulo the window size
+    uint32_t written;
+};
+
+/**
+ * @brief Starts decoding a bitmap
+ *
+ * @param dec
+ * @param colorMode Color mode byte of the bitmap, includes the encoding
+ * @param data Encoded data
+ * @param size Size of the encoded data
+ * @param width Width of the bitmap in pixels
+ * @return int 0 on success, 1 if the encoding is not known
+ */
+int HDL_DecoderInit (struct HDL_BitmapDecoder *dec, uint8_t colorMode, const uint8_t *data, size_t size, uint16_t width);
+
+/**
+ * @brief Decodes the next row of the bitmap
+ *
+ * @param dec
+ * @param row Output, (width + 7) / 8 bytes
+ * @return int 0 on success, 1 if the data is corrupt or ends early
+ */
+int HDL_DecodeRow (struct HDL_BitmapDecoder *dec, uint8_t *row);
+
+/**
+ * @brief Decodes bytes of the bitmap, rows are contiguous
+ *
+ * @param dec
+ * @param out
+ * @param len Number of bytes to decode
+ * @return int 0 on success, 1 if the data is corrupt or ends early
+ */
+int HDL_DecodeBytes (struct HDL_BitmapDecoder *dec, uint8_t *out, size_t len);
+
+// Compact attribute format: after the content of an element, a bitmask of the attribute keys it has
+// (bit i of byte i / 8). If any bit is set, a varint size of the attribute data, offsets of the
+// attributes from the start of the data (except the first, which is at 0) and the data follow.
+// Offsets are 1 byte if the size is less than 256, 2 if less than 65536, otherwise 4.
+// Each attribute starts with a varint of count << 1, the low bit is set if the value does not
+// match the schema and is written with a type byte and fixed width values as in the default format
+
+// Value encoding implied by the schema of an attribute key
+enum HDL_AttrEncoding {
+    // Type byte and fixed width values always follow
+    HDL_ATTR_ENC_TYPED  = 0,
+    // Zigzag varint per value (integers)
+    HDL_ATTR_ENC_INT    = 1,
+    // Byte per value (bools, bindings)
+    HDL_ATTR_ENC_BYTE   = 2,
+    // Varint (bitmap ids)
+    HDL_ATTR_ENC_UINT   = 3,
+    // Count is the length of the string and its bytes follow, or the count is the index in the string table
+    HDL_ATTR_ENC_STRING = 4
+};
+
+// Attributes of an element in the compact attribute format
+struct HDL_AttrBlock {
+    // Presence bitmask
+    const uint8_t *mask;
+    uint32_t maskBytes;
+    // Offsets of the attributes after the first
+    const uint8_t *offsets;
+    uint8_t offsetSize;
+    // Attribute data
+    const uint8_t *data;
+    uint32_t size;
+    // Value encoding of each attribute key
+    const uint8_t *schema;
+};
+
+// Attribute found in a block
+struct HDL_AttrValue {
+    // Encoding of the values, HDL_ATTR_ENC_TYPED if they are written with a type
+    enum HDL_AttrEncoding encoding;
+    // Type of typed values
+    uint8_t type;
+    // Number of values, length or index of a string
+    uint32_t count;
+    // First value
+    const uint8_t *data;
+};
+
+/**
+ * @brief Reads the start of the attribute block of an element
+ *
+ * @param block
+ * @param data First byte of the block, after the content of the element
+ * @param schema Value encoding of each attribute key
+ * @param attrCount Number of attribute keys
+ * @return size_t Size of the block, the child count follows it
+ */
+size_t HDL_AttrBlockInit (struct HDL_AttrBlock *block, const uint8_t *data, const uint8_t *schema, uint32_t attrCount);
+
+/**
+ * @brief Finds an attribute of an element, in constant time
+ *
+ * @param block
+ * @param key Attribute key
+ * @param value_out
+ * @return int 0 if found, 1 if the element does not have the attribute
+ */
+int HDL_AttrFind (const struct HDL_AttrBlock *block, uint32_t key, struct HDL_AttrValue *value_out);
+
+/**
+ * @brief Reads an unsigned varint
+ *
+ * @param data Advanced past the varint
+ * @return uint64_t
+ */
+uint64_t HDL_ReadVarint (const uint8_t **data);
+
+/**
+ * @brief Reads a zigzag encoded signed varint
+ *
+ * @param data Advanced past the varint
+ * @return int64_t
+ */
+int64_t HDL_ReadZigzag (const uint8_t **data);
+#endif
@@ -0,0 +1,148 @@
+#include "hdl-encode.h"
+#include <string.h>
+
+// Number of LZ hash chains, power of 2
+#define HDL_LZ_HASH_SIZE    4096
+// Most candidates tried for each LZ match
+#define HDL_LZ_MAX_TRIES    64
+// Longest literal run
+#define HDL_MAX_LITERAL     128
+
+size_t HDL_EncodeBound (size_t len) {
+    // Worst case is all literals, one control byte per run
+    return len + len / HDL_MAX_LITERAL + 1;
+}
+
+/**
+ * @brief Writes literal runs
+ *
+ * @param data
+ * @param len
+ * @param out
+ * @return size_t Bytes written
+ */
+static size_t _HDL_EncodeLiterals (const uint8_t *data, size_t len, uint8_t *out) {
+    size_t o = 0;
+    while(len > 0) {
+        size_t n = len < HDL_MAX_LITERAL ? len : HDL_MAX_LITERAL;
+        out[o++] = n - 1;
+        memcpy(out + o, data, n);
+        o += n;
+        data += n;
+        len -= n;
+    }
+    return o;
+}
+
+/**
+ * @brief Encodes with PackBits, runs of 3 or more bytes are repeated
+ *
+ * @param data
+ * @param len
+ * @param out
+ * @return size_t
+ */
+static size_t _HDL_EncodePackBits (const uint8_t *data, size_t len, uint8_t *out) {
+    size_t o = 0;
+    size_t lit_start = 0;
+    size_t i = 0;
+    while(i < len) {
+        size_t run = 1;
+        while(i + run < len && run < 128 && data[i + run] == data[i]) {
+            run++;
+        }
+        if(run < 3) {
+            i += run;
+            continue;
+        }
+        o += _HDL_EncodeLiterals(data + lit_start, i - lit_start, out + o);
+        out[o++] = 257 - run;
+        out[o++] = data[i];
+        i += run;
+        lit_start = i;
+    }
+    o += _HDL_EncodeLiterals(data + lit_start, len - lit_start, out + o);
+    return o;
+}
+
+/**
+ * @brief Hash of the 3 bytes a LZ match starts with
+ *
+ * @param data
+ * @return uint32_t
+ */
+static inline uint32_t _HDL_LZHash (const uint8_t *data) {
+    uint32_t v = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (v * 2654435761u) >> (32 - 12);
+}
+
+/**
+ * @brief Encodes with LZ, matches are found with hash chains over the window
+ *
+ * @param data
+ * @param len
+ * @param out
+ * @return size_t
+ */
+static size_t _HDL_EncodeLZ (const uint8_t *data, size_t len, uint8_t *out) {
+    // Last position of each hash and the previous position with the same hash, -1 if none
+    int64_t head[HDL_LZ_HASH_SIZE];
+    int64_t prev[HDL_LZ_WINDOW];
+    memset(head, 0xFF, sizeof(head));
+
+    size_t o = 0;
+    size_t lit_start = 0;
+    size_t i = 0;
+    while(i < len) {
+        size_t best_len = 0;
+        size_t best_off = 0;
+        size_t max_len = len - i < HDL_LZ_MAX_MATCH ? len - i : HDL_LZ_MAX_MATCH;
+        if(max_len >= HDL_LZ_MIN_MATCH) {
+            int64_t cand = head[_HDL_LZHash(data + i)];
+            for(int tries = 0; cand >= 0 && i - cand <= HDL_LZ_WINDOW && tries < HDL_LZ_MAX_TRIES; tries++) {
+                // Match may run into the bytes it copies
+                size_t l = 0;
+                while(l < max_len && data[cand + l] == data[i + l]) {
+                    l++;
+                }
+                if(l > best_len) {
+                    best_len = l;
+                    best_off = i - cand;
+                    if(l == max_len)
+                        break;
+                }
+                cand = prev[cand % HDL_LZ_WINDOW];
+            }
+        }
+
+        size_t n = best_len >= HDL_LZ_MIN_MATCH ? best_len : 1;
+        if(best_len >= HDL_LZ_MIN_MATCH) {
+            o += _HDL_EncodeLiterals(data + lit_start, i - lit_start, out + o);
+            out[o++] = best_len + 125;
+            out[o++] = best_off & 0xFF;
+            out[o++] = best_off >> 8;
+            lit_start = i + n;
+        }
+        for(size_t end = i + n; i < end; i++) {
+            if(len - i >= HDL_LZ_MIN_MATCH) {
+                uint32_t h = _HDL_LZHash(data + i);
+                prev[i % HDL_LZ_WINDOW] = head[h];
+                head[h] = i;
+            }
+        }
+    }
+    o += _HDL_EncodeLiterals(data + lit_start, len - lit_start, out + o);
+    return o;
+}
+
+size_t HDL_Encode (enum HDL_BitmapEncoding encoding, const uint8_t *data, size_t len, uint8_t *out) {
+    switch(encoding) {
+        case HDL_ENCODING_PACKBITS:
+            return _HDL_EncodePackBits(data, len, out);
+        case HDL_ENCODING_LZ:
+            return _HDL_EncodeLZ(data, len, out);
+        default:
+            memcpy(out, data, len);
+            return len;
+    }
+}
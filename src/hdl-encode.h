@@ -0,0 +1,25 @@
+#ifndef _HDL_ENCODE
+#define _HDL_ENCODE
+#include <stdint.h>
+#include <stddef.h>
+#include "hdl-decode.h"
+
+/**
+ * @brief Largest size of encoded data, for any encoding
+ *
+ * @param len Size of the raw data
+ * @return size_t
+ */
+size_t HDL_EncodeBound (size_t len);
+
+/**
+ * @brief Encodes bitmap data, read back with HDL_DecodeBytes or HDL_DecodeRow
+ *
+ * @param encoding
+ * @param data Raw data, rows are contiguous
+ * @param len Size of the raw data
+ * @param out Output, at least HDL_EncodeBound(len) bytes
+ * @return size_t Size of the encoded data
+ */
+size_t HDL_Encode (enum HDL_BitmapEncoding encoding, const uint8_t *data, size_t len, uint8_t *out);
+#endif
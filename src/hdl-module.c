@@ -0,0 +1,286 @@
+#include "hdl-module.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Initial number of modules in a cache
+#define HDL_MODULES_INITIAL_SIZE        8
+// Initial number of dependencies of a module
+#define HDL_MODULE_DEPS_INITIAL_SIZE    4
+// Deepest nesting of included modules
+#define HDL_MODULE_MAX_DEPTH            16
+// Size of the buffer files are hashed with
+#define HDL_HASH_BUFFER_SIZE            65536
+
+uint64_t HDL_Hash (const void *data, size_t len, uint64_t hash) {
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+int HDL_HashFile (const char *path, uint64_t *hash_out) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        return 1;
+    }
+    uint8_t *buffer = malloc(HDL_HASH_BUFFER_SIZE);
+    if(buffer == NULL) {
+        fclose(file);
+        return 1;
+    }
+    uint64_t hash = HDL_HASH_INIT;
+    size_t n;
+    while((n = fread(buffer, 1, HDL_HASH_BUFFER_SIZE, file)) > 0) {
+        hash = HDL_Hash(buffer, n, hash);
+    }
+    int err = ferror(file);
+    free(buffer);
+    fclose(file);
+    *hash_out = hash;
+    return err != 0;
+}
+
+/**
+ * @brief Reads a whole file
+ *
+ * @param path
+ * @param len_out Length of the file
+ * @return char* File data, freed by the caller. NULL if the file can not be read
+ */
+static char *_HDL_ReadFile (const char *path, size_t *len_out) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(len < 0) {
+        fclose(file);
+        return NULL;
+    }
+    // Empty files still get a buffer
+    char *data = malloc(len + 1);
+    if(data != NULL && fread(data, 1, len, file) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *len_out = len;
+    return data;
+}
+
+int HDL_ModuleCacheInit (struct HDL_ModuleCache *cache) {
+    memset(cache, 0, sizeof(struct HDL_ModuleCache));
+
+    // Modules are acquired again while parsing a module that includes them
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int err = pthread_mutex_init(&cache->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return err != 0;
+}
+
+/**
+ * @brief Frees a module
+ *
+ * @param module
+ */
+static void _HDL_ModuleFree (struct HDL_Module *module) {
+    HDL_DocumentFree(&module->doc);
+    if(module->deps != NULL)
+        free(module->deps);
+    free(module);
+}
+
+void HDL_ModuleCacheFree (struct HDL_ModuleCache *cache) {
+    for(uint32_t i = 0; i < cache->count; i++) {
+        _HDL_ModuleFree(cache->modules[i]);
+    }
+    if(cache->modules != NULL)
+        free(cache->modules);
+
+    cache->modules = NULL;
+    cache->count = 0;
+    cache->allocCount = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+int HDL_ModuleAddDep (struct HDL_Module *module, const char *path, uint64_t hash) {
+    if(strlen(path) >= HDL_MODULE_PATH_MAX_LENGTH) {
+        printf("Error: Path too long %s\r\n", path);
+        return 1;
+    }
+    if(module->depCount >= module->depAllocCount) {
+        uint32_t n_alloc = module->depAllocCount ? module->depAllocCount * 2 : HDL_MODULE_DEPS_INITIAL_SIZE;
+        struct HDL_ModuleDep *n_deps = realloc(module->deps, sizeof(struct HDL_ModuleDep) * n_alloc);
+        if(n_deps == NULL) {
+            printf("Error: Out of memory\r\n");
+            return 1;
+        }
+        module->deps = n_deps;
+        module->depAllocCount = n_alloc;
+    }
+    struct HDL_ModuleDep *dep = &module->deps[module->depCount++];
+    strcpy(dep->path, path);
+    dep->hash = hash;
+    return 0;
+}
+
+/**
+ * @brief Checks if a cached module was built from the current files
+ *
+ * @param module
+ * @param hash Hash of the module file now
+ * @return int 1 if the module can be reused
+ */
+static int _HDL_ModuleIsCurrent (struct HDL_Module *module, uint64_t hash) {
+    if(module->hash != hash) {
+        return 0;
+    }
+    for(uint32_t i = 0; i < module->depCount; i++) {
+        uint64_t dep_hash = 0;
+        if(HDL_HashFile(module->deps[i].path, &dep_hash) || dep_hash != module->deps[i].hash) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Parses a module file
+ *
+ * @param ctx Parse context of the including file
+ * @param path Path of the module file
+ * @param data Contents of the module file
+ * @param len Length of the contents
+ * @param hash Hash of the contents
+ * @return struct HDL_Module* NULL on failure
+ */
+static struct HDL_Module *_HDL_ModuleParse (struct HDL_ParseContext *ctx, const char *path, const char *data, size_t len, uint64_t hash) {
+    struct HDL_Module *module = calloc(1, sizeof(struct HDL_Module));
+    if(module == NULL) {
+        printf("Error: Out of memory\r\n");
+        return NULL;
+    }
+    strcpy(module->path, path);
+    module->hash = hash;
+
+    // Module is parsed with its own context, paths in it are relative to the module
+    struct HDL_ParseContext sub;
+    HDL_ParseContextInit(&sub, path);
+    sub.lex_mode = ctx->lex_mode;
+    sub.lex_threads = ctx->lex_threads;
+    sub.modules = ctx->modules;
+    sub.module = module;
+    sub.include_depth = ctx->include_depth + 1;
+    sub.includer = ctx;
+
+    int err = HDL_Parse(&sub, data, len, &module->doc);
+    if(err) {
+        printf("Error: Failed to parse included file %s\r\n", path);
+    }
+    else if(module->doc.elementCount > 0) {
+        printf("Error: Included file %s must only contain definitions\r\n", path);
+        err = 1;
+    }
+    if(err) {
+        _HDL_ModuleFree(module);
+        return NULL;
+    }
+    return module;
+}
+
+int HDL_ModuleAcquire (struct HDL_ParseContext *ctx, const char *path, struct HDL_Module **module_out) {
+    // Module including itself, directly or through other modules
+    for(struct HDL_ParseContext *includer = ctx; includer != NULL; includer = includer->includer) {
+        if(includer->module != NULL && strcmp(includer->module->path, path) == 0) {
+            printf("Error: Include cycle, %s is included again by %s\r\n", path, ctx->module->path);
+            return 1;
+        }
+    }
+    if(ctx->include_depth >= HDL_MODULE_MAX_DEPTH) {
+        printf("Error: Includes nested too deep at %s\r\n", path);
+        return 1;
+    }
+    if(strlen(path) >= HDL_MODULE_PATH_MAX_LENGTH) {
+        printf("Error: Path too long %s\r\n", path);
+        return 1;
+    }
+
+    size_t len = 0;
+    char *data = _HDL_ReadFile(path, &len);
+    if(data == NULL) {
+        printf("Error: Could not read included file %s\r\n", path);
+        return 1;
+    }
+    uint64_t hash = HDL_Hash(data, len, HDL_HASH_INIT);
+
+    struct HDL_ModuleCache *cache = ctx->modules;
+    if(cache == NULL) {
+        *module_out = _HDL_ModuleParse(ctx, path, data, len, hash);
+        free(data);
+        return *module_out == NULL;
+    }
+
+    // Lock is held until the module is released
+    pthread_mutex_lock(&cache->lock);
+
+    int32_t slot = -1;
+    for(uint32_t i = 0; i < cache->count; i++) {
+        if(strcmp(cache->modules[i]->path, path) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if(slot >= 0 && _HDL_ModuleIsCurrent(cache->modules[slot], hash)) {
+        cache->hits++;
+        free(data);
+        *module_out = cache->modules[slot];
+        return 0;
+    }
+
+    struct HDL_Module *module = _HDL_ModuleParse(ctx, path, data, len, hash);
+    free(data);
+    if(module == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        return 1;
+    }
+    cache->misses++;
+
+    if(slot >= 0) {
+        // Module or a file it depends on changed
+        _HDL_ModuleFree(cache->modules[slot]);
+        cache->modules[slot] = module;
+    }
+    else {
+        if(cache->count >= cache->allocCount) {
+            uint32_t n_alloc = cache->allocCount ? cache->allocCount * 2 : HDL_MODULES_INITIAL_SIZE;
+            struct HDL_Module **n_modules = realloc(cache->modules, sizeof(struct HDL_Module*) * n_alloc);
+            if(n_modules == NULL) {
+                printf("Error: Out of memory\r\n");
+                _HDL_ModuleFree(module);
+                pthread_mutex_unlock(&cache->lock);
+                return 1;
+            }
+            cache->modules = n_modules;
+            cache->allocCount = n_alloc;
+        }
+        cache->modules[cache->count++] = module;
+    }
+    *module_out = module;
+    return 0;
+}
+
+void HDL_ModuleRelease (struct HDL_ParseContext *ctx, struct HDL_Module *module) {
+    if(ctx->modules == NULL) {
+        _HDL_ModuleFree(module);
+    }
+    else {
+        pthread_mutex_unlock(&ctx->modules->lock);
+    }
+}
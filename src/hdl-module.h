@@ -0,0 +1,109 @@
+#ifndef _HDL_MODULE
+#define _HDL_MODULE
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "hdl-parse.h"
+
+// Maximum length of a module or dependency path
+#define HDL_MODULE_PATH_MAX_LENGTH  256
+
+// File a module was built from, module is parsed again if its hash changes
+struct HDL_ModuleDep {
+    char path[HDL_MODULE_PATH_MAX_LENGTH];
+    uint64_t hash;
+};
+
+// Included file, only its definitions (#const and #img) are used
+struct HDL_Module {
+    // Path of the module file
+    char path[HDL_MODULE_PATH_MAX_LENGTH];
+    // Hash of the module file
+    uint64_t hash;
+    // Parsed module, bitmaps are decoded
+    struct HDL_Document doc;
+    // Files loaded while parsing the module (bitmaps and nested modules)
+    struct HDL_ModuleDep *deps;
+    uint32_t depCount;
+    uint32_t depAllocCount;
+};
+
+// Parsed modules shared by every document parsed with the cache, safe to use from multiple threads
+struct HDL_ModuleCache {
+    struct HDL_Module **modules;
+    uint32_t count;
+    uint32_t allocCount;
+    // Held while a module is parsed or in use
+    pthread_mutex_t lock;
+    // Modules parsed and modules reused
+    uint32_t misses;
+    uint32_t hits;
+};
+
+/**
+ * @brief Initializes an empty module cache
+ *
+ * @param cache
+ * @return int 0 on success
+ */
+int HDL_ModuleCacheInit (struct HDL_ModuleCache *cache);
+
+/**
+ * @brief Frees the cache and every module in it
+ *
+ * @param cache
+ */
+void HDL_ModuleCacheFree (struct HDL_ModuleCache *cache);
+
+/**
+ * @brief Returns a parsed module, from the cache of the context if the module and its dependencies are unchanged
+ *
+ * Module must be released with HDL_ModuleRelease
+ *
+ * @param ctx Parse context of the including file
+ * @param path Path of the module file
+ * @param module_out
+ * @return int 0 on success
+ */
+int HDL_ModuleAcquire (struct HDL_ParseContext *ctx, const char *path, struct HDL_Module **module_out);
+
+/**
+ * @brief Releases a module returned by HDL_ModuleAcquire, frees it if the context has no cache
+ *
+ * @param ctx
+ * @param module
+ */
+void HDL_ModuleRelease (struct HDL_ParseContext *ctx, struct HDL_Module *module);
+
+/**
+ * @brief Records a file the module being parsed depends on
+ *
+ * @param module
+ * @param path
+ * @param hash Hash of the file
+ * @return int 0 on success
+ */
+int HDL_ModuleAddDep (struct HDL_Module *module, const char *path, uint64_t hash);
+
+/**
+ * @brief FNV-1a hash of data
+ *
+ * @param data
+ * @param len
+ * @param hash Previous hash to continue from, HDL_HASH_INIT to start
+ * @return uint64_t
+ */
+uint64_t HDL_Hash (const void *data, size_t len, uint64_t hash);
+
+// Initial value of HDL_Hash
+#define HDL_HASH_INIT   14695981039346656037ull
+
+/**
+ * @brief Hashes the contents of a file
+ *
+ * @param path
+ * @param hash_out
+ * @return int 0 on success, 1 if the file can not be read
+ */
+int HDL_HashFile (const char *path, uint64_t *hash_out);
+#endif
@@ -0,0 +1,223 @@
+#include "hdl-output.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Buffer size of a fd output, writes at least this big skip the buffer
+#define HDL_OUTPUT_FD_BUFFER_SIZE   (64 << 10)
+// Smallest memory buffer
+#define HDL_OUTPUT_MIN_SIZE         256
+
+int HDL_OutputInitBuffer (struct HDL_Output *out, size_t size) {
+    memset(out, 0, sizeof(struct HDL_Output));
+    out->kind = HDL_OUTPUT_BUFFER;
+    out->fd = -1;
+    out->base = -1;
+    out->allocated = size < HDL_OUTPUT_MIN_SIZE ? HDL_OUTPUT_MIN_SIZE : size;
+    out->data = malloc(out->allocated);
+    if(out->data == NULL) {
+        out->allocated = 0;
+        out->error = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int HDL_OutputInitFd (struct HDL_Output *out, int fd) {
+    memset(out, 0, sizeof(struct HDL_Output));
+    out->kind = HDL_OUTPUT_FD;
+    out->fd = fd;
+    out->base = lseek(fd, 0, SEEK_CUR);
+    out->allocated = HDL_OUTPUT_FD_BUFFER_SIZE;
+    out->data = malloc(out->allocated);
+    if(out->data == NULL) {
+        out->allocated = 0;
+        out->error = 1;
+        return 1;
+    }
+    return 0;
+}
+
+void HDL_OutputInitCount (struct HDL_Output *out) {
+    memset(out, 0, sizeof(struct HDL_Output));
+    out->kind = HDL_OUTPUT_COUNT;
+    out->fd = -1;
+    out->base = -1;
+}
+
+/**
+ * @brief Writes all of the data to the file, retrying short writes
+ *
+ * @param fd
+ * @param data
+ * @param len
+ * @return int 0 on success
+ */
+static int _HDL_WriteAll (int fd, const uint8_t *data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n <= 0) {
+            return 1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int HDL_OutputFlush (struct HDL_Output *out) {
+    if(out->kind == HDL_OUTPUT_FD && !out->error && out->used > 0) {
+        if(_HDL_WriteAll(out->fd, out->data, out->used)) {
+            printf("Error: Failed to write output\r\n");
+            out->error = 1;
+        }
+        out->used = 0;
+    }
+    return out->error;
+}
+
+int HDL_OutputWrite (struct HDL_Output *out, const void *data, size_t len) {
+    if(out->error) {
+        return 1;
+    }
+    switch(out->kind) {
+        case HDL_OUTPUT_BUFFER:
+        {
+            if(out->used + len > out->allocated) {
+                size_t n_alloc = out->allocated * 2;
+                if(n_alloc < out->used + len) {
+                    n_alloc = out->used + len;
+                }
+                uint8_t *n_data = realloc(out->data, n_alloc);
+                if(n_data == NULL) {
+                    printf("Error: Out of memory\r\n");
+                    out->error = 1;
+                    return 1;
+                }
+                out->data = n_data;
+                out->allocated = n_alloc;
+            }
+            memcpy(out->data + out->used, data, len);
+            out->used += len;
+            break;
+        }
+        case HDL_OUTPUT_FD:
+        {
+            if(out->used + len > out->allocated && HDL_OutputFlush(out)) {
+                return 1;
+            }
+            if(len >= out->allocated) {
+                // Big writes (bitmaps) go straight to the file
+                if(_HDL_WriteAll(out->fd, data, len)) {
+                    printf("Error: Failed to write output\r\n");
+                    out->error = 1;
+                    return 1;
+                }
+            }
+            else {
+                memcpy(out->data + out->used, data, len);
+                out->used += len;
+            }
+            break;
+        }
+        case HDL_OUTPUT_COUNT:
+            break;
+    }
+    out->size += len;
+    return 0;
+}
+
+int HDL_OutputByte (struct HDL_Output *out, uint8_t value) {
+    if(out->kind != HDL_OUTPUT_COUNT && out->used < out->allocated && !out->error) {
+        // Fast path, room in the buffer
+        out->data[out->used++] = value;
+        out->size++;
+        return 0;
+    }
+    return HDL_OutputWrite(out, &value, 1);
+}
+
+int HDL_OutputUint (struct HDL_Output *out, uint64_t value, int size) {
+    uint8_t bytes[8];
+    for(int i = 0; i < size; i++) {
+        bytes[out->bigEndian ? size - 1 - i : i] = value >> (i * 8);
+    }
+    return HDL_OutputWrite(out, bytes, size);
+}
+
+int HDL_OutputAlign (struct HDL_Output *out, size_t alignment) {
+    static const uint8_t zeros[64] = { 0 };
+    size_t pad = (alignment - out->size % alignment) % alignment;
+    while(pad > 0) {
+        size_t n = pad < sizeof(zeros) ? pad : sizeof(zeros);
+        if(HDL_OutputWrite(out, zeros, n)) {
+            return 1;
+        }
+        pad -= n;
+    }
+    return 0;
+}
+
+int HDL_OutputVarint (struct HDL_Output *out, uint64_t value) {
+    uint8_t bytes[10];
+    int len = 0;
+    do {
+        bytes[len] = value & 0x7F;
+        value >>= 7;
+        if(value != 0) {
+            bytes[len] |= 0x80;
+        }
+        len++;
+    }
+    while(value != 0);
+    return HDL_OutputWrite(out, bytes, len);
+}
+
+int HDL_OutputPatch (struct HDL_Output *out, size_t offset, const void *data, size_t len) {
+    if(out->error) {
+        return 1;
+    }
+    if(offset + len > out->size) {
+        printf("Error: Patch past the end of output\r\n");
+        out->error = 1;
+        return 1;
+    }
+    switch(out->kind) {
+        case HDL_OUTPUT_BUFFER:
+            memcpy(out->data + offset, data, len);
+            break;
+        case HDL_OUTPUT_FD:
+        {
+            // Part still in the buffer is patched there, the rest in the file
+            size_t buffered = out->size - out->used;
+            const uint8_t *bytes = data;
+            if(offset < buffered) {
+                size_t n = buffered - offset < len ? buffered - offset : len;
+                if(out->base < 0 || pwrite(out->fd, bytes, n, out->base + offset) != (ssize_t)n) {
+                    printf("Error: Failed to write output\r\n");
+                    out->error = 1;
+                    return 1;
+                }
+                bytes += n;
+                offset += n;
+                len -= n;
+            }
+            memcpy(out->data + (offset - buffered), bytes, len);
+            break;
+        }
+        case HDL_OUTPUT_COUNT:
+            break;
+    }
+    return 0;
+}
+
+int HDL_OutputClose (struct HDL_Output *out) {
+    int err = HDL_OutputFlush(out);
+    if(out->data != NULL)
+        free(out->data);
+    out->data = NULL;
+    out->used = 0;
+    out->allocated = 0;
+    return err;
+}
@@ -0,0 +1,135 @@
+#ifndef _HDL_OUTPUT
+#define _HDL_OUTPUT
+#include <stdint.h>
+#include <stddef.h>
+
+// Where compiled output goes
+enum HDL_OutputKind {
+    // Growable memory buffer, holds the whole output
+    HDL_OUTPUT_BUFFER,
+    // File descriptor, writes are buffered and big writes go straight to the file
+    HDL_OUTPUT_FD,
+    // Nothing is stored, only the size is counted (dry run)
+    HDL_OUTPUT_COUNT
+};
+
+// Sink for compiled output. Writes never overflow, a failed write sets the error and later writes are ignored
+struct HDL_Output {
+    enum HDL_OutputKind kind;
+    // Whole output (buffer) or bytes not yet written to the file (fd)
+    uint8_t *data;
+    // Bytes in data
+    size_t used;
+    // Allocated size of data
+    size_t allocated;
+    // Total bytes written, position of the next write
+    size_t size;
+    // Output file
+    int fd;
+    // Offset of the output in the file, -1 if the file is not seekable
+    int64_t base;
+    // Out of memory or writing the file failed
+    int error;
+    // Unsigned values are written big endian, set after init
+    uint8_t bigEndian;
+};
+
+/**
+ * @brief Initializes an output to a growable memory buffer
+ *
+ * @param out
+ * @param size Initial size of the buffer, grows as needed
+ * @return int 0 on success
+ */
+int HDL_OutputInitBuffer (struct HDL_Output *out, size_t size);
+
+/**
+ * @brief Initializes an output that writes to a file descriptor
+ *
+ * @param out
+ * @param fd Output file, written from its current position
+ * @return int 0 on success
+ */
+int HDL_OutputInitFd (struct HDL_Output *out, int fd);
+
+/**
+ * @brief Initializes an output that only counts the size
+ *
+ * @param out
+ */
+void HDL_OutputInitCount (struct HDL_Output *out);
+
+/**
+ * @brief Writes data to the output
+ *
+ * @param out
+ * @param data
+ * @param len
+ * @return int 0 on success
+ */
+int HDL_OutputWrite (struct HDL_Output *out, const void *data, size_t len);
+
+/**
+ * @brief Writes a byte
+ *
+ * @param out
+ * @param value
+ * @return int 0 on success
+ */
+int HDL_OutputByte (struct HDL_Output *out, uint8_t value);
+
+/**
+ * @brief Writes an unsigned value, little endian unless bigEndian is set
+ *
+ * @param out
+ * @param value
+ * @param size Size in bytes, 1, 2, 4 or 8
+ * @return int 0 on success
+ */
+int HDL_OutputUint (struct HDL_Output *out, uint64_t value, int size);
+
+/**
+ * @brief Writes zero bytes until the output size is a multiple of the alignment
+ *
+ * @param out
+ * @param alignment Power of 2
+ * @return int 0 on success
+ */
+int HDL_OutputAlign (struct HDL_Output *out, size_t alignment);
+
+/**
+ * @brief Writes an unsigned varint, 7 bits per byte starting from the lowest, high bit set if more bytes follow
+ *
+ * @param out
+ * @param value
+ * @return int 0 on success
+ */
+int HDL_OutputVarint (struct HDL_Output *out, uint64_t value);
+
+/**
+ * @brief Overwrites bytes already written to the output
+ *
+ * @param out
+ * @param offset Offset of the bytes in the output
+ * @param data
+ * @param len
+ * @return int 0 on success
+ */
+int HDL_OutputPatch (struct HDL_Output *out, size_t offset, const void *data, size_t len);
+
+/**
+ * @brief Writes buffered data to the file of a fd output
+ *
+ * @param out
+ * @return int 0 on success, or the error of an earlier write
+ */
+int HDL_OutputFlush (struct HDL_Output *out);
+
+/**
+ * @brief Flushes and frees the output, the file descriptor is not closed
+ *
+ * @param out
+ * @return int 0 if all of the output was written
+ */
+int HDL_OutputClose (struct HDL_Output *out);
+#endif
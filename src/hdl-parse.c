@@ -1,14 +1,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "hdl-parse.h"
 #include <math.h>
 #include "hdl-util.h"
+#include "hdl-module.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-// Number of bytes to reallocate if out of memory
-#define HDL_DATABUFFER_REALLOC_SIZE     256
-// Number of block pointers to reallocate if out of memory
+// Number of tokens to reallocate if out of memory
 #define HDL_BLOCKBUFFER_REALLOC_SIZE    32
+// Size of the chunks read from a streamed input
+#define HDL_STREAM_CHUNK_SIZE           65536
+// Number of blocks kept behind the last block requested by the parser when streaming
+#define HDL_STREAM_LOOKBEHIND           8
+// Inputs smaller than this are always lexed on one thread
+#define HDL_PARALLEL_MIN_SIZE           (1 << 20)
+// Smallest chunk of input given to a lexer thread
+#define HDL_PARALLEL_MIN_CHUNK          (256 << 10)
+// Bytes lexed from a guessed quote state before giving up on convergence
+#define HDL_PARALLEL_SPECULATE_SIZE     (64 << 10)
+// Max number of lexer threads
+#define HDL_PARALLEL_MAX_THREADS        64
 
 // Initial size of document element buffer
 #define HDL_DOC_ELEMENTS_INITIAL_SIZE   16
@@ -16,20 +32,22 @@
 #define HDL_DOC_VARS_INITIAL_SIZE       16
 // Initial size of bitmap buffer
 #define HDL_DOC_BITMAPS_INITIAL_SIZE    8
-// Initial size of element attribute buffer
-#define HDL_ELEMENT_ATTR_INITIAL_SIZE   8
-// Initial size of element children
-#define HDL_ELEMENT_CHILDREN_INITIAL_SIZE   8
+// Initial number of included modules of a document
+#define HDL_DOC_INCLUDES_INITIAL_SIZE   4
+// Initial size of the attribute pool
+#define HDL_DOC_ATTRS_INITIAL_SIZE      64
+// Initial depth of the element parser stack
+#define HDL_PARSE_STACK_INITIAL_SIZE    32
+// Longest numeric literal, longer words are not numbers
+#define HDL_NUMBER_MAX_LENGTH           48
+// Integer literal above INT64_MAX, lexed as HDL_TOKEN_INT and reported when it is read
+#define HDL_NUMBER_OUT_OF_RANGE         0xFF
+// Deepest nesting of parentheses and unary operators in a constant expression
+#define HDL_EXPR_MAX_DEPTH              64
 
 
-// Buffer for data 
-static char *data_buffer = NULL;
-// Array of addresses of split blocks
-static char **blocks = NULL;
-// Count of the blocks
-static uint32_t block_count = 0;
-// Count allocated (for block reallocation)
-static uint32_t blocks_allocated = 0;
+// End of input, returned for indices past the last block
+static struct HDL_Token block_eof = { 0, 0, HDL_TOKEN_EOF, 0, 0 };
 
 
 // Type sizes
@@ -41,195 +59,625 @@ uint8_t HDL_TYPE_SIZES[HDL_TYPE_COUNT] = {
     1, /* HDL_TYPE_I8 */
     2, /* HDL_TYPE_I16 */
     4, /* HDL_TYPE_I32 */
-    2, /* HDL_TYPE_IMG */
+    4, /* HDL_TYPE_IMG */
     1, /* HDL_TYPE_BIND */
+    8, /* HDL_TYPE_I64 */
+    1, /* HDL_TYPE_U8 */
+    2, /* HDL_TYPE_U16 */
 };
 
-// Delimiter characters
-static const char delimiters[] = {
-    '#',    // Define const or img
-    '\n',   // Whitespace
-    '\r',   // Whitespace
-    '\t',   // Whitespace
-    ' ',    // Whitespace
-    '<',    // Tag start
-    '>',    // Tag end
-    '/',    // Short tag delimiter 
-    '*',    // Comment delimiter
-    '=',    // Delimiter for attributes
-    '[',    // Delimiter for array start
-    ']',    // Delimiter for array end
-    ',',    // Delimiter for array values
-    '(',    // Delimiter for image parameter start
-    ')',    // Delimiter for image parameter end
-    '$',    // Binding value
+// Character classes
+#define HDL_CHAR_DELIMITER      0x01
+#define HDL_CHAR_WHITESPACE     0x02
+#define HDL_CHAR_QUOTE          0x04
+#define HDL_CHAR_ESCAPE         0x08
+// Not plain inside quotes and element content
+#define HDL_CHAR_TEXT           0x10
+
+// Character class table, characters with class 0 are plain and never change the lexer state
+static const uint8_t char_class[256] = {
+    ['#']   = HDL_CHAR_DELIMITER,   // Define const or img
+    ['\n']  = HDL_CHAR_DELIMITER | HDL_CHAR_WHITESPACE | HDL_CHAR_TEXT,
+    ['\r']  = HDL_CHAR_DELIMITER | HDL_CHAR_WHITESPACE | HDL_CHAR_TEXT,
+    ['\t']  = HDL_CHAR_DELIMITER | HDL_CHAR_WHITESPACE | HDL_CHAR_TEXT,
+    [' ']   = HDL_CHAR_DELIMITER | HDL_CHAR_WHITESPACE,
+    ['<']   = HDL_CHAR_DELIMITER | HDL_CHAR_TEXT,   // Tag start
+    ['>']   = HDL_CHAR_DELIMITER,   // Tag end
+    ['/']   = HDL_CHAR_DELIMITER,   // Short tag delimiter 
+    ['*']   = HDL_CHAR_DELIMITER,   // Comment delimiter
+    ['=']   = HDL_CHAR_DELIMITER,   // Delimiter for attributes
+    ['[']   = HDL_CHAR_DELIMITER,   // Delimiter for array start
+    [']']   = HDL_CHAR_DELIMITER,   // Delimiter for array end
+    [',']   = HDL_CHAR_DELIMITER,   // Delimiter for array values
+    ['(']   = HDL_CHAR_DELIMITER,   // Delimiter for image parameter start
+    [')']   = HDL_CHAR_DELIMITER,   // Delimiter for image parameter end
+    ['$']   = HDL_CHAR_DELIMITER,   // Binding value
+    ['+']   = HDL_CHAR_DELIMITER,   // Expression operators, hyphenated names ("my-value") are joined back by the parser
+    ['-']   = HDL_CHAR_DELIMITER,
+    ['%']   = HDL_CHAR_DELIMITER,
+    ['&']   = HDL_CHAR_DELIMITER,
+    ['|']   = HDL_CHAR_DELIMITER,
+    ['^']   = HDL_CHAR_DELIMITER,
+    ['~']   = HDL_CHAR_DELIMITER,
+    ['\'']  = HDL_CHAR_QUOTE | HDL_CHAR_TEXT,
+    ['"']   = HDL_CHAR_QUOTE | HDL_CHAR_TEXT,
+    ['\\']  = HDL_CHAR_ESCAPE | HDL_CHAR_TEXT
 };
 
 
+// Value of a constant expression, folded while parsing
+struct HDL_ExprValue {
+    // HDL_TYPE_I64 or HDL_TYPE_FLOAT
+    enum HDL_Type type;
+    int64_t i;
+    double f;
+};
+
+// Open element on the element parser stack
+struct HDL_ParseFrame {
+    // Index of the element
+    uint32_t element;
+};
+
 /**
  * @brief Checks if a character is delimiter
  * 
  * @param c Character
  * @return int 0 on fail, 1 on success
  */
-static int isDelimiter (char c) {
-    for(int i = 0; i < sizeof(delimiters)/sizeof(char); i++) {
-        if(c == delimiters[i])
-            return 1;
-    }
-    return 0;
-}
-
-static int isWhitespace (char c) {
-    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
-}
-
-// Is numeric
-static int isNumeric (char c) {
-    return (c >= '0' && c <= '9');
+static inline int isDelimiter (char c) {
+    return char_class[(uint8_t)c] & HDL_CHAR_DELIMITER;
 }
 
-// Is alphabetical
-static int isAlphabetical (char c) {
-    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+static inline int isWhitespace (char c) {
+    return char_class[(uint8_t)c] & HDL_CHAR_WHITESPACE;
 }
 
-// Is number string
-static int isNumberString (char *str) {
-    uint8_t p = 0;
-    uint8_t hasnum = 0;
-    for(int i = 0; i < strlen(str); i++) {
-        if(i != 0 && str[i] == '-') {
-            // Can't have negative sign in other positions than first
-            return 0;
-        }
-        if(isAlphabetical(str[i])) {
-            // Can't be a 
-            return 0;
+/**
+ * @brief Scans a numeric literal in a single pass
+ * 
+ * Integers are decimal or 0x hex, floats are decimal with a single point.
+ * Integers above INT64_MAX are out of range, they do not become floats. '-' is an operator, negative values are constant expressions
+ * 
+ * @param str Text, not null terminated
+ * @param len Length of the text
+ * @param int_out Value of an integer literal, NULL if not needed
+ * @param float_out Value of a float literal, NULL if not needed
+ * @return uint8_t HDL_TOKEN_INT, HDL_TOKEN_FLOAT, HDL_NUMBER_OUT_OF_RANGE or HDL_TOKEN_WORD if not a number
+ */
+static uint8_t _HDL_ScanNumber (const char *str, uint32_t len, int64_t *int_out, float *float_out) {
+    uint32_t i = 0;
+    uint8_t point = 0;
+    uint8_t overflow = 0;
+    uint32_t digits = 0;
+    uint64_t value = 0;
+
+    if(len == 0 || len > HDL_NUMBER_MAX_LENGTH) {
+        return HDL_TOKEN_WORD;
+    }
+    if(len > 2 && str[0] == '0' && str[i + 1] == 'x') {
+        // Hex integer
+        for(i += 2; i < len; i++) {
+            char c = str[i];
+            uint8_t d;
+            if(c >= '0' && c <= '9') {
+                d = c - '0';
+            }
+            else if(c >= 'a' && c <= 'f') {
+                d = c - 'a' + 10;
+            }
+            else if(c >= 'A' && c <= 'F') {
+                d = c - 'A' + 10;
+            }
+            else {
+                return HDL_TOKEN_WORD;
+            }
+            overflow |= value > (UINT64_MAX >> 4);
+            value = (value << 4) | d;
         }
-        if(str[i] == '.') {
-            if(p == 0) {
-                p = 1;
-                continue;
+    }
+    else {
+        for(; i < len; i++) {
+            char c = str[i];
+            if(c >= '0' && c <= '9') {
+                uint8_t d = c - '0';
+                overflow |= value > (UINT64_MAX - d) / 10;
+                value = value * 10 + d;
+                digits++;
+            }
+            else if(c == '.' && !point) {
+                point = 1;
             }
             else {
-                // Can't have multiple points
-                return 0;
+                // Multiple points or letters
+                return HDL_TOKEN_WORD;
             }
         }
-        if(isNumeric(str[i])) {
-            hasnum = 1;
+        if(digits == 0 || str[len - 1] == '.') {
+            // No digits or point at the end of the string
+            return HDL_TOKEN_WORD;
         }
     }
 
-    if(p == 1 && str[strlen(str) - 1] == '.') {
-        // period at the end of the string
-        return 0;
+    if(!point) {
+        if(overflow || value > INT64_MAX) {
+            return HDL_NUMBER_OUT_OF_RANGE;
+        }
+        if(int_out != NULL) {
+            *int_out = value;
+        }
+        return HDL_TOKEN_INT;
     }
 
-    if(hasnum) {
-        return 1;
+    if(float_out != NULL) {
+        // Bounded copy for strtof, the text is not null terminated
+        char buff[HDL_NUMBER_MAX_LENGTH + 1];
+        memcpy(buff, str, len);
+        buff[len] = 0;
+        *float_out = strtof(buff, NULL);
     }
-    else {
-        return 0;
+    return HDL_TOKEN_FLOAT;
+}
+
+/**
+ * @brief Counts plain characters at the start of data
+ * 
+ * @param data 
+ * @param len 
+ * @return uint32_t Number of plain characters
+ */
+static uint32_t _HDL_SkipWordScalar (const char *data, uint32_t len) {
+    uint32_t i = 0;
+    while(i < len && char_class[(uint8_t)data[i]] == 0) {
+        i++;
     }
+    return i;
 }
+
 /**
- * @brief Is integer string
+ * @brief Counts plain characters in quotes or content at the start of data
  * 
- * @param str 
- * @return int 
+ * Single spaces are plain, a space after a space is not. First character must not be a space after whitespace
+ * 
+ * @param data 
+ * @param len 
+ * @return uint32_t Number of plain characters
  */
-static int isIntString (char *str) {
-    uint8_t hasnum = 0;
-    int len = strlen(str);
-    for(int i = 0; i < len; i++) {
-        if(i != 0 && str[i] == '-') {
-            // Can't have negative sign in other positions than first
-            return 0;
+static uint32_t _HDL_SkipTextScalar (const char *data, uint32_t len) {
+    uint32_t i = 0;
+    while(i < len && !(char_class[(uint8_t)data[i]] & HDL_CHAR_TEXT)) {
+        if(i > 0 && data[i] == ' ' && data[i - 1] == ' ') {
+            break;
         }
-        if(isNumeric(str[i])) {
-            hasnum = 1;
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__)
+/*
+    SIMD versions flag candidate bytes and check them with the class table.
+    Words: candidates are <= 0x2F, '<'..'>', '['..'^' or '|'..'~', false positives ('.', '}', ...) are skipped.
+    Text: candidates are control characters, '<', quotes, '\' and a space after a space.
+*/
+static uint32_t _HDL_SkipWordSSE2 (const char *data, uint32_t len) {
+    const __m128i low = _mm_set1_epi8(0x2F);
+    const __m128i tag = _mm_set1_epi8(0x3C);
+    const __m128i bracket = _mm_set1_epi8(0x5B);
+    const __m128i brace = _mm_set1_epi8(0x7C);
+    const __m128i range = _mm_set1_epi8(2);
+    const __m128i bracket_range = _mm_set1_epi8(3);
+    uint32_t i = 0;
+
+    // Most words are short, check the first bytes one by one
+    while(i < 8 && i < len) {
+        if(char_class[(uint8_t)data[i]]) {
+            return i;
         }
-        else if(str[i] == '-') {
+        i++;
+    }
 
+    while(i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(v, low), v);
+        __m128i d = _mm_sub_epi8(v, tag);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(d, range), d));
+        d = _mm_sub_epi8(v, bracket);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(d, bracket_range), d));
+        d = _mm_sub_epi8(v, brace);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(d, range), d));
+
+        uint32_t mask = _mm_movemask_epi8(m);
+        while(mask) {
+            int p = __builtin_ctz(mask);
+            if(char_class[(uint8_t)data[i + p]]) {
+                return i + p;
+            }
+            mask &= mask - 1;
         }
-        else {
-            return 0;
+        i += 16;
+    }
+    return i + _HDL_SkipWordScalar(data + i, len - i);
+}
+
+static uint32_t _HDL_SkipTextSSE2 (const char *data, uint32_t len) {
+    const __m128i control = _mm_set1_epi8(0x1F);
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tag = _mm_set1_epi8('<');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i escape = _mm_set1_epi8('\\');
+    // Last byte of the previous vector was a space
+    uint32_t carry = 0;
+    uint32_t i = 0;
+
+    while(i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(v, control), v);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, tag));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, squote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, dquote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, escape));
+
+        uint32_t spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(v, space));
+        uint32_t mask = _mm_movemask_epi8(m) | (spaces & ((spaces << 1) | carry));
+        while(mask) {
+            int p = __builtin_ctz(mask);
+            if(data[i + p] == ' ' || (char_class[(uint8_t)data[i + p]] & HDL_CHAR_TEXT)) {
+                return i + p;
+            }
+            mask &= mask - 1;
         }
+        carry = spaces >> 15;
+        i += 16;
+    }
+    if(i > 0 && i < len && carry && data[i] == ' ') {
+        return i;
     }
-    return hasnum;
+    return i + _HDL_SkipTextScalar(data + i, len - i);
 }
 
-void _HDL_FreeBlocks () {
-    if(data_buffer != NULL)
-        free(data_buffer);
+__attribute__((target("avx2")))
+static uint32_t _HDL_SkipWordAVX2 (const char *data, uint32_t len) {
+    const __m256i low = _mm256_set1_epi8(0x2F);
+    const __m256i tag = _mm256_set1_epi8(0x3C);
+    const __m256i bracket = _mm256_set1_epi8(0x5B);
+    const __m256i brace = _mm256_set1_epi8(0x7C);
+    const __m256i range = _mm256_set1_epi8(2);
+    const __m256i bracket_range = _mm256_set1_epi8(3);
+    uint32_t i = 0;
+
+    // Most words are short, check the first bytes one by one
+    while(i < 8 && i < len) {
+        if(char_class[(uint8_t)data[i]]) {
+            return i;
+        }
+        i++;
+    }
+
+    while(i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, low), v);
+        __m256i d = _mm256_sub_epi8(v, tag);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(d, range), d));
+        d = _mm256_sub_epi8(v, bracket);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(d, bracket_range), d));
+        d = _mm256_sub_epi8(v, brace);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(d, range), d));
+
+        uint32_t mask = _mm256_movemask_epi8(m);
+        while(mask) {
+            int p = __builtin_ctz(mask);
+            if(char_class[(uint8_t)data[i + p]]) {
+                return i + p;
+            }
+            mask &= mask - 1;
+        }
+        i += 32;
+    }
+    return i + _HDL_SkipWordSSE2(data + i, len - i);
+}
 
-    if(blocks != NULL)
-        free(blocks);
+__attribute__((target("avx2")))
+static uint32_t _HDL_SkipTextAVX2 (const char *data, uint32_t len) {
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tag = _mm256_set1_epi8('<');
+    const __m256i squote = _mm256_set1_epi8('\'');
+    const __m256i dquote = _mm256_set1_epi8('"');
+    const __m256i escape = _mm256_set1_epi8('\\');
+    // Last byte of the previous vector was a space
+    uint32_t carry = 0;
+    uint32_t i = 0;
+
+    while(i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, tag));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, squote));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, dquote));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, escape));
+
+        uint32_t spaces = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, space));
+        uint32_t mask = _mm256_movemask_epi8(m) | (spaces & ((spaces << 1) | carry));
+        while(mask) {
+            int p = __builtin_ctz(mask);
+            if(data[i + p] == ' ' || (char_class[(uint8_t)data[i + p]] & HDL_CHAR_TEXT)) {
+                return i + p;
+            }
+            mask &= mask - 1;
+        }
+        carry = spaces >> 31;
+        i += 32;
+    }
+    if(i > 0 && i < len && carry && data[i] == ' ') {
+        return i;
+    }
+    return i + _HDL_SkipTextSSE2(data + i, len - i);
+}
+#endif
 
-    block_count = 0;
-    blocks_allocated = 0;
+/**
+ * @brief Selects the skip functions for a lexer mode
+ * 
+ * @param mode 
+ * @param skip Output skip functions, NULL if the fast path is disabled
+ * @return int 0 on success, 1 if the mode is not supported on this machine
+ */
+static int _HDL_SelectSkip (enum HDL_LexMode mode, struct HDL_LexSkip *skip) {
+    skip->word = NULL;
+    skip->text = NULL;
+    switch(mode) {
+        case HDL_LEX_NONE:
+            return 0;
+        case HDL_LEX_SCALAR:
+            skip->word = _HDL_SkipWordScalar;
+            skip->text = _HDL_SkipTextScalar;
+            return 0;
+#if defined(__x86_64__)
+        case HDL_LEX_SSE2:
+            skip->word = _HDL_SkipWordSSE2;
+            skip->text = _HDL_SkipTextSSE2;
+            return 0;
+        case HDL_LEX_AVX2:
+        case HDL_LEX_AUTO:
+            if(__builtin_cpu_supports("avx2")) {
+                skip->word = _HDL_SkipWordAVX2;
+                skip->text = _HDL_SkipTextAVX2;
+                return 0;
+            }
+            else if(mode == HDL_LEX_AUTO) {
+                skip->word = _HDL_SkipWordSSE2;
+                skip->text = _HDL_SkipTextSSE2;
+                return 0;
+            }
+            return 1;
+#else
+        case HDL_LEX_AUTO:
+            skip->word = _HDL_SkipWordScalar;
+            skip->text = _HDL_SkipTextScalar;
+            return 0;
+#endif
+        default:
+            return 1;
+    }
 }
 
 /**
- * @brief Parses the data in to blocks
+ * @brief Sets the lexer fast path mode
  * 
- * @param data 
- * @return int 
+ * @param mode 
+ * @return int 0 on success, 1 if the mode is not supported on this machine
  */
-int _HDL_ParseDataToBlocks (char *data) {
-    // Save length of data
-    int len = strlen(data);
-    // Data buffer index
-    int dbi = 0;
-    // Data buffer current allocated size
-    int dalloc = 0;
+int HDL_SetLexMode (struct HDL_ParseContext *ctx, enum HDL_LexMode mode) {
+    struct HDL_LexSkip skip;
+    if(_HDL_SelectSkip(mode, &skip)) {
+        return 1;
+    }
+    ctx->lex_mode = mode;
+    return 0;
+}
 
-    _HDL_FreeBlocks();
+void _HDL_FreeBlocks (struct HDL_ParseContext *ctx) {
+    if(ctx->block_list.tokens != NULL)
+        free(ctx->block_list.tokens);
+
+    if(ctx->scratch != NULL)
+        free(ctx->scratch);
+
+    if(ctx->stream_buffer != NULL)
+        free(ctx->stream_buffer);
+
+    ctx->block_list.tokens = NULL;
+    ctx->scratch = NULL;
+    ctx->stream_buffer = NULL;
+    ctx->block_list.count = 0;
+    ctx->block_list.allocated = 0;
+    ctx->scratch_allocated = 0;
+    ctx->stream_allocated = 0;
+    ctx->source = NULL;
+    ctx->source_len = 0;
+    ctx->source_base = 0;
+    ctx->stream = NULL;
+    ctx->stream_eof = 1;
+    ctx->stream_error = 0;
+    ctx->block_base = 0;
+    ctx->block_max = 0;
+}
 
-    // Allocate data_buffer to the length of data
+/**
+ * @brief Appends a block to the block array
+ * 
+ * @param block 
+ * @return int 0 on success
+ */
+static int _HDL_PushBlock (struct HDL_TokenList *list, struct HDL_Token *block) {
+    if(list->count >= list->allocated) {
+        // Reallocate blocks, grow by half to keep the number of reallocations low on big inputs
+        uint32_t n_alloc = list->allocated + list->allocated / 2 + HDL_BLOCKBUFFER_REALLOC_SIZE;
+        struct HDL_Token *n_blocks = realloc(list->tokens, sizeof(struct HDL_Token) * n_alloc);
+        if(n_blocks == NULL) {
+            // Out of memory
+            return 1;
+        }
+        list->tokens = n_blocks;
+        list->allocated = n_alloc;
+    }
+    list->tokens[list->count++] = *block;
+    return 0;
+}
 
-    dalloc = sizeof(char) * len * 2;
-    // TODO: data_buffer reallocation: Allocate double length, because reallocation does not work yet
-    data_buffer = malloc(dalloc);
+/**
+ * @brief Appends blocks to the block array
+ * 
+ * @param list 
+ * @param tokens 
+ * @param count 
+ * @return int 0 on success
+ */
+static int _HDL_AppendBlocks (struct HDL_TokenList *list, const struct HDL_Token *tokens, uint32_t count) {
+    if(list->count + count > list->allocated) {
+        uint32_t n_alloc = list->count + count + list->count / 2 + HDL_BLOCKBUFFER_REALLOC_SIZE;
+        struct HDL_Token *n_blocks = realloc(list->tokens, sizeof(struct HDL_Token) * n_alloc);
+        if(n_blocks == NULL) {
+            // Out of memory
+            return 1;
+        }
+        list->tokens = n_blocks;
+        list->allocated = n_alloc;
+    }
+    memcpy(list->tokens + list->count, tokens, sizeof(struct HDL_Token) * count);
+    list->count += count;
+    return 0;
+}
 
-    if(data_buffer == NULL) {
-        // Out of memory
-        return 1;
+/**
+ * @brief Starts a new block
+ * 
+ * @param block 
+ * @param offset Offset of the first character
+ * @param quotes Quote state before the first character
+ * @param c First character
+ */
+static inline void _HDL_OpenBlock (struct HDL_Token *block, uint32_t offset, uint8_t quotes, char c) {
+    block->offset = offset;
+    block->length = 0;
+    block->quotes = quotes;
+    block->decode = 0;
+    if(quotes == 3) {
+        block->kind = HDL_TOKEN_CONTENT;
+    }
+    else if(c == '"' || c == '\'') {
+        block->kind = HDL_TOKEN_STRING;
+    }
+    else {
+        block->kind = HDL_TOKEN_WORD;
     }
+}
 
-    blocks_allocated = HDL_BLOCKBUFFER_REALLOC_SIZE;
-    blocks = malloc(sizeof(char*) * blocks_allocated);
+/**
+ * @brief Sets the kind of a closed word block to a numeric literal kind if it is one
+ * 
+ * @param block 
+ * @param source Input data the block offset is relative to
+ */
+static inline void _HDL_ClassifyBlock (struct HDL_Token *block, const char *source) {
+    if(block->kind == HDL_TOKEN_WORD && !block->decode) {
+        uint8_t kind = _HDL_ScanNumber(source + block->offset, block->length, NULL, NULL);
+        block->kind = kind == HDL_NUMBER_OUT_OF_RANGE ? HDL_TOKEN_INT : kind;
+    }
+}
 
-    if(blocks == NULL) {
-        // Out of memory
+/**
+ * @brief Resets the lexer state to the start of input
+ * 
+ * @param lex 
+ */
+static void _HDL_LexInit (struct HDL_Lexer *lex, struct HDL_TokenList *out, enum HDL_LexMode mode) {
+    lex->open = 0;
+    lex->inquotes = 0;
+    lex->lastChar = ' ';
+    lex->out = out;
+    lex->primary = NULL;
+    lex->primary_pos = 0;
+    lex->converged = UINT32_MAX;
+    _HDL_SelectSkip(mode, &lex->skip);
+}
+
+/**
+ * @brief Checks if a speculating lexer has reached a delimiter the primary lexer also produced
+ * 
+ * From a shared delimiter on, both lexers are in the same state and produce the same blocks
+ * 
+ * @param lex Speculating lexer
+ * @param offset Offset of the delimiter
+ * @return int 1 if converged
+ */
+static int _HDL_LexConverged (struct HDL_Lexer *lex, uint32_t offset) {
+    const struct HDL_TokenList *primary = lex->primary;
+    while(lex->primary_pos < primary->count && primary->tokens[lex->primary_pos].offset < offset) {
+        lex->primary_pos++;
+    }
+    if(lex->primary_pos < primary->count && primary->tokens[lex->primary_pos].offset == offset
+        && primary->tokens[lex->primary_pos].kind == HDL_TOKEN_DELIMITER) {
+        lex->converged = lex->primary_pos;
         return 1;
     }
+    return 0;
+}
+
+/**
+ * @brief Splits a chunk of input in to blocks
+ * 
+ * Blocks are spans (offset, length, kind) in the input data, nothing is copied.
+ * Text of a block is decoded on demand with _HDL_BlockText.
+ * State is saved to the lexer, so a block may continue in the next chunk
+ * 
+ * @param lex Lexer state
+ * @param data Chunk
+ * @param len Length of the chunk
+ * @param base Offset of the chunk in the input data
+ * @return int 0 on success
+ */
+static int _HDL_LexChunk (struct HDL_Lexer *lex, const char *data, uint32_t len, uint32_t base) {
 
-    // Save first block
-    blocks[block_count++] = &data_buffer[dbi];
+    // Work on local copies of the state
+    struct HDL_Token block = lex->block;
+    uint8_t open = lex->open;
+    struct HDL_LexSkip skip = lex->skip;
+    char lastChar = lex->lastChar;
+    uint8_t inquotes = lex->inquotes;
 
-    char lastChar = ' ';
-    int blocklen = 0;
-    // 0 = not in quotes 1 = in single quotes 2 = in double quotes
-    uint8_t inquotes = 0;
-    // Loop until termination
-    for(int i = 0; i < len; i++) {
+    // Loop until the end of the chunk
+    for(uint32_t i = 0; i < len; i++) {
 
         char c = data[i];
 
-        // Check for data buffer size 
-        if(dalloc - 2 <= dbi) {
-            // Data buffer smaller than current index, must be reallocated
-            // TODO:    Can't reallocate because the addresses may change
-            //          Add array of relative indices instead of pointers to fix this issue
-            //dalloc += HDL_DATABUFFER_REALLOC_SIZE;
-            //data_buffer = realloc(data_buffer, dalloc);
-            printf("ERROR: Can't reallocate memory (TODO)\r\n");
-            return 1;
+        if(skip.word != NULL && lastChar != '\\') {
+            // Plain characters never change the state, they are all added to the block
+            uint32_t n = 0;
+            if(inquotes == 0) {
+                if(char_class[(uint8_t)c] == 0) {
+                    n = skip.word(data + i, len - i);
+                }
+            }
+            else if(!(char_class[(uint8_t)c] & HDL_CHAR_TEXT) && (c != ' ' || !isWhitespace(lastChar))) {
+                n = skip.text(data + i, len - i);
+            }
+            if(n > 0) {
+                if(!open) {
+                    _HDL_OpenBlock(&block, base + i, inquotes, c);
+                    open = 1;
+                }
+                i += n - 1;
+                lastChar = data[i];
+                continue;
+            }
         }
 
+        // Quote state before this character, saved to the block for decoding
+        uint8_t quotes = inquotes;
+
         // Check quotes
         if(lastChar != '\\') {
             switch(c) {
@@ -264,56 +712,54 @@ int _HDL_ParseDataToBlocks (char *data) {
         }
         // Skip duplicate whitespace
         if(isWhitespace(c) && isWhitespace(lastChar)) {
+            // Skipped characters inside a block must be dropped when decoding
+            block.decode |= open;
             lastChar = c;
             continue;
         }
 
         // Check for delimiters
         if(isDelimiter(c) && !inquotes) {
-            if(blocklen > 0) {
-                // Set null terminator
-                data_buffer[dbi++] = 0;
-
-                if(blocks_allocated - 2 <= block_count) {
-                    // Reallocate blocks
-                    blocks_allocated += HDL_BLOCKBUFFER_REALLOC_SIZE;
-                    blocks = realloc(blocks, sizeof(char*) * blocks_allocated);
+            if(open) {
+                // Close the block
+                block.length = base + i - block.offset;
+                _HDL_ClassifyBlock(&block, data - base);
+                if(_HDL_PushBlock(lex->out, &block)) {
+                    lex->open = open;
+                    return 1;
                 }
-                blocks[block_count++] = &data_buffer[dbi];
+                open = 0;
             }
-
-            blocklen = 0;
             
             if(!isWhitespace(c)) {
                 // Add the delimiter
-                data_buffer[dbi++] = c;
-                // Add second null terminator
-                data_buffer[dbi++] = 0;
-                blocks[block_count++] = &data_buffer[dbi];
+                struct HDL_Token delim = { base + i, 1, HDL_TOKEN_DELIMITER, 0, 0 };
+                if(_HDL_PushBlock(lex->out, &delim)) {
+                    return 1;
+                }
+                if(lex->primary != NULL && _HDL_LexConverged(lex, base + i)) {
+                    // Rest of the chunk is the same as in the primary lexer
+                    return 0;
+                }
             }
         }
         else  {
             if(!isWhitespace(c) || (inquotes && c != '\n')) {
                 // Add character
-
-                // Replace possible newline/tab
                 if(lastChar == '\\') {
-                    if(c == 'n') {
-                        // Newline
-                        dbi--;
-                        data_buffer[dbi++] = '\n';
-                    }
-                    else if(c == 't') {
-                        // Tab
-                        dbi--;
-                        data_buffer[dbi++] = '\t';
-                    }
+                    // Escaped character, replaced or dropped when decoding
+                    block.decode = 1;
                 }
-                else {
-                    data_buffer[dbi++] = c;
-                    blocklen++;
+                else if(!open) {
+                    // Start a new block
+                    _HDL_OpenBlock(&block, base + i, quotes, c);
+                    open = 1;
                 }
             }
+            else {
+                // Dropped character (newline in quotes)
+                block.decode |= open;
+            }
         }
 
         if(c == '>' && lastChar != '\\') {
@@ -324,91 +770,1361 @@ int _HDL_ParseDataToBlocks (char *data) {
 
         lastChar = c;
     }
-    data_buffer[dbi] = 0;
-    if(blocklen <= 0) {
-        block_count--;
-    }
+
+    lex->block = block;
+    lex->open = open;
+    lex->lastChar = lastChar;
+    lex->inquotes = inquotes;
 
     return 0;
 }
 
-void _HDL_PrintBlocks () {
-    printf("Blocks:\r\n");
-    for(int i = 0; i < block_count; i++) {
-        printf("\t\"%s\"\r\n", blocks[i]);
+/**
+ * @brief Closes the block open at the end of input
+ * 
+ * @param lex Lexer state
+ * @param source Input data
+ * @param end Offset of the end of input
+ * @return int 0 on success
+ */
+static int _HDL_LexFinish (struct HDL_Lexer *lex, const char *source, uint32_t end) {
+    if(lex->open) {
+        lex->open = 0;
+        lex->block.length = end - lex->block.offset;
+        _HDL_ClassifyBlock(&lex->block, source);
+        return _HDL_PushBlock(lex->out, &lex->block);
     }
+    return 0;
 }
 
-void _HDL_InitElement (struct HDL_Element *element) {
+// Chunk of the input lexed by one thread
+struct HDL_LexJob {
+    const char *data;
+    // Offsets of the chunk in the input data, chunks start after a newline
+    uint32_t start;
+    uint32_t end;
+    // Lexers for each quote state at the start of the chunk, lexer 0 is the primary and lexes the whole chunk
+    struct HDL_Lexer lex[4];
+    // Blocks of each lexer
+    struct HDL_TokenList tokens[4];
+    // Lexer reached the end of the chunk or converged with the primary lexer
+    uint8_t complete[4];
+    // First chunk of the input, state at the start is known
+    uint8_t first;
+    // Lexer fast path mode
+    enum HDL_LexMode mode;
+    int err;
+};
 
-    memset(element, 0, sizeof(struct HDL_Element));
+/**
+ * @brief Lexes a chunk of the input, run on a lexer thread
+ * 
+ * Quote state at the start of the chunk is not known until the previous chunks are lexed,
+ * so the chunk is lexed from every quote state. Guessed states usually converge
+ * with the primary lexer within a few blocks, they only lex the start of the chunk
+ * 
+ * @param arg struct HDL_LexJob
+ * @return void* 
+ */
+static void *_HDL_LexJobRun (void *arg) {
+    struct HDL_LexJob *job = arg;
+    uint32_t len = job->end - job->start;
+
+    job->tokens[0].allocated = len / 16 + HDL_BLOCKBUFFER_REALLOC_SIZE;
+    job->tokens[0].tokens = malloc(sizeof(struct HDL_Token) * job->tokens[0].allocated);
+    if(job->tokens[0].tokens == NULL) {
+        // Out of memory
+        job->err = 1;
+        return NULL;
+    }
+
+    _HDL_LexInit(&job->lex[0], &job->tokens[0], job->mode);
+    if(!job->first) {
+        job->lex[0].lastChar = '\n';
+    }
+    if(_HDL_LexChunk(&job->lex[0], job->data + job->start, len, job->start)) {
+        job->err = 1;
+        return NULL;
+    }
+    job->complete[0] = 1;
+
+    if(job->first) {
+        return NULL;
+    }
+
+    uint32_t speculate = len < HDL_PARALLEL_SPECULATE_SIZE ? len : HDL_PARALLEL_SPECULATE_SIZE;
+    for(int q = 1; q < 4; q++) {
+        struct HDL_Lexer *lex = &job->lex[q];
+        _HDL_LexInit(lex, &job->tokens[q], job->mode);
+        lex->lastChar = '\n';
+        lex->inquotes = q;
+        lex->primary = &job->tokens[0];
+        if(_HDL_LexChunk(lex, job->data + job->start, speculate, job->start)) {
+            job->err = 1;
+            return NULL;
+        }
+        job->complete[q] = lex->converged != UINT32_MAX || speculate == len;
+    }
+    return NULL;
+}
 
-    element->attrAllocCount = HDL_ELEMENT_ATTR_INITIAL_SIZE;
-    element->attrs = malloc(sizeof(struct HDL_Attr) * element->attrAllocCount);
+/**
+ * @brief Appends the blocks of a lexed chunk, continuing from the lexer state at the end of the previous chunk
+ * 
+ * @param lex Lexer state, blocks are pushed to its block array
+ * @param job 
+ * @return int 0 on success
+ */
+static int _HDL_LexStitch (struct HDL_Lexer *lex, struct HDL_LexJob *job) {
+    uint8_t q = lex->inquotes;
+
+    if(!job->complete[q]) {
+        // Guess did not converge, lex the chunk again from the real state
+        return _HDL_LexChunk(lex, job->data + job->start, job->end - job->start, job->start);
+    }
+
+    struct HDL_TokenList *tokens = &job->tokens[q];
+    uint32_t converged = job->lex[q].converged;
+    // State at the end of the chunk
+    struct HDL_Lexer *last = converged != UINT32_MAX ? &job->lex[0] : &job->lex[q];
+    uint32_t first = 0;
+
+    if(lex->open) {
+        // Block of the previous chunk continues, characters skipped before the first
+        // block or delimiter of the chunk are dropped from it when decoding
+        struct HDL_Token *block = &lex->block;
+        if(tokens->count == 0) {
+            if(last->open) {
+                block->decode |= last->block.decode | (last->block.offset > job->start);
+            }
+            else {
+                block->decode |= job->end > job->start;
+            }
+            lex->lastChar = last->lastChar;
+            lex->inquotes = last->inquotes;
+            return 0;
+        }
+        struct HDL_Token *next = &tokens->tokens[0];
+        block->decode |= next->offset > job->start;
+        if(next->kind == HDL_TOKEN_DELIMITER) {
+            block->length = next->offset - block->offset;
+        }
+        else {
+            // First block of the chunk is the end of the open block
+            block->length = next->offset + next->length - block->offset;
+            block->decode |= next->decode;
+            first = 1;
+        }
+        _HDL_ClassifyBlock(block, job->data);
+        if(_HDL_PushBlock(lex->out, block)) {
+            return 1;
+        }
+    }
 
-    element->childAllocCount = HDL_ELEMENT_CHILDREN_INITIAL_SIZE;
-    element->children = malloc(sizeof(uint16_t) * element->childAllocCount);
+    if(_HDL_AppendBlocks(lex->out, tokens->tokens + first, tokens->count - first)) {
+        return 1;
+    }
+    if(converged != UINT32_MAX) {
+        if(_HDL_AppendBlocks(lex->out, job->tokens[0].tokens + converged + 1, job->tokens[0].count - converged - 1)) {
+            return 1;
+        }
+    }
 
+    lex->block = last->block;
+    lex->open = last->open;
+    lex->lastChar = last->lastChar;
+    lex->inquotes = last->inquotes;
+    return 0;
 }
 
-int _HDL_ParseValue (struct HDL_Document *doc, int *blockIndex, uint8_t *len_out, enum HDL_Type *type_out, void **val_out) {
+/**
+ * @brief Returns the number of threads to lex an input with
+ * 
+ * @param len Length of the input
+ * @return int 
+ */
+static int _HDL_LexThreadCount (struct HDL_ParseContext *ctx, uint32_t len) {
+    int threads = ctx->lex_threads;
+    if(threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    if(len < HDL_PARALLEL_MIN_SIZE) {
+        return 1;
+    }
+    if(threads > len / HDL_PARALLEL_MIN_CHUNK) {
+        threads = len / HDL_PARALLEL_MIN_CHUNK;
+    }
+    if(threads > HDL_PARALLEL_MAX_THREADS) {
+        threads = HDL_PARALLEL_MAX_THREADS;
+    }
+    return threads < 1 ? 1 : threads;
+}
 
-    if(blocks[*blockIndex][0] == '[') {
-        // Array
-        uint8_t tmp_len = 0;
-        enum HDL_Type tmp_type = 0;
-        uint8_t tmp_val[64];
+/**
+ * @brief Sets the number of threads used to lex big inputs
+ * 
+ * @param threads Thread count, 0 = one per CPU
+ * @return int 0 on success
+ */
+int HDL_SetLexThreads (struct HDL_ParseContext *ctx, int threads) {
+    if(threads < 0 || threads > HDL_PARALLEL_MAX_THREADS) {
+        return 1;
+    }
+    ctx->lex_threads = threads;
+    return 0;
+}
 
-        void *val_addr = tmp_val;
+/**
+ * @brief Parses the data in to blocks on multiple threads
+ * 
+ * Input is split at newlines, chunks are lexed in parallel and joined in order.
+ * Result is the same as lexing the input on one thread
+ * 
+ * @param data Input data
+ * @param len Length of the input data
+ * @param threads Number of threads
+ * @return int 0 on success
+ */
+static int _HDL_LexParallel (struct HDL_ParseContext *ctx, const char *data, uint32_t len, int threads) {
+    struct HDL_LexJob *jobs = calloc(threads, sizeof(struct HDL_LexJob));
+    pthread_t thread_ids[HDL_PARALLEL_MAX_THREADS];
+    uint8_t started[HDL_PARALLEL_MAX_THREADS] = { 0 };
 
-        *len_out = 0;
-        *type_out = HDL_TYPE_NULL;
-        // Allocated length for array
-        int alloc_len = 8;
+    if(jobs == NULL) {
+        // Out of memory
+        return 1;
+    }
 
-        (*blockIndex)++;
-        while((*blockIndex) < block_count) {
-            if(blocks[*blockIndex][0] == ']') {
-                // Array done
-                break;
+    // Split the input at the first newline after each even split point
+    int count = 0;
+    uint32_t start = 0;
+    for(int i = 0; i < threads && start < len; i++) {
+        uint32_t end = len;
+        if(i < threads - 1) {
+            uint32_t split = (uint64_t)len * (i + 1) / threads;
+            if(split < start) {
+                split = start;
             }
-            if(_HDL_ParseValue(doc, blockIndex, &tmp_len, &tmp_type, &val_addr)) {
-                printf("Failed to parse array values\r\n");
-                return 1;
+            const char *newline = memchr(data + split, '\n', len - split);
+            if(newline != NULL) {
+                end = newline - data + 1;
             }
-            if(tmp_type == HDL_TYPE_STRING) {
-                printf("Arrays do not support strings\r\n");
+        }
+        jobs[count].data = data;
+        jobs[count].start = start;
+        jobs[count].end = end;
+        jobs[count].first = count == 0;
+        jobs[count].mode = ctx->lex_mode;
+        count++;
+        start = end;
+    }
+
+    for(int i = 1; i < count; i++) {
+        started[i] = pthread_create(&thread_ids[i], NULL, _HDL_LexJobRun, &jobs[i]) == 0;
+    }
+    _HDL_LexJobRun(&jobs[0]);
+
+    int err = 0;
+    uint32_t estimate = HDL_BLOCKBUFFER_REALLOC_SIZE;
+    for(int i = 0; i < count; i++) {
+        if(i > 0) {
+            if(started[i]) {
+                pthread_join(thread_ids[i], NULL);
+            }
+            else {
+                // Could not start a thread, lex the chunk here
+                _HDL_LexJobRun(&jobs[i]);
+            }
+        }
+        err |= jobs[i].err;
+        estimate += jobs[i].tokens[0].count;
+    }
+
+    if(!err) {
+        ctx->block_list.allocated = estimate;
+        ctx->block_list.tokens = malloc(sizeof(struct HDL_Token) * ctx->block_list.allocated);
+        err = ctx->block_list.tokens == NULL;
+    }
+
+    _HDL_LexInit(&ctx->lexer, &ctx->block_list, ctx->lex_mode);
+    for(int i = 0; i < count; i++) {
+        if(!err) {
+            err = _HDL_LexStitch(&ctx->lexer, &jobs[i]);
+        }
+        for(int q = 0; q < 4; q++) {
+            if(jobs[i].tokens[q].tokens != NULL)
+                free(jobs[i].tokens[q].tokens);
+        }
+    }
+    free(jobs);
+
+    if(err) {
+        return 1;
+    }
+    return _HDL_LexFinish(&ctx->lexer, data, len);
+}
+
+/**
+ * @brief Parses the data in to blocks
+ * 
+ * @param data Input data, does not need to be null terminated
+ * @param len Length of the input data
+ * @return int 
+ */
+int _HDL_ParseDataToBlocks (struct HDL_ParseContext *ctx, const char *data, uint32_t len) {
+
+    _HDL_FreeBlocks(ctx);
+
+    ctx->source = data;
+    ctx->source_len = len;
+
+    int threads = _HDL_LexThreadCount(ctx, len);
+    if(threads > 1) {
+        return _HDL_LexParallel(ctx, data, len, threads);
+    }
+
+    // Guess the block count from the input length, array grows if needed
+    ctx->block_list.allocated = len / 16 + HDL_BLOCKBUFFER_REALLOC_SIZE;
+    ctx->block_list.tokens = malloc(sizeof(struct HDL_Token) * ctx->block_list.allocated);
+
+    if(ctx->block_list.tokens == NULL) {
+        // Out of memory
+        return 1;
+    }
+
+    _HDL_LexInit(&ctx->lexer, &ctx->block_list, ctx->lex_mode);
+    if(_HDL_LexChunk(&ctx->lexer, data, len, 0)) {
+        return 1;
+    }
+    return _HDL_LexFinish(&ctx->lexer, data, len);
+}
+
+/**
+ * @brief Starts lexing a streamed input, blocks are lexed chunk by chunk when the parser needs them
+ * 
+ * @param file Input file
+ * @return int 0 on success
+ */
+static int _HDL_StreamOpen (struct HDL_ParseContext *ctx, FILE *file) {
+
+    _HDL_FreeBlocks(ctx);
+
+    ctx->stream = file;
+    ctx->stream_eof = 0;
+
+    ctx->block_list.allocated = HDL_STREAM_CHUNK_SIZE / 16;
+    ctx->block_list.tokens = malloc(sizeof(struct HDL_Token) * ctx->block_list.allocated);
+
+    ctx->stream_allocated = HDL_STREAM_CHUNK_SIZE * 2;
+    ctx->stream_buffer = malloc(ctx->stream_allocated);
+
+    if(ctx->block_list.tokens == NULL || ctx->stream_buffer == NULL) {
+        // Out of memory
+        return 1;
+    }
+    ctx->source = ctx->stream_buffer;
+
+    _HDL_LexInit(&ctx->lexer, &ctx->block_list, ctx->lex_mode);
+    return 0;
+}
+
+/**
+ * @brief Drops blocks the parser is done with and lexes the next chunk of the stream
+ * 
+ * Memory use is bounded by the chunk size and the longest block, not by the input size
+ * 
+ * @return int 0 on success
+ */
+static int _HDL_StreamRefill (struct HDL_ParseContext *ctx) {
+    // Drop blocks behind the parser
+    uint32_t keep = ctx->block_max > HDL_STREAM_LOOKBEHIND ? ctx->block_max - HDL_STREAM_LOOKBEHIND : 0;
+    if(keep > ctx->block_base + ctx->block_list.count) {
+        keep = ctx->block_base + ctx->block_list.count;
+    }
+    if(keep > ctx->block_base) {
+        uint32_t drop = keep - ctx->block_base;
+        memmove(ctx->block_list.tokens, ctx->block_list.tokens + drop, sizeof(struct HDL_Token) * (ctx->block_list.count - drop));
+        ctx->block_list.count -= drop;
+        ctx->block_base += drop;
+    }
+
+    // Drop input before the first live block
+    uint32_t first = ctx->source_len;
+    if(ctx->block_list.count > 0) {
+        first = ctx->block_list.tokens[0].offset;
+    }
+    else if(ctx->lexer.open) {
+        first = ctx->lexer.block.offset;
+    }
+    if(first > 0) {
+        memmove(ctx->stream_buffer, ctx->stream_buffer + first, ctx->source_len - first);
+        ctx->source_len -= first;
+        ctx->source_base += first;
+        for(uint32_t i = 0; i < ctx->block_list.count; i++) {
+            ctx->block_list.tokens[i].offset -= first;
+        }
+        ctx->lexer.block.offset -= first;
+    }
+
+    // Make room for the next chunk
+    if(ctx->stream_allocated < ctx->source_len + HDL_STREAM_CHUNK_SIZE) {
+        ctx->stream_allocated = ctx->source_len + HDL_STREAM_CHUNK_SIZE;
+        char *n_buffer = realloc(ctx->stream_buffer, ctx->stream_allocated);
+        if(n_buffer == NULL) {
+            // Out of memory
+            ctx->stream_error = 1;
+            return 1;
+        }
+        ctx->stream_buffer = n_buffer;
+        ctx->source = ctx->stream_buffer;
+    }
+
+    size_t n = fread(ctx->stream_buffer + ctx->source_len, 1, HDL_STREAM_CHUNK_SIZE, ctx->stream);
+    if(n == 0) {
+        if(ferror(ctx->stream)) {
+            printf("Error: Failed to read input\r\n");
+            ctx->stream_error = 1;
+            return 1;
+        }
+        ctx->stream_eof = 1;
+        ctx->stream_error = _HDL_LexFinish(&ctx->lexer, ctx->stream_buffer, ctx->source_len);
+        return ctx->stream_error;
+    }
+
+    uint32_t base = ctx->source_len;
+    ctx->source_len += n;
+    ctx->stream_error = _HDL_LexChunk(&ctx->lexer, ctx->stream_buffer + base, n, base);
+    return ctx->stream_error;
+}
+
+/**
+ * @brief Splits data in to tokens without parsing them
+ * 
+ * @param data 
+ * @param len 
+ * @param tokens_out Tokens, freed by the caller. NULL if not needed
+ * @param count_out Number of tokens
+ * @return int 0 on success
+ */
+int HDL_Tokenize (struct HDL_ParseContext *ctx, const char *data, size_t len, struct HDL_Token **tokens_out, uint32_t *count_out) {
+    int err = _HDL_ParseDataToBlocks(ctx, data, len);
+    *count_out = ctx->block_list.count;
+    if(tokens_out != NULL) {
+        // Hand over the block array
+        *tokens_out = err ? NULL : ctx->block_list.tokens;
+        if(!err) {
+            ctx->block_list.tokens = NULL;
+        }
+    }
+    _HDL_FreeBlocks(ctx);
+    return err;
+}
+
+/**
+ * @brief Returns a block, end of input block if index is out of range
+ * 
+ * @param index 
+ * @return struct HDL_Token* 
+ */
+static struct HDL_Token *_HDL_Block (struct HDL_ParseContext *ctx, int index) {
+    if(index < 0 || index < ctx->block_base) {
+        return &block_eof;
+    }
+    while(index - ctx->block_base >= ctx->block_list.count) {
+        // Lex more of the stream
+        if(ctx->stream_eof || _HDL_StreamRefill(ctx)) {
+            return &block_eof;
+        }
+    }
+    if(index > ctx->block_max) {
+        ctx->block_max = index;
+    }
+    return &ctx->block_list.tokens[index - ctx->block_base];
+}
+
+/**
+ * @brief Checks if a block exists, false at the end of input
+ * 
+ * @param index 
+ * @return int 
+ */
+static int _HDL_BlockExists (struct HDL_ParseContext *ctx, int index) {
+    return _HDL_Block(ctx, index)->kind != HDL_TOKEN_EOF;
+}
+
+/**
+ * @brief Returns the offset of a block in the whole input, also when streaming
+ * 
+ * @param index 
+ * @return uint32_t 
+ */
+static uint32_t _HDL_BlockOffset (struct HDL_ParseContext *ctx, int index) {
+    return ctx->source_base + _HDL_Block(ctx, index)->offset;
+}
+
+/**
+ * @brief Returns a raw character of a block
+ * 
+ * @param index Block index
+ * @param n Character index
+ * @return char Character, 0 if past the end of the block
+ */
+static char _HDL_BlockChar (struct HDL_ParseContext *ctx, int index, uint32_t n) {
+    struct HDL_Token *block = _HDL_Block(ctx, index);
+    if(n >= block->length) {
+        return 0;
+    }
+    return ctx->source[block->offset + n];
+}
+
+/**
+ * @brief Checks if a block is a delimiter
+ * 
+ * @param index 
+ * @return int 
+ */
+static int _HDL_BlockIsDelimiter (struct HDL_ParseContext *ctx, int index) {
+    return _HDL_Block(ctx, index)->kind == HDL_TOKEN_DELIMITER;
+}
+
+/**
+ * @brief Decodes the span of a block, applies escapes and drops skipped whitespace
+ * 
+ * Runs the same quote/whitespace rules as the lexer, starting from the quote state saved to the block
+ * 
+ * @param data Span
+ * @param len Length of the span
+ * @param quotes Quote state at the start of the span
+ * @param out Output buffer, at least len bytes
+ * @return uint32_t Length of the decoded text
+ */
+static uint32_t _HDL_DecodeSpan (const char *data, uint32_t len, uint8_t quotes, char *out) {
+    uint32_t n = 0;
+    char lastChar = 0;
+    uint8_t inquotes = quotes;
+
+    for(uint32_t i = 0; i < len; i++) {
+        char c = data[i];
+        if(lastChar != '\\') {
+            if(c == '\'' && (inquotes == 0 || inquotes == 1)) {
+                inquotes = !inquotes;
+            }
+            else if(c == '"' && (inquotes == 0 || inquotes == 2)) {
+                inquotes = inquotes ? 0 : 2;
+            }
+        }
+
+        if(isWhitespace(c) && isWhitespace(lastChar)) {
+            lastChar = c;
+            continue;
+        }
+
+        if(!isWhitespace(c) || (inquotes && c != '\n')) {
+            if(lastChar == '\\') {
+                if(c == 'n') {
+                    out[n - 1] = '\n';
+                }
+                else if(c == 't') {
+                    out[n - 1] = '\t';
+                }
+            }
+            else {
+                out[n++] = c;
+            }
+        }
+        lastChar = c;
+    }
+    return n;
+}
+
+/**
+ * @brief Makes the scratch buffer at least the given size
+ * 
+ * @param ctx 
+ * @param size 
+ * @return int 0 on success
+ */
+static int _HDL_ReserveScratch (struct HDL_ParseContext *ctx, uint32_t size) {
+    if(ctx->scratch_allocated >= size) {
+        return 0;
+    }
+    char *n_scratch = realloc(ctx->scratch, size);
+    if(n_scratch == NULL) {
+        // Out of memory, old buffer is kept
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+    ctx->scratch = n_scratch;
+    ctx->scratch_allocated = size;
+    return 0;
+}
+
+/**
+ * @brief Returns the text of a block
+ * 
+ * @param index Block index
+ * @param len_out Length of the text
+ * @return const char* Text, not null terminated. Valid until the next call. NULL if out of memory
+ */
+static const char *_HDL_BlockText (struct HDL_ParseContext *ctx, int index, uint32_t *len_out) {
+    struct HDL_Token *block = _HDL_Block(ctx, index);
+
+    if(!block->decode) {
+        // Span can be used as is
+        *len_out = block->length;
+        return ctx->source + block->offset;
+    }
+
+    if(_HDL_ReserveScratch(ctx, block->length)) {
+        *len_out = 0;
+        return NULL;
+    }
+    *len_out = _HDL_DecodeSpan(ctx->source + block->offset, block->length, block->quotes, ctx->scratch);
+    return ctx->scratch;
+}
+
+/**
+ * @brief Returns the text of a block as a null terminated string
+ * 
+ * @param index Block index
+ * @return const char* String, valid until the next call. Empty if out of memory, it is only used in messages
+ */
+static const char *_HDL_BlockString (struct HDL_ParseContext *ctx, int index) {
+    struct HDL_Token *block = _HDL_Block(ctx, index);
+    uint32_t len = block->length;
+
+    if(_HDL_ReserveScratch(ctx, block->length + 1)) {
+        return "";
+    }
+    if(block->decode) {
+        len = _HDL_DecodeSpan(ctx->source + block->offset, block->length, block->quotes, ctx->scratch);
+    }
+    else {
+        memcpy(ctx->scratch, ctx->source + block->offset, len);
+    }
+    ctx->scratch[len] = 0;
+    return ctx->scratch;
+}
+
+/**
+ * @brief Copies the text of a block, null terminated
+ * 
+ * @param index Block index
+ * @param out Output buffer
+ * @param size Size of the output buffer, text is truncated to fit
+ * @return uint32_t Length of the full text
+ */
+static uint32_t _HDL_BlockCopy (struct HDL_ParseContext *ctx, int index, char *out, uint32_t size) {
+    uint32_t len = 0;
+    const char *text = _HDL_BlockText(ctx, index, &len);
+    if(text == NULL) {
+        out[0] = 0;
+        return 0;
+    }
+    uint32_t n = len < size - 1 ? len : size - 1;
+    memcpy(out, text, n);
+    out[n] = 0;
+    return len;
+}
+
+/**
+ * @brief Compares the text of a block to a string
+ * 
+ * @param index Block index
+ * @param str 
+ * @return int 1 if equal
+ */
+static int _HDL_BlockEquals (struct HDL_ParseContext *ctx, int index, const char *str) {
+    uint32_t len = 0;
+    const char *text = _HDL_BlockText(ctx, index, &len);
+    return text != NULL && strlen(str) == len && memcmp(text, str, len) == 0;
+}
+
+/**
+ * @brief Checks if a hyphen and another part of a name follow a block without whitespace, as in "my-value"
+ * 
+ * The lexer splits '-' off as an operator, the parser joins hyphenated names back
+ * 
+ * @param index Block index
+ * @return int 1 if blocks index + 1 and index + 2 continue the name
+ */
+static int _HDL_NameContinues (struct HDL_ParseContext *ctx, int index) {
+    // Last block first, blocks can move while the stream is lexed further
+    struct HDL_Token *part = _HDL_Block(ctx, index + 2);
+    if(part->kind != HDL_TOKEN_WORD && part->kind != HDL_TOKEN_INT) {
+        return 0;
+    }
+    struct HDL_Token *block = _HDL_Block(ctx, index);
+    struct HDL_Token *hyphen = _HDL_Block(ctx, index + 1);
+    return hyphen->kind == HDL_TOKEN_DELIMITER && ctx->source[hyphen->offset] == '-'
+        && hyphen->offset == block->offset + block->length && part->offset == hyphen->offset + 1;
+}
+
+/**
+ * @brief Finds the last block of the longest name starting at a block
+ * 
+ * @param index First block of the name
+ * @return int Last block of the name
+ */
+static int _HDL_NameEnd (struct HDL_ParseContext *ctx, int index) {
+    if(_HDL_Block(ctx, index)->kind != HDL_TOKEN_WORD) {
+        return index;
+    }
+    while(_HDL_NameContinues(ctx, index)) {
+        index += 2;
+    }
+    return index;
+}
+
+/**
+ * @brief Returns the text of a name from its first to its last block
+ * 
+ * @param first First block of the name
+ * @param last Last block of the name
+ * @param len_out Length of the text
+ * @return const char* Text, not null terminated. NULL if out of memory
+ */
+static const char *_HDL_NameText (struct HDL_ParseContext *ctx, int first, int last, uint32_t *len_out) {
+    if(first == last) {
+        return _HDL_BlockText(ctx, first, len_out);
+    }
+    // Parts of a hyphenated name are contiguous in the input
+    struct HDL_Token *end = _HDL_Block(ctx, last);
+    struct HDL_Token *start = _HDL_Block(ctx, first);
+    *len_out = end->offset + end->length - start->offset;
+    return ctx->source + start->offset;
+}
+
+/**
+ * @brief Returns the longest name starting at a block as a null terminated string
+ * 
+ * @param index First block of the name
+ * @return const char* String, valid until the next call. Empty if out of memory, it is only used in messages
+ */
+static const char *_HDL_NameString (struct HDL_ParseContext *ctx, int index) {
+    int last = _HDL_NameEnd(ctx, index);
+    if(last == index) {
+        return _HDL_BlockString(ctx, index);
+    }
+    uint32_t len = 0;
+    _HDL_NameText(ctx, index, last, &len);
+    if(_HDL_ReserveScratch(ctx, len + 1)) {
+        return "";
+    }
+    memcpy(ctx->scratch, ctx->source + _HDL_Block(ctx, index)->offset, len);
+    ctx->scratch[len] = 0;
+    return ctx->scratch;
+}
+
+/**
+ * @brief Copies the longest name starting at a block, null terminated
+ * 
+ * @param blockIndex First block of the name, moved to the last block of the name
+ * @param out Output buffer
+ * @param size Size of the output buffer, text is truncated to fit
+ * @return uint32_t Length of the full name
+ */
+static uint32_t _HDL_NameCopy (struct HDL_ParseContext *ctx, int *blockIndex, char *out, uint32_t size) {
+    int last = _HDL_NameEnd(ctx, *blockIndex);
+    uint32_t len = 0;
+    const char *text = _HDL_NameText(ctx, *blockIndex, last, &len);
+    *blockIndex = last;
+    if(text == NULL) {
+        out[0] = 0;
+        return 0;
+    }
+    uint32_t n = len < size - 1 ? len : size - 1;
+    memcpy(out, text, n);
+    out[n] = 0;
+    return len;
+}
+
+void _HDL_PrintBlocks (struct HDL_ParseContext *ctx) {
+    printf("Blocks:\r\n");
+    for(int i = 0; i < ctx->block_list.count; i++) {
+        uint32_t len = 0;
+        const char *text = _HDL_BlockText(ctx, i, &len);
+        printf("\t%i \"%.*s\"\r\n", ctx->block_list.tokens[i].kind, len, text != NULL ? text : "");
+    }
+}
+
+void _HDL_InitElement (struct HDL_Element *element) {
+
+    memset(element, 0, sizeof(struct HDL_Element));
+
+}
+
+/**
+ * @brief Returns the next allocated count of a growing array, doubling its size
+ * 
+ * @param allocCount Allocated count
+ * @param initial Initial count for an empty array
+ * @param max Max count
+ * @return uint32_t 0 if the array can not grow
+ */
+static uint32_t _HDL_GrowCount (uint32_t allocCount, uint32_t initial, uint32_t max) {
+    uint32_t n_alloc = allocCount == 0 ? initial : allocCount * 2;
+    if(n_alloc > max || n_alloc < allocCount) {
+        n_alloc = max;
+    }
+    if(n_alloc <= allocCount) {
+        printf("Error: Too many items\r\n");
+        return 0;
+    }
+    return n_alloc;
+}
+
+/**
+ * @brief Grows an array allocated from the document arena
+ * 
+ * @param doc 
+ * @param array Array, may be NULL
+ * @param allocCount Allocated count
+ * @param n_alloc New count
+ * @param size Size of an item
+ * @return int 0 on success
+ */
+static int _HDL_GrowArray (struct HDL_Document *doc, void **array, uint32_t allocCount, uint32_t n_alloc, size_t size) {
+    void *n_array = HDL_ArenaRealloc(&doc->arena, *array, size * allocCount, size * n_alloc);
+    if(n_array == NULL) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+    *array = n_array;
+    return 0;
+}
+
+/**
+ * @brief Defines a variable or bitmap name
+ * 
+ * @param doc 
+ * @param name 
+ * @param kind 
+ * @param index Index of the variable or bitmap
+ * @return int 0 on success, 1 if already defined
+ */
+static int _HDL_DefineSymbol (struct HDL_Document *doc, const char *name, enum HDL_SymbolKind kind, uint32_t index) {
+    int32_t id = HDL_SymbolIntern(&doc->symbols, name, strlen(name));
+    if(id < 0) {
+        // Out of memory
+        return 1;
+    }
+    struct HDL_Symbol *symbol = &doc->symbols.symbols[id];
+    if(symbol->kind != HDL_SYMBOL_NONE) {
+        printf("Error: '%s' is already defined\r\n", name);
+        return 1;
+    }
+    symbol->kind = kind;
+    symbol->index = index;
+    return 0;
+}
+
+/**
+ * @brief Finds the definition named by the blocks starting at a block
+ * 
+ * The longest defined hyphenated name wins, "W-2" is W minus 2 unless a "W-2" is defined
+ * 
+ * @param doc 
+ * @param index First block of the name
+ * @param end_out Last block of the name, may be NULL
+ * @return struct HDL_Symbol* NULL if not found
+ */
+static struct HDL_Symbol *_HDL_FindSymbol (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int index, int *end_out) {
+    for(int last = _HDL_NameEnd(ctx, index); last >= index; last -= 2) {
+        uint32_t len = 0;
+        const char *name = _HDL_NameText(ctx, index, last, &len);
+        if(name == NULL) {
+            return NULL;
+        }
+        int32_t id = HDL_SymbolFind(&doc->symbols, name, len);
+        if(id >= 0 && doc->symbols.symbols[id].kind != HDL_SYMBOL_NONE) {
+            if(end_out != NULL) {
+                *end_out = last;
+            }
+            return &doc->symbols.symbols[id];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads the numeric literal of a block, kind was classified by the lexer
+ * 
+ * @param index Block index
+ * @param int_out Value if the block is an integer
+ * @param float_out Value if the block is a float
+ * @return uint8_t Kind of the block, HDL_NUMBER_OUT_OF_RANGE if it is an integer above INT64_MAX
+ */
+static uint8_t _HDL_BlockNumber (struct HDL_ParseContext *ctx, int index, int64_t *int_out, float *float_out) {
+    struct HDL_Token *block = _HDL_Block(ctx, index);
+    if(block->kind == HDL_TOKEN_INT || block->kind == HDL_TOKEN_FLOAT) {
+        // Literals never need decoding, the span is used as is
+        if(_HDL_ScanNumber(ctx->source + block->offset, block->length, int_out, float_out) == HDL_NUMBER_OUT_OF_RANGE) {
+            printf("Error: Integer '%s' is out of range (max %lld)\r\n", _HDL_BlockString(ctx, index), (long long)INT64_MAX);
+            return HDL_NUMBER_OUT_OF_RANGE;
+        }
+    }
+    return block->kind;
+}
+
+/**
+ * @brief Reads a bitmap dimension (0 - 65535) from a block
+ * 
+ * @param index Block index
+ * @param out 
+ * @return int 0 on success
+ */
+static int _HDL_BlockDimension (struct HDL_ParseContext *ctx, int index, uint16_t *out) {
+    int64_t val = 0;
+    if(_HDL_BlockNumber(ctx, index, &val, NULL) != HDL_TOKEN_INT || val < 0 || val > UINT16_MAX) {
+        printf("Error: Invalid image dimension '%s'\r\n", _HDL_BlockString(ctx, index));
+        return 1;
+    }
+    *out = val;
+    return 0;
+}
+
+/**
+ * @brief Returns an integer or float value as an integer
+ * 
+ * @param val 
+ * @param type 
+ * @return int64_t 0 if not a number
+ */
+static int64_t _HDL_NumberAsInt (const void *val, enum HDL_Type type) {
+    switch(type) {
+        case HDL_TYPE_I8:
+            return *(const int8_t*)val;
+        case HDL_TYPE_I16:
+            return *(const int16_t*)val;
+        case HDL_TYPE_I32:
+            return *(const int32_t*)val;
+        case HDL_TYPE_I64:
+            return *(const int64_t*)val;
+        case HDL_TYPE_FLOAT:
+            return (int64_t)*(const float*)val;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Rank of the numeric types an array can mix, values are widened to the higher rank
+ * 
+ * @param type 
+ * @return int 0 if not a number
+ */
+static int _HDL_NumberRank (enum HDL_Type type) {
+    switch(type) {
+        case HDL_TYPE_I32:
+            return 1;
+        case HDL_TYPE_I64:
+            return 2;
+        case HDL_TYPE_FLOAT:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Widens a numeric value to a type of higher rank
+ * 
+ * @param in 
+ * @param from 
+ * @param out 
+ * @param to 
+ */
+static void _HDL_PromoteNumber (const void *in, enum HDL_Type from, void *out, enum HDL_Type to) {
+    if(to == HDL_TYPE_FLOAT) {
+        *(float*)out = from == HDL_TYPE_FLOAT ? *(const float*)in : (float)_HDL_NumberAsInt(in, from);
+    }
+    else if(to == HDL_TYPE_I64) {
+        *(int64_t*)out = _HDL_NumberAsInt(in, from);
+    }
+    else {
+        *(int32_t*)out = (int32_t)_HDL_NumberAsInt(in, from);
+    }
+}
+
+/**
+ * @brief Checks if a constant is a single integer or float
+ * 
+ * @param var 
+ * @return int 
+ */
+static int _HDL_IsNumberVar (struct HDL_Variable *var) {
+    if(var->count != 1) {
+        return 0;
+    }
+    switch(var->type) {
+        case HDL_TYPE_I8:
+        case HDL_TYPE_I16:
+        case HDL_TYPE_I32:
+        case HDL_TYPE_I64:
+        case HDL_TYPE_FLOAT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Returns the precedence of a binary operator block
+ * 
+ * '/' followed by '>' ends a short tag and is not an operator
+ * 
+ * @param index Block index
+ * @return int Precedence, higher binds tighter. 0 if not a binary operator
+ */
+static int _HDL_ExprPrecedence (struct HDL_ParseContext *ctx, int index) {
+    if(!_HDL_BlockIsDelimiter(ctx, index)) {
+        return 0;
+    }
+    switch(_HDL_BlockChar(ctx, index, 0)) {
+        case '|':
+            return 1;
+        case '^':
+            return 2;
+        case '&':
+            return 3;
+        case '+':
+        case '-':
+            return 4;
+        case '/':
+            if(_HDL_BlockChar(ctx, index + 1, 0) == '>') {
+                return 0;
+            }
+            return 5;
+        case '*':
+        case '%':
+            return 5;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Applies a binary operator, integers stay integers unless mixed with a float
+ * 
+ * @param op Operator character
+ * @param lhs Left operand, result is stored here
+ * @param rhs Right operand
+ * @return int 0 on success
+ */
+static int _HDL_ExprApply (char op, struct HDL_ExprValue *lhs, const struct HDL_ExprValue *rhs) {
+    if(lhs->type == HDL_TYPE_FLOAT || rhs->type == HDL_TYPE_FLOAT) {
+        double a = lhs->type == HDL_TYPE_FLOAT ? lhs->f : (double)lhs->i;
+        double b = rhs->type == HDL_TYPE_FLOAT ? rhs->f : (double)rhs->i;
+        lhs->type = HDL_TYPE_FLOAT;
+        switch(op) {
+            case '+':
+                lhs->f = a + b;
+                return 0;
+            case '-':
+                lhs->f = a - b;
+                return 0;
+            case '*':
+                lhs->f = a * b;
+                return 0;
+            case '/':
+                if(b == 0) {
+                    printf("Error: Division by zero in constant expression\r\n");
+                    return 1;
+                }
+                lhs->f = a / b;
+                return 0;
+            default:
+                printf("Error: Operator '%c' needs integer operands\r\n", op);
+                return 1;
+        }
+    }
+
+    int64_t a = lhs->i;
+    int64_t b = rhs->i;
+    int overflow = 0;
+    switch(op) {
+        case '+':
+            overflow = __builtin_add_overflow(a, b, &lhs->i);
+            break;
+        case '-':
+            overflow = __builtin_sub_overflow(a, b, &lhs->i);
+            break;
+        case '*':
+            overflow = __builtin_mul_overflow(a, b, &lhs->i);
+            break;
+        case '/':
+        case '%':
+            if(b == 0) {
+                printf("Error: Division by zero in constant expression\r\n");
+                return 1;
+            }
+            overflow = a == INT64_MIN && b == -1;
+            if(!overflow) {
+                lhs->i = op == '/' ? a / b : a % b;
+            }
+            break;
+        case '&':
+            lhs->i = a & b;
+            break;
+        case '|':
+            lhs->i = a | b;
+            break;
+        case '^':
+            lhs->i = a ^ b;
+            break;
+    }
+    if(overflow) {
+        printf("Error: Integer overflow in constant expression\r\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int _HDL_ParseExpr (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex, int minPrecedence, int depth, struct HDL_ExprValue *out);
+
+/**
+ * @brief Parses an operand of a constant expression: literal, numeric constant, parentheses or unary operator
+ * 
+ * @param doc 
+ * @param blockIndex First block of the operand, moved to the last block of the operand
+ * @param depth Nesting depth
+ * @param out 
+ * @return int 0 on success
+ */
+static int _HDL_ParseExprOperand (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex, int depth, struct HDL_ExprValue *out) {
+    if(depth > HDL_EXPR_MAX_DEPTH) {
+        printf("Error: Constant expression nested too deep\r\n");
+        return 1;
+    }
+
+    int64_t ival = 0;
+    float fval = 0;
+    uint8_t kind = _HDL_BlockNumber(ctx, *blockIndex, &ival, &fval);
+    if(kind == HDL_NUMBER_OUT_OF_RANGE) {
+        return 1;
+    }
+    if(kind == HDL_TOKEN_INT) {
+        out->type = HDL_TYPE_I64;
+        out->i = ival;
+        return 0;
+    }
+    if(kind == HDL_TOKEN_FLOAT) {
+        out->type = HDL_TYPE_FLOAT;
+        out->f = fval;
+        return 0;
+    }
+
+    if(kind == HDL_TOKEN_DELIMITER) {
+        char c = _HDL_BlockChar(ctx, *blockIndex, 0);
+        if(c == '(') {
+            (*blockIndex)++;
+            if(_HDL_ParseExpr(ctx, doc, blockIndex, 1, depth + 1, out)) {
+                return 1;
+            }
+            (*blockIndex)++;
+            if(_HDL_BlockChar(ctx, *blockIndex, 0) != ')') {
+                printf("Error: Missing parenthesis in constant expression\r\n");
+                return 1;
+            }
+            return 0;
+        }
+        if(c == '-' || c == '+' || c == '~') {
+            (*blockIndex)++;
+            if(_HDL_ParseExprOperand(ctx, doc, blockIndex, depth + 1, out)) {
+                return 1;
+            }
+            if(c == '-') {
+                if(out->type == HDL_TYPE_FLOAT) {
+                    out->f = -out->f;
+                }
+                else if(__builtin_sub_overflow((int64_t)0, out->i, &out->i)) {
+                    printf("Error: Integer overflow in constant expression\r\n");
+                    return 1;
+                }
+            }
+            else if(c == '~') {
+                if(out->type == HDL_TYPE_FLOAT) {
+                    printf("Error: Operator '~' needs an integer operand\r\n");
+                    return 1;
+                }
+                out->i = ~out->i;
+            }
+            return 0;
+        }
+        printf("Error: Unexpected '%c' in constant expression\r\n", c);
+        return 1;
+    }
+
+    // Numeric constant
+    struct HDL_Symbol *symbol = _HDL_FindSymbol(ctx, doc, *blockIndex, blockIndex);
+    if(symbol == NULL || symbol->kind != HDL_SYMBOL_VAR) {
+        printf("Error: Unknown constant '%s' in expression\r\n", _HDL_NameString(ctx, *blockIndex));
+        return 1;
+    }
+    struct HDL_Variable *var = &doc->vars[symbol->index];
+    if(!_HDL_IsNumberVar(var)) {
+        printf("Error: '%s' is not a number\r\n", var->name);
+        return 1;
+    }
+    if(var->type == HDL_TYPE_FLOAT) {
+        out->type = HDL_TYPE_FLOAT;
+        out->f = *(float*)var->value;
+    }
+    else {
+        out->type = HDL_TYPE_I64;
+        out->i = _HDL_NumberAsInt(var->value, var->type);
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses and folds a constant expression with C precedence
+ * 
+ * @param doc 
+ * @param blockIndex First block of the expression, moved to the last block of the expression
+ * @param minPrecedence Operators binding looser than this end the expression
+ * @param depth Nesting depth
+ * @param out 
+ * @return int 0 on success
+ */
+static int _HDL_ParseExpr (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex, int minPrecedence, int depth, struct HDL_ExprValue *out) {
+    if(_HDL_ParseExprOperand(ctx, doc, blockIndex, depth, out)) {
+        return 1;
+    }
+    while(1) {
+        int precedence = _HDL_ExprPrecedence(ctx, *blockIndex + 1);
+        if(precedence == 0 || precedence < minPrecedence) {
+            return 0;
+        }
+        char op = _HDL_BlockChar(ctx, *blockIndex + 1, 0);
+        (*blockIndex) += 2;
+
+        // Operators are left associative, the right side only takes tighter operators
+        struct HDL_ExprValue rhs;
+        if(_HDL_ParseExpr(ctx, doc, blockIndex, precedence + 1, depth, &rhs)) {
+            return 1;
+        }
+        if(_HDL_ExprApply(op, out, &rhs)) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Checks if a value starts a constant expression: a number, a numeric constant, '(' or a unary operator
+ * 
+ * @param doc 
+ * @param index Block index
+ * @return int 
+ */
+static int _HDL_IsExprStart (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int index) {
+    struct HDL_Token *block = _HDL_Block(ctx, index);
+    if(block->kind == HDL_TOKEN_INT || block->kind == HDL_TOKEN_FLOAT) {
+        return 1;
+    }
+    if(block->kind == HDL_TOKEN_DELIMITER) {
+        char c = ctx->source[block->offset];
+        return c == '(' || c == '-' || c == '+' || c == '~';
+    }
+    if(block->kind != HDL_TOKEN_WORD) {
+        return 0;
+    }
+    struct HDL_Symbol *symbol = _HDL_FindSymbol(ctx, doc, index, NULL);
+    if(symbol == NULL || symbol->kind != HDL_SYMBOL_VAR) {
+        return 0;
+    }
+    return _HDL_IsNumberVar(&doc->vars[symbol->index]);
+}
+
+int _HDL_ParseValue (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex, uint32_t *len_out, enum HDL_Type *type_out, void **val_out) {
+
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) == '[') {
+        // Array
+        uint32_t tmp_len = 0;
+        enum HDL_Type tmp_type = 0;
+        uint64_t tmp_val[8];
+
+        void *val_addr = tmp_val;
+
+        *len_out = 0;
+        *type_out = HDL_TYPE_NULL;
+        // Allocated length for array
+        int alloc_len = 8;
+
+        (*blockIndex)++;
+        while(_HDL_BlockExists(ctx, *blockIndex)) {
+            if(_HDL_BlockChar(ctx, *blockIndex, 0) == ']') {
+                // Array done
+                break;
+            }
+            if(_HDL_ParseValue(ctx, doc, blockIndex, &tmp_len, &tmp_type, &val_addr)) {
+                printf("Failed to parse array values\r\n");
+                return 1;
+            }
+            if(tmp_type == HDL_TYPE_STRING) {
+                printf("Arrays do not support strings\r\n");
                 return 1;
             }
             
             if(*len_out > 0 && (*type_out != tmp_type)) {
-                printf("Array mismatch of types\r\n");
-                return 1;
+                int rank = _HDL_NumberRank(tmp_type);
+                int array_rank = _HDL_NumberRank(*type_out);
+                if(rank == 0 || array_rank == 0) {
+                    printf("Array mismatch of types\r\n");
+                    return 1;
+                }
+                if(rank > array_rank) {
+                    // Widen the values parsed so far
+                    void *n_val = HDL_ArenaAlloc(&doc->arena, HDL_TYPE_SIZES[tmp_type] * alloc_len);
+                    if(n_val == NULL) {
+                        printf("Error: Out of memory\r\n");
+                        return 1;
+                    }
+                    for(uint32_t n = 0; n < *len_out; n++) {
+                        _HDL_PromoteNumber(((uint8_t*)*val_out) + HDL_TYPE_SIZES[*type_out] * n, *type_out,
+                            ((uint8_t*)n_val) + HDL_TYPE_SIZES[tmp_type] * n, tmp_type);
+                    }
+                    *val_out = n_val;
+                    *type_out = tmp_type;
+                }
+                else {
+                    // Widen the new value
+                    uint64_t n_val = 0;
+                    _HDL_PromoteNumber(tmp_val, tmp_type, &n_val, *type_out);
+                    tmp_val[0] = n_val;
+                    tmp_type = *type_out;
+                }
             }
 
             if(*len_out == 0) {
                 // Allocate
-                *val_out = malloc(HDL_TYPE_SIZES[tmp_type] * alloc_len);
+                *val_out = HDL_ArenaAlloc(&doc->arena, HDL_TYPE_SIZES[tmp_type] * alloc_len);
                 *type_out = tmp_type;
             }
             else {
-                // Reallocate if needed
+                // Reallocate if needed, usually the last allocation so it grows in place
                 if((*len_out) >= alloc_len) {
                     alloc_len += 8;
-                    *val_out = realloc(*val_out, HDL_TYPE_SIZES[tmp_type] * alloc_len);
+                    *val_out = HDL_ArenaRealloc(&doc->arena, *val_out, HDL_TYPE_SIZES[tmp_type] * (alloc_len - 8), HDL_TYPE_SIZES[tmp_type] * alloc_len);
                 }
             }
+            if(*val_out == NULL) {
+                printf("Error: Out of memory\r\n");
+                return 1;
+            }
 
             memcpy(((uint8_t*)*val_out) + (HDL_TYPE_SIZES[tmp_type] * (*len_out)), tmp_val, HDL_TYPE_SIZES[tmp_type]);
             (*len_out)++;
 
             (*blockIndex)++;
 
-            if(blocks[*blockIndex][0] == ']') {
+            if(_HDL_BlockChar(ctx, *blockIndex, 0) == ']') {
                 // Array done
                 break;
             }
-            else if(blocks[*blockIndex][0] == ',') {
+            else if(_HDL_BlockChar(ctx, *blockIndex, 0) == ',') {
                 // Next value
                 
             }
@@ -421,23 +2137,31 @@ int _HDL_ParseValue (struct HDL_Document *doc, int *blockIndex, uint8_t *len_out
             (*blockIndex)++;
         }
     }
-    else if(blocks[*blockIndex][0] == '"' || blocks[*blockIndex][0] == '\'') {
-        uint8_t quoteType = (blocks[*blockIndex][0] == '"');
+    else if(_HDL_BlockChar(ctx, *blockIndex, 0) == '"' || _HDL_BlockChar(ctx, *blockIndex, 0) == '\'') {
+        uint8_t quoteType = (_HDL_BlockChar(ctx, *blockIndex, 0) == '"');
         // String
         *len_out = 1;
         *type_out = HDL_TYPE_STRING;
-        int slen = strlen(blocks[*blockIndex]);
+        uint32_t slen = 0;
+        const char *str = _HDL_BlockText(ctx, *blockIndex, &slen);
+        if(str == NULL) {
+            return 1;
+        }
+        if(slen < 2) {
+            printf("No enclosing quote\r\n");
+            return 1;
+        }
         // Leave quotes out of the string
         if(*val_out == NULL) {
-            *val_out = malloc(slen - 1);
+            *val_out = HDL_ArenaAlloc(&doc->arena, slen - 1);
         }
-        memcpy(*val_out, (blocks[*blockIndex] + 1), slen - 2);
+        memcpy(*val_out, str + 1, slen - 2);
         ((char*)(*val_out))[slen - 2] = 0;
         
-        if(quoteType == 0 && blocks[*blockIndex][slen - 1] == '\'') {
+        if(quoteType == 0 && str[slen - 1] == '\'') {
             // OK
         }
-        else if(quoteType == 1 && blocks[*blockIndex][slen - 1] == '"') {
+        else if(quoteType == 1 && str[slen - 1] == '"') {
             // OK
         }
         else {
@@ -446,128 +2170,123 @@ int _HDL_ParseValue (struct HDL_Document *doc, int *blockIndex, uint8_t *len_out
             return 1;
         }
     }
-    else if(blocks[*blockIndex][0] == '0' && blocks[*blockIndex][1] == 'x') {
-        // Hex string
-        int32_t val = strtol(&(blocks[*blockIndex][2]), NULL, 16);
-
-        // Save as float, compiler will optimize it to the correct size
-        *len_out = 1;
-        *type_out = HDL_TYPE_FLOAT;
-        if(*val_out == NULL) {
-            *val_out = malloc(sizeof(float));
+    else if(_HDL_IsExprStart(ctx, doc, *blockIndex)) {
+        // Number or constant expression, folded to a literal. Integers are 64-bit only if they do not fit 32 bits,
+        // compiler optimizes them to the correct size
+        struct HDL_ExprValue expr;
+        if(_HDL_ParseExpr(ctx, doc, blockIndex, 1, 0, &expr)) {
+            return 1;
         }
-        *(float*)(*val_out) = val;
-    }
-    else if(isNumberString(blocks[*blockIndex])) {
-        // Save as float, compiler will optimize it to the correct size
         *len_out = 1;
-        *type_out = HDL_TYPE_FLOAT;
+        if(expr.type == HDL_TYPE_FLOAT) {
+            *type_out = HDL_TYPE_FLOAT;
+        }
+        else {
+            *type_out = (expr.i >= INT32_MIN && expr.i <= INT32_MAX) ? HDL_TYPE_I32 : HDL_TYPE_I64;
+        }
         if(*val_out == NULL) {
-            *val_out = malloc(sizeof(float));
+            *val_out = HDL_ArenaAlloc(&doc->arena, HDL_TYPE_SIZES[*type_out]);
+        }
+        if(*type_out == HDL_TYPE_FLOAT) {
+            *(float*)(*val_out) = expr.f;
+        }
+        else if(*type_out == HDL_TYPE_I32) {
+            *(int32_t*)(*val_out) = expr.i;
+        }
+        else {
+            *(int64_t*)(*val_out) = expr.i;
         }
-        *(float*)(*val_out) = (float)atof(blocks[*blockIndex]);
     }
-    else if(strcmp(blocks[*blockIndex], "true") == 0) {
+    else if(_HDL_BlockEquals(ctx, *blockIndex, "true")) {
         // boolean/true
         *len_out = 1;
         *type_out = HDL_TYPE_BOOL;
         if(*val_out == NULL) {
-            *val_out = malloc(1);
+            *val_out = HDL_ArenaAlloc(&doc->arena, 1);
         }
         *(uint8_t*)(*val_out) = 1;
     }
-    else if(strcmp(blocks[*blockIndex], "false") == 0) {
+    else if(_HDL_BlockEquals(ctx, *blockIndex, "false")) {
         // boolean/false
         *len_out = 1;
         *type_out = HDL_TYPE_BOOL;
         if(*val_out == NULL) {
-            *val_out = malloc(1);
+            *val_out = HDL_ArenaAlloc(&doc->arena, 1);
         }
         *(uint8_t*)(*val_out) = 0;
     }
-    else if(blocks[*blockIndex][0] == '$') {
-        // Binding address
+    else if(_HDL_BlockChar(ctx, *blockIndex, 0) == '$') {
+        // Binding address, a slot number or an integer constant
         *len_out = 1;
         *type_out = HDL_TYPE_BIND;
         (*blockIndex)++;
-        if(!isIntString(blocks[*blockIndex])) {
-            
-            uint8_t f = 0;
-            for(int i = 0; i < doc->varCount; i++) {
-                if(strcmp(doc->vars[i].name, blocks[*blockIndex]) == 0) {
-
-                    // Copy value, should be FLOAT
-                    *len_out = doc->vars[i].count;
-                    *type_out = HDL_TYPE_BIND;
-                    if(*val_out == NULL) {
-                        *val_out = malloc(1);
-                    }
-                    *(uint8_t*)(*val_out) = (uint8_t)*(float*)doc->vars[i].value;
-
-                    f = 1;
-                    break;
+        int64_t slot = 0;
+        uint8_t kind = _HDL_BlockNumber(ctx, *blockIndex, &slot, NULL);
+        if(kind == HDL_NUMBER_OUT_OF_RANGE) {
+            return 1;
+        }
+        if(kind != HDL_TOKEN_INT) {
+            struct HDL_Symbol *symbol = _HDL_FindSymbol(ctx, doc, *blockIndex, blockIndex);
+            if(symbol != NULL && symbol->kind == HDL_SYMBOL_VAR) {
+                struct HDL_Variable *var = &doc->vars[symbol->index];
+                if(var->count != 1 || (var->type != HDL_TYPE_I8 && var->type != HDL_TYPE_I16 && var->type != HDL_TYPE_I32 && var->type != HDL_TYPE_I64)) {
+                    printf("Error: Binding '%s' is not an integer constant\r\n", var->name);
+                    return 1;
                 }
+                slot = _HDL_NumberAsInt(var->value, var->type);
             }
-            if(!f) {
-                printf("Waringin: Could not parse binding\r\n");
-                if(*val_out == NULL) {
-                    *val_out = malloc(1);
-                }
-                *(uint8_t*)(*val_out) = 0xFF;
+            else {
+                // Would otherwise share a vartable with every other unresolved binding
+                printf("Error: Unknown binding '%s'\r\n", _HDL_NameString(ctx, *blockIndex));
+                return 1;
             }
         }
-        else {
+        // Slots are written as a byte
+        if(slot < 0 || slot > UINT8_MAX) {
+            printf("Error: Binding slot %lld is out of range (0 - 255)\r\n", (long long)slot);
+            return 1;
+        }
+        if(*val_out == NULL) {
+            *val_out = HDL_ArenaAlloc(&doc->arena, 1);
             if(*val_out == NULL) {
-                *val_out = malloc(1);
+                printf("Error: Out of memory\r\n");
+                return 1;
             }
-            *(uint8_t*)(*val_out) = atoi(blocks[*blockIndex]);
         }
+        *(uint8_t*)(*val_out) = slot;
     }
     else {
-        // Check variable table
-        uint8_t f = 0;
-        for(int i = 0; i < doc->varCount; i++) {
-            if(strcmp(doc->vars[i].name, blocks[*blockIndex]) == 0) {
-
-                // TODO: Copy or reference? reference for now
-                *len_out = doc->vars[i].count;
-                *type_out = doc->vars[i].type;
-                if(*val_out == NULL) {
-                    *val_out = doc->vars[i].value;
+        // Check variable and image tables
+        struct HDL_Symbol *symbol = _HDL_FindSymbol(ctx, doc, *blockIndex, blockIndex);
+        if(symbol == NULL) {
+            printf("Unknown value '%s'\r\n", _HDL_NameString(ctx, *blockIndex));
+            return 1;
+        }
+        if(symbol->kind == HDL_SYMBOL_VAR) {
+            struct HDL_Variable *var = &doc->vars[symbol->index];
+
+            // TODO: Copy or reference? reference for now
+            *len_out = var->count;
+            *type_out = var->type;
+            if(*val_out == NULL) {
+                *val_out = var->value;
+            }
+            else {
+                if(*type_out == HDL_TYPE_STRING) {
+                    strcpy(*val_out, var->value);
                 }
                 else {
-                    if(*type_out == HDL_TYPE_STRING) {
-                        strcpy(*val_out, doc->vars[i].value);
-                    }
-                    else {
-                        memcpy(*val_out, doc->vars[i].value, HDL_TYPE_SIZES[doc->vars[i].type]);
-                    }
+                    memcpy(*val_out, var->value, HDL_TYPE_SIZES[var->type]);
                 }
-
-                f = 1;
-                break;
             }
         }
-        if(!f) {
-            // Check image table
-            for(int i = 0; i < doc->bitmapCount; i++) {
-                if(strcmp(doc->bitmaps[i].name, blocks[*blockIndex]) == 0) {
-
-                    *len_out = 1;
-                    *type_out = HDL_TYPE_IMG;
-                    if(*val_out == NULL) {
-                        *val_out = malloc(2);
-                    }
-                    *(uint16_t*)(*val_out) = i;
-                    f = 1;
-                    break;
-                }
+        else {
+            *len_out = 1;
+            *type_out = HDL_TYPE_IMG;
+            if(*val_out == NULL) {
+                *val_out = HDL_ArenaAlloc(&doc->arena, sizeof(uint32_t));
             }
-        }
-
-        if(!f) {
-            printf("Unknown value!\r\n");
-            return 1;
+            *(uint32_t*)(*val_out) = symbol->index;
         }
     }
 
@@ -575,41 +2294,57 @@ int _HDL_ParseValue (struct HDL_Document *doc, int *blockIndex, uint8_t *len_out
     return 0;
 }
 
-int _HDL_ParseAttribute (struct HDL_Document *doc, struct HDL_Element *element, int *blockIndex) {
+int _HDL_ParseAttribute (struct HDL_ParseContext *ctx, struct HDL_Document *doc, struct HDL_Element *element, int *blockIndex) {
 
-    if(isDelimiter(blocks[*blockIndex][0])) {
+    if(_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
         printf("Error: Unexpected delimiter on attribute\r\n");
         return 1;
     }
-    // Reallocate attributes if needed
-    if(element->attrCount >= element->attrAllocCount) {
-        element->attrAllocCount += HDL_ELEMENT_ATTR_INITIAL_SIZE;
-        element->attrs = realloc(element->attrs, sizeof(struct HDL_Attr) * element->attrAllocCount);
+    // Reallocate attribute pool if needed
+    if(doc->attrCount >= doc->attrAllocCount) {
+        uint32_t n_alloc = _HDL_GrowCount(doc->attrAllocCount, HDL_DOC_ATTRS_INITIAL_SIZE, UINT32_MAX);
+        if(n_alloc == 0 || _HDL_GrowArray(doc, (void**)&doc->attrs, doc->attrAllocCount, n_alloc, sizeof(struct HDL_Attr))) {
+            return 1;
+        }
+        doc->attrAllocCount = n_alloc;
     }
     
-    struct HDL_Attr *attr = &element->attrs[element->attrCount++];
+    // Attributes are parsed before children, so the attributes of an element stay contiguous
+    struct HDL_Attr *attr = &doc->attrs[doc->attrCount++];
+    element->attrCount++;
     memset(attr, 0, sizeof(struct HDL_Attr));
 
     // Read attribute key
-    strcpy(attr->key, blocks[*blockIndex]);
-    (*blockIndex)++;
+    uint32_t keyLen = 0;
+    int keyEnd = _HDL_NameEnd(ctx, *blockIndex);
+    const char *key = _HDL_NameText(ctx, *blockIndex, keyEnd, &keyLen);
+    if(key == NULL) {
+        return 1;
+    }
+    int32_t keyId = HDL_SymbolIntern(&doc->symbols, key, keyLen);
+    if(keyId < 0) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+    attr->key = keyId;
+    *blockIndex = keyEnd + 1;
 
-    if(!isDelimiter(blocks[*blockIndex][0]) || blocks[*blockIndex][0] == '>' || blocks[*blockIndex][0] == '/') {
+    if(!_HDL_BlockIsDelimiter(ctx, *blockIndex) || _HDL_BlockChar(ctx, *blockIndex, 0) == '>' || _HDL_BlockChar(ctx, *blockIndex, 0) == '/') {
         // Nothing assigned, set to true
         attr->count = 1;
         attr->type = HDL_TYPE_BOOL;
-        attr->value = malloc(1);
+        attr->value = HDL_ArenaAlloc(&doc->arena, 1);
         *(uint8_t*)attr->value = 1;
-        //if(blocks[*blockIndex][0] == '>' || blocks[*blockIndex][0] == '/') {
+        //if(_HDL_BlockChar(ctx, *blockIndex, 0) == '>' || _HDL_BlockChar(ctx, *blockIndex, 0) == '/') {
             // Decrement blockIndex if ending tag
         (*blockIndex)--;
         //}
         return 0;
     }
 
-    if(blocks[*blockIndex][0] == '=') {
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) == '=') {
         (*blockIndex)++;
-        if(_HDL_ParseValue(doc, blockIndex, &attr->count, &attr->type, &attr->value)) {
+        if(_HDL_ParseValue(ctx, doc, blockIndex, &attr->count, &attr->type, &attr->value)) {
             return 1;
         }
     }
@@ -621,70 +2356,133 @@ int _HDL_ParseAttribute (struct HDL_Document *doc, struct HDL_Element *element,
     return 0;
 }
 
-int _HDL_ParseImageFromPath (struct HDL_Bitmap *bmp, struct HDL_Document *doc, int *blockIndex) {
+int _HDL_ParseImageFromPath (struct HDL_ParseContext *ctx, struct HDL_Bitmap *bmp, struct HDL_Document *doc, int *blockIndex) {
     // Remove quotes
     char nbuff[128];
-    strcpy(nbuff, blocks[*blockIndex] + 1);
-    nbuff[strlen(nbuff) - 1] = 0;
-    return HDL_BitmapFromBMP(nbuff, bmp);
+    uint32_t len = _HDL_BlockCopy(ctx, *blockIndex, nbuff, sizeof(nbuff));
+    if(len < 2 || len >= sizeof(nbuff)) {
+        printf("Invalid image path\r\n");
+        return 1;
+    }
+    memmove(nbuff, nbuff + 1, len - 2);
+    nbuff[len - 2] = 0;
+    if(HDL_BitmapFromBMP(ctx, nbuff, bmp, &doc->arena)) {
+        return 1;
+    }
+    if(ctx->module != NULL) {
+        // Bitmap is part of an included module, module is parsed again if the file changes
+        char path[HDL_MODULE_PATH_MAX_LENGTH];
+        uint64_t hash = 0;
+        snprintf(path, sizeof(path), "%s%s", ctx->input_path, nbuff);
+        if(HDL_HashFile(path, &hash) || HDL_ModuleAddDep(ctx->module, path, hash)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-int _HDL_ParseImage (struct HDL_Document *doc, int *blockIndex) {
-    (*blockIndex)++;
-    // Reallocate images
+/**
+ * @brief Adds a zeroed bitmap to the document
+ * 
+ * @param doc 
+ * @return struct HDL_Bitmap* NULL if out of memory
+ */
+static struct HDL_Bitmap *_HDL_NewBitmap (struct HDL_Document *doc) {
     if(doc->bitmapCount >= doc->bitmapAllocCount) {
-        doc->bitmapAllocCount += HDL_DOC_BITMAPS_INITIAL_SIZE;
-        doc->bitmaps = realloc(doc->bitmaps, sizeof(struct HDL_Bitmap) * doc->bitmapAllocCount);
+        uint32_t n_alloc = _HDL_GrowCount(doc->bitmapAllocCount, HDL_DOC_BITMAPS_INITIAL_SIZE, UINT32_MAX);
+        if(n_alloc == 0 || _HDL_GrowArray(doc, (void**)&doc->bitmaps, doc->bitmapAllocCount, n_alloc, sizeof(struct HDL_Bitmap))) {
+            return NULL;
+        }
+        doc->bitmapAllocCount = n_alloc;
     }
     struct HDL_Bitmap *bmp = &doc->bitmaps[doc->bitmapCount];
+    memset(bmp, 0, sizeof(struct HDL_Bitmap));
     bmp->id = doc->bitmapCount;
     doc->bitmapCount++;
+    return bmp;
+}
+
+/**
+ * @brief Adds a zeroed variable to the document
+ * 
+ * @param doc 
+ * @return struct HDL_Variable* NULL if out of memory
+ */
+static struct HDL_Variable *_HDL_NewVariable (struct HDL_Document *doc) {
+    if(doc->varCount >= doc->varAllocCount) {
+        uint32_t n_alloc = _HDL_GrowCount(doc->varAllocCount, HDL_DOC_VARS_INITIAL_SIZE, UINT32_MAX);
+        if(n_alloc == 0 || _HDL_GrowArray(doc, (void**)&doc->vars, doc->varAllocCount, n_alloc, sizeof(struct HDL_Variable))) {
+            return NULL;
+        }
+        doc->varAllocCount = n_alloc;
+    }
+    struct HDL_Variable *_var = &doc->vars[doc->varCount++];
+    memset(_var, 0, sizeof(struct HDL_Variable));
+    return _var;
+}
+
+int _HDL_ParseImage (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex) {
+    (*blockIndex)++;
+    struct HDL_Bitmap *bmp = _HDL_NewBitmap(doc);
+    if(bmp == NULL) {
+        return 1;
+    }
 
     // First block should be the name of the image
-    if(isDelimiter(blocks[*blockIndex][0])) {
+    if(_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
         printf("Unexpected character while parsing images\r\n");
         return 1;
     }
     
-    strcpy(bmp->name, blocks[*blockIndex]);
+    _HDL_NameCopy(ctx, blockIndex, bmp->name, sizeof(bmp->name));
+    if(_HDL_DefineSymbol(doc, bmp->name, HDL_SYMBOL_BITMAP, bmp->id)) {
+        return 1;
+    }
     bmp->colorMode = HDL_COLORS_MONO;
     (*blockIndex)++;
 
     // Expecting image name
-    if(blocks[*blockIndex][0] == '"') {
-        return _HDL_ParseImageFromPath(bmp, doc, blockIndex);
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) == '"') {
+        return _HDL_ParseImageFromPath(ctx, bmp, doc, blockIndex);
     }
     // Expecting parenthesis with width, height inside
-    else if(blocks[*blockIndex][0] != '(') {
+    else if(_HDL_BlockChar(ctx, *blockIndex, 0) != '(') {
         printf("(width, height) or image path expected while defining image\r\n");
         return 1;
     }
     // Width
     (*blockIndex)++;
-    // TODO: Check if numerical
-    bmp->width = atoi(blocks[*blockIndex]);
+    if(_HDL_BlockDimension(ctx, *blockIndex, &bmp->width)) {
+        return 1;
+    }
     // Comma between values
     (*blockIndex)++;
-    if(blocks[*blockIndex][0] != ',') {
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) != ',') {
         printf("(width, height) expected while defining image\r\n");
         return 1;
     }
     // Height
     (*blockIndex)++;
-    bmp->height = atoi(blocks[*blockIndex]);
+    if(_HDL_BlockDimension(ctx, *blockIndex, &bmp->height)) {
+        return 1;
+    }
     // Closing parenthesis
     (*blockIndex)++;
-    if(blocks[*blockIndex][0] == ',') {
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) == ',') {
         // Spritesheet values
         (*blockIndex)++;
-        bmp->sprite_width = atoi(blocks[*blockIndex]);
+        if(_HDL_BlockDimension(ctx, *blockIndex, &bmp->sprite_width)) {
+            return 1;
+        }
         (*blockIndex)++;
-        if(blocks[*blockIndex][0] != ',') {
+        if(_HDL_BlockChar(ctx, *blockIndex, 0) != ',') {
             printf("(width, height, sprite_width, sprite_height) expected while defining image\r\n");
             return 1;
         }
         (*blockIndex)++;
-        bmp->sprite_height = atoi(blocks[*blockIndex]);
+        if(_HDL_BlockDimension(ctx, *blockIndex, &bmp->sprite_height)) {
+            return 1;
+        }
         (*blockIndex)++;
     }
     else {
@@ -692,35 +2490,42 @@ int _HDL_ParseImage (struct HDL_Document *doc, int *blockIndex) {
         bmp->sprite_width = bmp->width;
     }
 
-    if(blocks[*blockIndex][0] != ')') {
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) != ')') {
         printf("Missing parenthesis while defining image\r\n");
         return 1;
     }
 
     (*blockIndex)++;
 
-    if(blocks[*blockIndex][0] == '"') {
+    if(_HDL_BlockChar(ctx, *blockIndex, 0) == '"') {
         // Bitmap from .bmp
-        return _HDL_ParseImageFromPath(bmp, doc, blockIndex);
+        return _HDL_ParseImageFromPath(ctx, bmp, doc, blockIndex);
     }
 
     bmp->size = (bmp->width + 7)/8 * bmp->height;
     // Allocate and zero data buffer
-    bmp->data = malloc(bmp->size);
+    bmp->data = HDL_ArenaAlloc(&doc->arena, bmp->size);
+    if(bmp->data == NULL) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
     memset(bmp->data, 0, bmp->size);
 
     int y = 0;
     int x = 0;
     int pad_width = (bmp->width + 7) / 8;
     // Start reading image data until semicolon
-    while((*blockIndex) < block_count) {
+    while(_HDL_BlockExists(ctx, *blockIndex)) {
 
-        if(blocks[*blockIndex][0] == ';') {
+        if(_HDL_BlockChar(ctx, *blockIndex, 0) == ';') {
             // Done
             break;
         }
-        char *block = blocks[*blockIndex];
-        int len = strlen(block);
+        uint32_t len = 0;
+        const char *block = _HDL_BlockText(ctx, *blockIndex, &len);
+        if(block == NULL) {
+            return 1;
+        }
         
         for(int i = 0; i < len; i++) {
 
@@ -754,60 +2559,280 @@ int _HDL_ParseImage (struct HDL_Document *doc, int *blockIndex) {
     return 0;
 }
 
-int _HDL_ParseVariable (struct HDL_Document *doc, int *blockIndex) {
+/**
+ * @brief Finds a module merged into the document
+ * 
+ * @param doc 
+ * @param path Path of the module file
+ * @return int32_t Index in the document includes, -1 if not merged
+ */
+static int32_t _HDL_FindInclude (struct HDL_Document *doc, const char *path) {
+    for(uint32_t i = 0; i < doc->includeCount; i++) {
+        if(strcmp(doc->includes[i], path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Records a module as merged into the document
+ * 
+ * @param doc 
+ * @param path Path of the module file
+ * @return int 0 on success
+ */
+static int _HDL_AddInclude (struct HDL_Document *doc, const char *path) {
+    if(doc->includeCount >= doc->includeAllocCount) {
+        uint32_t n_alloc = _HDL_GrowCount(doc->includeAllocCount, HDL_DOC_INCLUDES_INITIAL_SIZE, UINT32_MAX);
+        if(n_alloc == 0 || _HDL_GrowArray(doc, (void**)&doc->includes, doc->includeAllocCount, n_alloc, sizeof(char*))) {
+            return 1;
+        }
+        doc->includeAllocCount = n_alloc;
+    }
+    size_t len = strlen(path) + 1;
+    char *copy = HDL_ArenaAlloc(&doc->arena, len);
+    if(copy == NULL) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+    memcpy(copy, path, len);
+    doc->includes[doc->includeCount++] = copy;
+    return 0;
+}
+
+/**
+ * @brief Copies the definitions of an included module to the document
+ * 
+ * Definitions of a module are merged once, definitions the module got from a module 
+ * the document already merged (a file included by two libraries) are skipped
+ * 
+ * @param doc 
+ * @param module 
+ * @param path Path of the module file
+ * @return int 0 on success
+ */
+static int _HDL_MergeModule (struct HDL_Document *doc, struct HDL_Document *module, const char *path) {
+    if(_HDL_FindInclude(doc, path) >= 0) {
+        return 0;
+    }
+
+    // Module of each definition in the document, indexed like HDL_Variable.module. 0 if merged before
+    uint32_t *origins = malloc(sizeof(uint32_t) * (module->includeCount + 1));
+    // Bitmap ids of the module in the document
+    uint32_t *bitmapIds = malloc(sizeof(uint32_t) * (module->bitmapCount + 1));
+    int err = origins == NULL || bitmapIds == NULL;
+    if(err) {
+        printf("Error: Out of memory\r\n");
+    }
+
+    for(uint32_t i = 0; !err && i <= module->includeCount; i++) {
+        const char *include = i == 0 ? path : module->includes[i - 1];
+        if(_HDL_FindInclude(doc, include) >= 0) {
+            origins[i] = 0;
+        }
+        else {
+            err = _HDL_AddInclude(doc, include);
+            origins[i] = doc->includeCount;
+        }
+    }
+
+    for(uint32_t i = 0; !err && i < module->bitmapCount; i++) {
+        struct HDL_Bitmap *src = &module->bitmaps[i];
+        if(origins[src->module] == 0) {
+            // Same bitmap is already in the document
+            int32_t id = HDL_SymbolFind(&doc->symbols, src->name, strlen(src->name));
+            if(id < 0 || doc->symbols.symbols[id].kind != HDL_SYMBOL_BITMAP) {
+                printf("Error: Bitmap '%s' of %s is missing\r\n", src->name, path);
+                err = 1;
+                break;
+            }
+            bitmapIds[i] = doc->symbols.symbols[id].index;
+            continue;
+        }
+        struct HDL_Bitmap *bmp = _HDL_NewBitmap(doc);
+        if(bmp == NULL) {
+            err = 1;
+            break;
+        }
+        uint32_t id = bmp->id;
+        *bmp = *src;
+        bmp->id = id;
+        bmp->module = origins[src->module];
+        bitmapIds[i] = id;
+        bmp->data = HDL_ArenaAlloc(&doc->arena, src->size);
+        if(bmp->data == NULL && src->size > 0) {
+            printf("Error: Out of memory\r\n");
+            err = 1;
+            break;
+        }
+        memcpy(bmp->data, src->data, src->size);
+        err = _HDL_DefineSymbol(doc, bmp->name, HDL_SYMBOL_BITMAP, bmp->id);
+    }
+
+    for(uint32_t i = 0; !err && i < module->varCount; i++) {
+        struct HDL_Variable *src = &module->vars[i];
+        if(origins[src->module] == 0) {
+            continue;
+        }
+        struct HDL_Variable *_var = _HDL_NewVariable(doc);
+        if(_var == NULL) {
+            err = 1;
+            break;
+        }
+        *_var = *src;
+        _var->module = origins[src->module];
+        size_t size = src->type == HDL_TYPE_STRING ? strlen(src->value) + 1 : (size_t)HDL_TYPE_SIZES[src->type] * src->count;
+        _var->value = HDL_ArenaAlloc(&doc->arena, size);
+        if(_var->value == NULL && size > 0) {
+            printf("Error: Out of memory\r\n");
+            err = 1;
+            break;
+        }
+        memcpy(_var->value, src->value, size);
+        if(_var->type == HDL_TYPE_IMG) {
+            *(uint32_t*)_var->value = bitmapIds[*(uint32_t*)src->value];
+        }
+        err = _HDL_DefineSymbol(doc, _var->name, HDL_SYMBOL_VAR, doc->varCount - 1);
+    }
+
+    free(origins);
+    free(bitmapIds);
+    return err;
+}
+
+/**
+ * @brief Parses #include "file", definitions of the file are added to the document
+ * 
+ * @param doc 
+ * @param blockIndex Index of the include block, moved to the path
+ * @return int 0 on success
+ */
+static int _HDL_ParseInclude (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex) {
     (*blockIndex)++;
-    if(strcmp(blocks[*blockIndex], "const") == 0) {
-        // Define constant
-        // Reallocate variables if needed
-        if(doc->varCount >= doc->varAllocCount) {
-            doc->varAllocCount += HDL_DOC_VARS_INITIAL_SIZE;
-            doc->vars = realloc(doc->vars, sizeof(struct HDL_Variable) * doc->varAllocCount);
+    if(_HDL_Block(ctx, *blockIndex)->kind != HDL_TOKEN_STRING) {
+        printf("Error: Expected a quoted path after #include\r\n");
+        return 1;
+    }
+    // Remove quotes
+    char nbuff[HDL_MODULE_PATH_MAX_LENGTH];
+    uint32_t len = _HDL_BlockCopy(ctx, *blockIndex, nbuff, sizeof(nbuff));
+    if(len < 2 || len >= sizeof(nbuff)) {
+        printf("Invalid include path\r\n");
+        return 1;
+    }
+    memmove(nbuff, nbuff + 1, len - 2);
+    nbuff[len - 2] = 0;
+
+    // Relative paths are relative to the including file
+    char path[HDL_MODULE_PATH_MAX_LENGTH];
+    if(nbuff[0] == '/') {
+        strcpy(path, nbuff);
+    }
+    else if(snprintf(path, sizeof(path), "%s%s", ctx->input_path, nbuff) >= sizeof(path)) {
+        printf("Error: Path too long %s%s\r\n", ctx->input_path, nbuff);
+        return 1;
+    }
+    // Same file reached through different relative paths is the same module
+    char *real = realpath(path, NULL);
+    if(real != NULL) {
+        if(strlen(real) < sizeof(path)) {
+            strcpy(path, real);
         }
+        free(real);
+    }
+
+    struct HDL_Module *module = NULL;
+    if(HDL_ModuleAcquire(ctx, path, &module)) {
+        return 1;
+    }
+
+    int err = _HDL_MergeModule(doc, &module->doc, module->path);
+
+    if(!err && ctx->module != NULL) {
+        // Nested include, the including module depends on the module and everything it was built from
+        err = HDL_ModuleAddDep(ctx->module, module->path, module->hash);
+        for(uint32_t i = 0; !err && i < module->depCount; i++) {
+            err = HDL_ModuleAddDep(ctx->module, module->deps[i].path, module->deps[i].hash);
+        }
+    }
 
+    HDL_ModuleRelease(ctx, module);
+    return err;
+}
+
+int _HDL_ParseVariable (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int *blockIndex) {
+    (*blockIndex)++;
+    if(_HDL_BlockEquals(ctx, *blockIndex, "const")) {
+        // Define constant
         (*blockIndex)++;
-        if(isDelimiter(blocks[*blockIndex][0])) {
+        if(_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
             // Unexpected
             printf("Unexpected delimiter instead of const name\r\n");
             return 1;
         }
-        struct HDL_Variable *_var = &doc->vars[doc->varCount++];
-
-        memset(_var, 0, sizeof(struct HDL_Variable));
+        struct HDL_Variable *_var = _HDL_NewVariable(doc);
+        if(_var == NULL) {
+            return 1;
+        }
 
         _var->isConst = 1;
         // Copy name to variable
-        strcpy(_var->name, blocks[*blockIndex]);
+        _HDL_NameCopy(ctx, blockIndex, _var->name, sizeof(_var->name));
 
         (*blockIndex)++;
 
-        if(_HDL_ParseValue(doc, blockIndex, &_var->count, &_var->type, &_var->value)) {
+        if(_HDL_ParseValue(ctx, doc, blockIndex, &_var->count, &_var->type, &_var->value)) {
             printf("Failed to parse value for const\r\n");
             return 1;
         }
 
+        // Defined after the value, so the value can not refer to the constant itself
+        if(_HDL_DefineSymbol(doc, _var->name, HDL_SYMBOL_VAR, doc->varCount - 1)) {
+            return 1;
+        }
+
         (*blockIndex)++;
 
     }
-    else if(strcmp(blocks[*blockIndex], "img") == 0) {
+    else if(_HDL_BlockEquals(ctx, *blockIndex, "img")) {
         // Define bitmap
-        if(_HDL_ParseImage(doc, blockIndex)) {
+        if(_HDL_ParseImage(ctx, doc, blockIndex)) {
             printf("Failed to parse bitmap image\r\n");
             return 1;
         }
 
         (*blockIndex)++;
     }
+    else if(_HDL_BlockEquals(ctx, *blockIndex, "include")) {
+        // Include definitions of another file
+        if(_HDL_ParseInclude(ctx, doc, blockIndex)) {
+            return 1;
+        }
+
+        (*blockIndex)++;
+    }
     else {
-        printf("Error: Unknown definition %s\r\n", blocks[*blockIndex]);
+        printf("Error: Unknown definition %s\r\n", _HDL_BlockString(ctx, *blockIndex));
         return 1;
     }
     return 0;
 }
 
-int _HDL_ParseElement (struct HDL_Document *doc, int parentIndex, int *blockIndex) {
+/**
+ * @brief Parses an opening tag with its attributes and adds the element to the document
+ * 
+ * @param doc 
+ * @param parentIndex Index of the parent element, -1 if root
+ * @param blockIndex Index of the '<' block, moved past the end of the tag
+ * @param tagType_out 1 = short tag, 2 = long tag (children and content follow)
+ * @return int 0 on success
+ */
+static int _HDL_ParseOpenTag (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int parentIndex, int *blockIndex, uint8_t *tagType_out) {
 
+    uint32_t start = _HDL_BlockOffset(ctx, *blockIndex);
     (*blockIndex)++;
-    if(isDelimiter(blocks[*blockIndex][0])) {
+    if(_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
         // Should be a tagname, not delimiter
         printf("Unexpected delimiter at start\r\n");
 
@@ -816,11 +2841,17 @@ int _HDL_ParseElement (struct HDL_Document *doc, int parentIndex, int *blockInde
 
     // Reallocate if needed
     if(doc->elementCount >= doc->elementAllocCount) {
-        doc->elementAllocCount += HDL_DOC_ELEMENTS_INITIAL_SIZE;
-        doc->elements = realloc(doc->elements, sizeof(struct HDL_Element) * doc->elementAllocCount);
+        uint32_t n_alloc = _HDL_GrowCount(doc->elementAllocCount, HDL_DOC_ELEMENTS_INITIAL_SIZE, INT32_MAX);
+        if(n_alloc == 0 
+            || _HDL_GrowArray(doc, (void**)&doc->elements, doc->elementAllocCount, n_alloc, sizeof(struct HDL_Element))
+            || _HDL_GrowArray(doc, (void**)&doc->contents, doc->elementAllocCount, n_alloc, sizeof(char*))
+            || _HDL_GrowArray(doc, (void**)&doc->parents, doc->elementAllocCount, n_alloc, sizeof(int32_t))
+            || _HDL_GrowArray(doc, (void**)&doc->spans, doc->elementAllocCount, n_alloc, sizeof(struct HDL_Span))) {
+            return 1;
+        }
+        doc->elementAllocCount = n_alloc;
     }
 
-    // Element count or element address may change, so save the index here
     int elementIndex = doc->elementCount;
 
     struct HDL_Element *element = &doc->elements[elementIndex];
@@ -830,10 +2861,27 @@ int _HDL_ParseElement (struct HDL_Document *doc, int parentIndex, int *blockInde
 
     // Initialize element
     _HDL_InitElement(element);
+    element->attrStart = doc->attrCount;
+    doc->contents[elementIndex] = NULL;
+    doc->parents[elementIndex] = parentIndex;
+    // End is set at the end of the tag
+    doc->spans[elementIndex].start = start;
+    doc->spans[elementIndex].end = start;
 
     // Save the tagname
-    strcpy(element->tag, blocks[*blockIndex]);
-    (*blockIndex)++;
+    uint32_t tagLen = 0;
+    int tagEnd = _HDL_NameEnd(ctx, *blockIndex);
+    const char *tag = _HDL_NameText(ctx, *blockIndex, tagEnd, &tagLen);
+    if(tag == NULL) {
+        return 1;
+    }
+    int32_t tagId = HDL_SymbolIntern(&doc->symbols, tag, tagLen);
+    if(tagId < 0) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+    element->tag = tagId;
+    *blockIndex = tagEnd + 1;
 
     // 0 = undefined, 1 = short tag, 2 = long tag (check children too)
     uint8_t tagType = 0;
@@ -841,15 +2889,14 @@ int _HDL_ParseElement (struct HDL_Document *doc, int parentIndex, int *blockInde
     // Element tag can be checked here
 
     // Loop through possible attributes until /> or >
-    while((*blockIndex) < block_count) {
-        char *block = blocks[*blockIndex];
-        if(isDelimiter(block[0])) {
-            if(block[0] == '/') {
+    while(_HDL_BlockExists(ctx, *blockIndex)) {
+        if(_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
+            char c = _HDL_BlockChar(ctx, *blockIndex, 0);
+            if(c == '/') {
 
                 // Short tag
                 (*blockIndex)++;
-                block = blocks[*blockIndex];
-                if(block[0] != '>') {
+                if(_HDL_BlockChar(ctx, *blockIndex, 0) != '>') {
                     // Unexpected character
                     printf("Unexpected delimiter attrs 1\r\n");
 
@@ -857,134 +2904,246 @@ int _HDL_ParseElement (struct HDL_Document *doc, int parentIndex, int *blockInde
                 }
                 else {
                     tagType = 1;
+                    doc->spans[elementIndex].end = _HDL_BlockOffset(ctx, *blockIndex) + 1;
                     (*blockIndex)++;
                     break;
                 }
             }
-            else if(block[0] == '>') {
+            else if(c == '>') {
                 // Long tag
 
-                tagType = 2;
-                (*blockIndex)++;
+                tagType = 2;
+                (*blockIndex)++;
+                break;
+            }
+            else {
+                printf("Error: Unexpected delimiter %c\r\n", c);
+                return 1;
+            }
+        }
+        else {
+            // Attribute
+            if(_HDL_ParseAttribute(ctx, doc, element, blockIndex)) {
+                printf("Error: Failed to parse attribute\r\n");
+                return 1;
+            }
+            (*blockIndex)++;
+        }
+    }
+
+
+    if(parentIndex >= 0) {
+        // Count the child, child index is built when the whole document is parsed
+        doc->elements[parentIndex].childCount++;
+    }
+
+    if(tagType == 0) {
+        // Unexpected end of input
+        return 1;
+    }
+
+    *tagType_out = tagType;
+    return 0;
+}
+
+/**
+ * @brief Parses an element and all of its children
+ * 
+ * Nesting is tracked with an explicit stack of open elements instead of recursion,
+ * so deep documents can not overflow the call stack
+ * 
+ * @param doc 
+ * @param rootParent Parent of the element, -1 if it is the root
+ * @param rootDepth Depth of the parent, 0 if the element is the root
+ * @param blockIndex Index of the '<' block
+ * @return int 0 on success
+ */
+int _HDL_ParseElement (struct HDL_ParseContext *ctx, struct HDL_Document *doc, int rootParent, uint32_t rootDepth, int *blockIndex) {
+
+    // Open long tags, innermost last
+    uint32_t stackAllocCount = HDL_PARSE_STACK_INITIAL_SIZE;
+    struct HDL_ParseFrame *stack = malloc(sizeof(struct HDL_ParseFrame) * stackAllocCount);
+    uint32_t depth = 0;
+    int err = 0;
+
+    if(stack == NULL) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+
+    // Next tag to parse starts at blockIndex
+    uint8_t openTag = 1;
+
+    while(1) {
+
+        if(openTag) {
+            openTag = 0;
+
+            int parentIndex = depth > 0 ? (int)stack[depth - 1].element : rootParent;
+            int elementIndex = doc->elementCount;
+            uint8_t tagType = 0;
+            if(_HDL_ParseOpenTag(ctx, doc, parentIndex, blockIndex, &tagType)) {
+                err = 1;
                 break;
             }
-            else {
-                printf("Error: Unexpected delimiter %c\r\n", block[0]);
-                return 1;
+
+            // Depth of the element, root is 1
+            if(rootDepth + depth + 1 > doc->maxDepth) {
+                doc->maxDepth = rootDepth + depth + 1;
             }
-        }
-        else {
-            // Attribute
-            if(_HDL_ParseAttribute(doc, element, blockIndex)) {
-                printf("Error: Failed to parse attribute\r\n");
-                return 1;
+
+            if(tagType == 2) {
+                // Parse children/content until the closing tag
+                if(depth >= stackAllocCount) {
+                    stackAllocCount *= 2;
+                    struct HDL_ParseFrame *n_stack = realloc(stack, sizeof(struct HDL_ParseFrame) * stackAllocCount);
+                    if(n_stack == NULL) {
+                        printf("Error: Out of memory\r\n");
+                        err = 1;
+                        break;
+                    }
+                    stack = n_stack;
+                }
+                stack[depth].element = elementIndex;
+                depth++;
             }
-            (*blockIndex)++;
         }
-    }
 
+        if(depth == 0 || !_HDL_BlockExists(ctx, *blockIndex)) {
+            // Root element done
+            break;
+        }
 
-    if(parentIndex < 0) {
-        // Root element
-        element->parent = -1;
-        
-    }
-    else {
-        struct HDL_Element *parent = &doc->elements[parentIndex];
-        // Add element to parents children
-        parent->children[parent->childCount++] = elementIndex;
+        uint32_t elementIndex = stack[depth - 1].element;
 
-        // Reallocate if needed...
-        if(parent->childCount >= parent->childAllocCount) {
-            parent->childAllocCount += HDL_ELEMENT_CHILDREN_INITIAL_SIZE;
-            parent->children = realloc(parent->children, sizeof(struct HDL_Element) * parent->childAllocCount);
-        }
-    }
+        if(_HDL_BlockChar(ctx, *blockIndex, 0) == '<') {
+            (*blockIndex)++;
+            if(_HDL_BlockChar(ctx, *blockIndex, 0) == '/') {
 
-    if(tagType == 0) {
-        // Unexpected end of input
-        return 1;
-    }
-    else if(tagType == 1) {
-        // Element ready
-    }
-    else if(tagType == 2) {
-        // Parse children/content
-        
-        while((*blockIndex) < block_count) {
-            if(blocks[*blockIndex][0] == '<') {
+                // Expect end tag for this element
                 (*blockIndex)++;
-                if(blocks[*blockIndex][0] == '/') {
-
-                    // Expect end tag for this element
-                    (*blockIndex)++;
-                    // Need to get address of the element again because it may have been changed
-                    element = &doc->elements[elementIndex];
-                    // Compare tags
-                    if(strcmp(blocks[*blockIndex], element->tag) == 0) {
+                struct HDL_Element *element = &doc->elements[elementIndex];
+                // Compare tags
+                uint32_t endLen = 0;
+                int endTagEnd = _HDL_NameEnd(ctx, *blockIndex);
+                const char *endTag = _HDL_NameText(ctx, *blockIndex, endTagEnd, &endLen);
+                if(endTag == NULL) {
+                    err = 1;
+                    break;
+                }
+                if(HDL_SymbolFind(&doc->symbols, endTag, endLen) == (int32_t)element->tag) {
+                    *blockIndex = endTagEnd + 1;
+                    if(_HDL_BlockChar(ctx, *blockIndex, 0) == '>') {
+                        // Element OK
+                        doc->spans[elementIndex].end = _HDL_BlockOffset(ctx, *blockIndex) + 1;
                         (*blockIndex)++;
-                        if(blocks[*blockIndex][0] == '>') {
-                            // Element OK
-                            (*blockIndex)++;
-                            break;
-                        }
-                        else {
-                            printf("Error: Unexpected character on closing tag\r\n");
-                            return 1;
-                        }
+                        depth--;
                     }
                     else {
-                        printf("Error: Mismatch of tags (<%s> vs </%s>)\r\n", blocks[*blockIndex], element->tag);
-                        return 1;
+                        printf("Error: Unexpected character on closing tag\r\n");
+                        err = 1;
+                        break;
                     }
                 }
                 else {
-                    if(isDelimiter(blocks[*blockIndex][0])) {
-                        // Unexpected character
-                        printf("Unexpected delimiter\r\n");
-                        return 1;
-                    }
-                    else {
-                        // Child element
-                        // Element parse function increments blockIndex at start so let's back up 1 block
-                        (*blockIndex)--;
-                        if(_HDL_ParseElement(doc, elementIndex, blockIndex)) {
-                            // Failed to parse
-                            
-                            return 1;
-                        }
-                    }
+                    printf("Error: Mismatch of tags (<%s> vs </%s>)\r\n", _HDL_NameString(ctx, *blockIndex), HDL_SymbolName(&doc->symbols, element->tag));
+                    err = 1;
+                    break;
                 }
             }
             else {
-                if(!isDelimiter(blocks[*blockIndex][0])) {
-                    // Copy content 
-                    // Need to get address of the element again because it may have been changed
-                    element = &doc->elements[elementIndex];
-                    if(element->content == NULL) {
-                        int bLen = strlen(blocks[*blockIndex]);
-                        element->content = malloc(bLen + 1);
-                        memcpy(element->content, blocks[*blockIndex], bLen + 1);
+                if(_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
+                    // Unexpected character
+                    printf("Unexpected delimiter\r\n");
+                    err = 1;
+                    break;
+                }
+                else {
+                    // Child element
+                    // Open tag parsing starts from the '<' block so let's back up 1 block
+                    (*blockIndex)--;
+                    openTag = 1;
+                }
+            }
+        }
+        else {
+            if(!_HDL_BlockIsDelimiter(ctx, *blockIndex)) {
+                // Copy content 
+                if(doc->contents[elementIndex] == NULL) {
+                    uint32_t bLen = 0;
+                    const char *text = _HDL_BlockText(ctx, *blockIndex, &bLen);
+                    if(text == NULL) {
+                        err = 1;
+                        break;
                     }
-                    else {
-                        // Prevent multiple allocation
-                        printf("Error: Multiple allocation of content\r\n");
-                        return 1;
+                    char *content = HDL_ArenaAlloc(&doc->arena, bLen + 1);
+                    if(content == NULL) {
+                        printf("Error: Out of memory\r\n");
+                        err = 1;
+                        break;
                     }
+                    memcpy(content, text, bLen);
+                    content[bLen] = 0;
+                    doc->contents[elementIndex] = content;
                 }
                 else {
-
-                    printf("Error: Unexpected character\r\n");
-                    return 1;
+                    // Prevent multiple allocation
+                    printf("Error: Multiple allocation of content\r\n");
+                    err = 1;
+                    break;
                 }
-                (*blockIndex)++;
             }
+            else {
+
+                printf("Error: Unexpected character\r\n");
+                err = 1;
+                break;
+            }
+            (*blockIndex)++;
+        }
+    }
+
+    free(stack);
+    return err;
+}
+
+/**
+ * @brief Builds the child index from the element parents
+ * 
+ * Elements are in document order, so children of an element end up in document order too
+ * 
+ * @param doc 
+ * @return int 0 on success
+ */
+static int _HDL_BuildChildIndex (struct HDL_Document *doc) {
+    // Index is built again after every incremental re-parse, reuse it if it is large enough
+    if(doc->children == NULL || doc->childAllocCount < doc->elementCount + 1) {
+        doc->children = HDL_ArenaAlloc(&doc->arena, sizeof(uint32_t) * (doc->elementCount + 1));
+        if(doc->children == NULL) {
+            printf("Error: Out of memory\r\n");
+            return 1;
+        }
+        doc->childAllocCount = doc->elementCount + 1;
+    }
+
+    // Ranges of the children, counts are filled again below
+    uint32_t start = 0;
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        doc->elements[i].childStart = start;
+        start += doc->elements[i].childCount;
+        doc->elements[i].childCount = 0;
+    }
+
+    for(uint32_t i = 0; i < doc->elementCount; i++) {
+        if(doc->parents[i] >= 0) {
+            struct HDL_Element *parent = &doc->elements[doc->parents[i]];
+            doc->children[parent->childStart + parent->childCount++] = i;
         }
     }
     return 0;
 }
 
-int _HDL_ParseBlocks (struct HDL_Document *doc) {
+int _HDL_ParseBlocks (struct HDL_ParseContext *ctx, struct HDL_Document *doc) {
     int err = 0;
     int blockIndex = 0;
 
@@ -992,14 +3151,14 @@ int _HDL_ParseBlocks (struct HDL_Document *doc) {
     uint8_t rootCreated = 0;
 
     // Loop until all blocks
-    while(blockIndex < block_count) {
-        if(blocks[blockIndex][0] == '#') {
+    while(_HDL_BlockExists(ctx, blockIndex)) {
+        if(_HDL_BlockChar(ctx, blockIndex, 0) == '#') {
             // Variable or image definition
-            err = _HDL_ParseVariable(doc, &blockIndex);
+            err = _HDL_ParseVariable(ctx, doc, &blockIndex);
             if(err)
                 break;
         }
-        else if(blocks[blockIndex][0] == '<') {
+        else if(_HDL_BlockChar(ctx, blockIndex, 0) == '<') {
             // Tag start - parse element
             if(rootCreated) {
                 // Multiple root elements, illegal
@@ -1008,78 +3167,507 @@ int _HDL_ParseBlocks (struct HDL_Document *doc) {
                 break;
             }
             rootCreated = 1;
-            err = _HDL_ParseElement(doc, -1, &blockIndex);
+            err = _HDL_ParseElement(ctx, doc, -1, 0, &blockIndex);
             if(err) {
                 printf("Error while parsing elements\r\n");
                 break;
             }
         }
-        else if(blocks[blockIndex][0] == '/' && blocks[blockIndex][1] == '*') {
+        else if(_HDL_BlockChar(ctx, blockIndex, 0) == '/' && _HDL_BlockChar(ctx, blockIndex, 1) == '*') {
             // Comment
-            while(blockIndex < block_count && (blocks[blockIndex][0] != '*' && blocks[blockIndex][1] == '/')) {
+            while(_HDL_BlockExists(ctx, blockIndex) && (_HDL_BlockChar(ctx, blockIndex, 0) != '*' && _HDL_BlockChar(ctx, blockIndex, 1) == '/')) {
                 // Wait until out of comment
                 blockIndex++;
             }
         }
         else {
 
-            printf("Unexpected block %s\r\n", blocks[blockIndex]);
+            printf("Unexpected block %s\r\n", _HDL_BlockString(ctx, blockIndex));
             err = 1;
             if(err)
                 break;
         }
     }
 
+    if(!err) {
+        err = _HDL_BuildChildIndex(doc);
+    }
+
     return err;
 }
 
 
 /**
- * @brief Parses an HDL file
+ * @brief Initializes an empty document
  * 
- * @param data Data to parse
- * @return int 0 on success
+ * @param doc 
  */
-int HDL_Parse (char *data, struct HDL_Document *doc) {
-    int err = 0;
-    // Initialize doc
+static void _HDL_InitDocument (struct HDL_Document *doc) {
+    // All memory of the document is allocated from the arena
+    HDL_ArenaInit(&doc->arena);
+
     // Elements
     doc->elementCount = 0;
+    doc->maxDepth = 0;
     doc->elementAllocCount = HDL_DOC_ELEMENTS_INITIAL_SIZE;
-    doc->elements = malloc(sizeof(struct HDL_Element) * doc->elementAllocCount);
+    doc->elements = HDL_ArenaAlloc(&doc->arena, sizeof(struct HDL_Element) * doc->elementAllocCount);
+    doc->contents = HDL_ArenaAlloc(&doc->arena, sizeof(char*) * doc->elementAllocCount);
+    doc->parents = HDL_ArenaAlloc(&doc->arena, sizeof(int32_t) * doc->elementAllocCount);
+    doc->spans = HDL_ArenaAlloc(&doc->arena, sizeof(struct HDL_Span) * doc->elementAllocCount);
+    doc->children = NULL;
+    doc->childAllocCount = 0;
+
+    // Attributes
+    doc->attrCount = 0;
+    doc->attrAllocCount = HDL_DOC_ATTRS_INITIAL_SIZE;
+    doc->attrs = HDL_ArenaAlloc(&doc->arena, sizeof(struct HDL_Attr) * doc->attrAllocCount);
     // Variables
     doc->varCount = 0;
     doc->varAllocCount = HDL_DOC_VARS_INITIAL_SIZE;
-    doc->vars = malloc(sizeof(struct HDL_Variable) * doc->varAllocCount);
+    doc->vars = HDL_ArenaAlloc(&doc->arena, sizeof(struct HDL_Variable) * doc->varAllocCount);
 
     // Bitmaps
     doc->bitmapCount = 0;
     doc->bitmapAllocCount = HDL_DOC_BITMAPS_INITIAL_SIZE;
-    doc->bitmaps = malloc(sizeof(struct HDL_Bitmap) * doc->bitmapAllocCount);
+    doc->bitmaps = HDL_ArenaAlloc(&doc->arena, sizeof(struct HDL_Bitmap) * doc->bitmapAllocCount);
+
+    // Included modules
+    doc->includes = NULL;
+    doc->includeCount = 0;
+    doc->includeAllocCount = 0;
+
+    // Names
+    HDL_SymbolsInit(&doc->symbols, &doc->arena);
+}
+
+/**
+ * @brief Frees all memory of a document
+ * 
+ * @param doc 
+ */
+void HDL_DocumentFree (struct HDL_Document *doc) {
+    HDL_ArenaFree(&doc->arena);
+
+    doc->elements = NULL;
+    doc->elementCount = 0;
+    doc->elementAllocCount = 0;
+    doc->contents = NULL;
+    doc->parents = NULL;
+    doc->spans = NULL;
+    doc->children = NULL;
+    doc->childAllocCount = 0;
+    doc->attrs = NULL;
+    doc->attrCount = 0;
+    doc->attrAllocCount = 0;
+    doc->vars = NULL;
+    doc->varCount = 0;
+    doc->varAllocCount = 0;
+    doc->bitmaps = NULL;
+    doc->bitmapCount = 0;
+    doc->bitmapAllocCount = 0;
+    doc->includes = NULL;
+    doc->includeCount = 0;
+    doc->includeAllocCount = 0;
+    memset(&doc->symbols, 0, sizeof(struct HDL_SymbolTable));
+}
+
+/**
+ * @brief Sets the cache included modules are parsed once in
+ * 
+ * @param ctx 
+ * @param cache Cache shared with other contexts, NULL to parse every include
+ */
+void HDL_SetModuleCache (struct HDL_ParseContext *ctx, struct HDL_ModuleCache *cache) {
+    ctx->modules = cache;
+}
+
+/**
+ * @brief Initializes a parse context
+ * 
+ * @param ctx 
+ * @param filename Path of the input file, relative image paths are resolved from its directory. NULL for the working directory
+ */
+void HDL_ParseContextInit (struct HDL_ParseContext *ctx, const char *filename) {
+    memset(ctx, 0, sizeof(struct HDL_ParseContext));
+    ctx->lex_mode = HDL_LEX_AUTO;
+    ctx->lex_threads = 0;
+    ctx->stream_eof = 1;
+
+    if(filename == NULL) {
+        return;
+    }
+    // Set filename path
+    for(int i = strlen(filename) - 1; i > 0; i--) {
+        if(filename[i] == '/') {
+            if(i + 1 >= sizeof(ctx->input_path)) {
+                break;
+            }
+            memcpy(ctx->input_path, filename, i + 1);
+            ctx->input_path[i + 1] = 0;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Parses an HDL file
+ * 
+ * @param data Data to parse, does not need to be null terminated
+ * @param len Length of the data
+ * @param doc Output document
+ * @return int 0 on success
+ */
+int HDL_Parse (struct HDL_ParseContext *ctx, const char *data, size_t len, struct HDL_Document *doc) {
+    int err = 0;
+    // Initialize doc
+    _HDL_InitDocument(doc);
+
+    if(len > UINT32_MAX) {
+        printf("Error: Input too large\r\n");
+        return 1;
+    }
 
     // Parse the data in to easy access blocks
-    err |= _HDL_ParseDataToBlocks(data);
+    err |= _HDL_ParseDataToBlocks(ctx, data, len);
 
     // Parse blocks
-    err |= _HDL_ParseBlocks(doc);
+    err |= _HDL_ParseBlocks(ctx, doc);
+
+    _HDL_FreeBlocks(ctx);
+
+    return err;
+}
+
+/**
+ * @brief Parses an HDL file from a stream
+ * 
+ * Input is read and lexed in fixed size chunks while parsing, 
+ * so the lexer memory use does not depend on the input size
+ * 
+ * @param file Input file
+ * @param doc Output document
+ * @return int 0 on success
+ */
+int HDL_ParseFile (struct HDL_ParseContext *ctx, FILE *file, struct HDL_Document *doc) {
+    int err = 0;
+    // Initialize doc
+    _HDL_InitDocument(doc);
+
+    err |= _HDL_StreamOpen(ctx, file);
+
+    // Parse blocks, lexing the stream as needed
+    if(!err) {
+        err |= _HDL_ParseBlocks(ctx, doc);
+    }
+    err |= ctx->stream_error;
 
-    _HDL_FreeBlocks();
+    _HDL_FreeBlocks(ctx);
 
     return err;
 }
 
+/**
+ * @brief Finds the deepest element whose text contains a change
+ * 
+ * Start and end tags of the element must be outside the change, so the element is still an element
+ * 
+ * @param doc 
+ * @param start Offset of the first changed character
+ * @param end Offset after the last changed character in the old text
+ * @return int32_t Element index, -1 if no element contains the change
+ */
+static int32_t _HDL_FindEditedElement (struct HDL_Document *doc, uint32_t start, uint32_t end) {
+    if(doc->elementCount == 0 || doc->children == NULL) {
+        return -1;
+    }
+    int32_t found = -1;
+    uint32_t index = 0;
+    while(doc->spans[index].start < start && end < doc->spans[index].end) {
+        found = index;
+
+        // Continue to the child containing the change
+        struct HDL_Element *element = &doc->elements[index];
+        uint32_t next = UINT32_MAX;
+        for(uint32_t i = 0; i < element->childCount; i++) {
+            uint32_t child = doc->children[element->childStart + i];
+            if(doc->spans[child].start < start && end < doc->spans[child].end) {
+                next = child;
+                break;
+            }
+        }
+        if(next == UINT32_MAX) {
+            break;
+        }
+        index = next;
+    }
+    return found;
+}
+
+/**
+ * @brief Moves elements [newFirst, total) of an array to first, in place of elements [first, last)
+ * 
+ * @param array 
+ * @param size Size of an element
+ * @param first 
+ * @param last 
+ * @param newFirst 
+ * @param total 
+ * @param scratch At least (total - newFirst) * size bytes
+ */
+static void _HDL_SpliceArray (void *array, size_t size, uint32_t first, uint32_t last, uint32_t newFirst, uint32_t total, void *scratch) {
+    uint8_t *bytes = array;
+    uint32_t newCount = total - newFirst;
+    memcpy(scratch, bytes + newFirst * size, newCount * size);
+    memmove(bytes + (first + newCount) * size, bytes + last * size, (newFirst - last) * size);
+    memcpy(bytes + first * size, scratch, newCount * size);
+}
+
+/**
+ * @brief Returns the index of an element or attribute after _HDL_SpliceArray
+ * 
+ * @param index Index before the splice, not in [first, last)
+ * @param first 
+ * @param last 
+ * @param newFirst 
+ * @param total 
+ * @return uint32_t 
+ */
+static uint32_t _HDL_SpliceIndex (uint32_t index, uint32_t first, uint32_t last, uint32_t newFirst, uint32_t total) {
+    if(index < first) {
+        return index;
+    }
+    if(index >= newFirst) {
+        return first + (index - newFirst);
+    }
+    return index - (last - first) + (total - newFirst);
+}
+
+/**
+ * @brief Replaces an element subtree with the elements parsed after the end of the document
+ * 
+ * Memory of the replaced elements stays in the arena until the document is freed
+ * 
+ * @param doc 
+ * @param first First element of the old subtree
+ * @param last Element after the old subtree
+ * @param newFirst First element of the new subtree, new elements continue to the end of the document
+ * @param newAttrFirst First attribute of the new subtree
+ * @return int 0 on success
+ */
+static int _HDL_SpliceElements (struct HDL_Document *doc, uint32_t first, uint32_t last, uint32_t newFirst, uint32_t newAttrFirst) {
+    uint32_t total = doc->elementCount;
+    uint32_t attrTotal = doc->attrCount;
+    uint32_t attrFirst = doc->elements[first].attrStart;
+    uint32_t attrLast = last < newFirst ? doc->elements[last].attrStart : newAttrFirst;
+
+    size_t scratchSize = (total - newFirst) * sizeof(struct HDL_Element);
+    if(scratchSize < (attrTotal - newAttrFirst) * sizeof(struct HDL_Attr)) {
+        scratchSize = (attrTotal - newAttrFirst) * sizeof(struct HDL_Attr);
+    }
+    uint32_t count = total - (last - first);
+    void *scratch = malloc(scratchSize + 1);
+    uint32_t *depths = malloc(sizeof(uint32_t) * (count + 1));
+    if(scratch == NULL || depths == NULL) {
+        printf("Error: Out of memory\r\n");
+        free(scratch);
+        free(depths);
+        return 1;
+    }
+
+    // Indices stored in the elements
+    for(uint32_t i = 0; i < total; i++) {
+        if(i >= first && i < last) {
+            continue;
+        }
+        if(doc->parents[i] >= 0) {
+            doc->parents[i] = _HDL_SpliceIndex(doc->parents[i], first, last, newFirst, total);
+        }
+        if(doc->elements[i].attrCount > 0) {
+            doc->elements[i].attrStart = _HDL_SpliceIndex(doc->elements[i].attrStart, attrFirst, attrLast, newAttrFirst, attrTotal);
+        }
+    }
+
+    _HDL_SpliceArray(doc->elements, sizeof(struct HDL_Element), first, last, newFirst, total, scratch);
+    _HDL_SpliceArray(doc->contents, sizeof(char*), first, last, newFirst, total, scratch);
+    _HDL_SpliceArray(doc->parents, sizeof(int32_t), first, last, newFirst, total, scratch);
+    _HDL_SpliceArray(doc->spans, sizeof(struct HDL_Span), first, last, newFirst, total, scratch);
+    _HDL_SpliceArray(doc->attrs, sizeof(struct HDL_Attr), attrFirst, attrLast, newAttrFirst, attrTotal, scratch);
+    doc->elementCount = count;
+    doc->attrCount = attrTotal - (attrLast - attrFirst);
+
+    // Replaced subtree may have been the deepest
+    doc->maxDepth = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        depths[i] = doc->parents[i] >= 0 ? depths[doc->parents[i]] + 1 : 1;
+        if(depths[i] > doc->maxDepth) {
+            doc->maxDepth = depths[i];
+        }
+    }
+
+    free(scratch);
+    free(depths);
+    return _HDL_BuildChildIndex(doc);
+}
+
+/**
+ * @brief Parses the new text of an element and replaces the old subtree of the element with it
+ * 
+ * @param doc 
+ * @param index Element containing the change
+ * @param data New input data
+ * @param len Length of the new input data
+ * @param oldLen Length of the old input data
+ * @param changeEnd Offset after the last changed character in the old text
+ * @param edit Replaced elements
+ * @return int 0 on success, document is unchanged on failure
+ */
+static int _HDL_ReparseElement (struct HDL_ParseContext *ctx, struct HDL_Document *doc, uint32_t index, const char *data, uint32_t len, uint32_t oldLen, uint32_t changeEnd, struct HDL_Edit *edit) {
+    // Elements of a subtree are contiguous and inside the span of the subtree root
+    struct HDL_Span span = doc->spans[index];
+    uint32_t last = index + 1;
+    while(last < doc->elementCount && doc->spans[last].start < span.end) {
+        last++;
+    }
+    uint32_t start = span.start;
+    uint32_t end = span.end + len - oldLen;
+
+    // Lex only the text of the element
+    _HDL_FreeBlocks(ctx);
+    ctx->source = data;
+    ctx->source_len = len;
+    ctx->block_list.allocated = (end - start) / 16 + HDL_BLOCKBUFFER_REALLOC_SIZE;
+    ctx->block_list.tokens = malloc(sizeof(struct HDL_Token) * ctx->block_list.allocated);
+    if(ctx->block_list.tokens == NULL) {
+        printf("Error: Out of memory\r\n");
+        return 1;
+    }
+    _HDL_LexInit(&ctx->lexer, &ctx->block_list, ctx->lex_mode);
+    if(_HDL_LexChunk(&ctx->lexer, data + start, end - start, start) || _HDL_LexFinish(&ctx->lexer, data, end)) {
+        _HDL_FreeBlocks(ctx);
+        return 1;
+    }
+
+    uint32_t elementCount = doc->elementCount;
+    uint32_t attrCount = doc->attrCount;
+    uint32_t maxDepth = doc->maxDepth;
+    int32_t parent = doc->parents[index];
+    uint32_t childCount = parent >= 0 ? doc->elements[parent].childCount : 0;
+    uint32_t depth = 0;
+    for(int32_t p = parent; p >= 0; p = doc->parents[p]) {
+        depth++;
+    }
+
+    // New subtree is parsed after the last element, the text must still be exactly one element
+    int blockIndex = 0;
+    int err = _HDL_BlockChar(ctx, 0, 0) != '<'
+        || _HDL_ParseElement(ctx, doc, parent, depth, &blockIndex)
+        || _HDL_BlockExists(ctx, blockIndex)
+        || doc->elementCount == elementCount
+        || doc->spans[elementCount].end != end;
+    _HDL_FreeBlocks(ctx);
+
+    // Element replaces a child, it is not a new one
+    if(parent >= 0) {
+        doc->elements[parent].childCount = childCount;
+    }
+    if(err) {
+        doc->elementCount = elementCount;
+        doc->attrCount = attrCount;
+        doc->maxDepth = maxDepth;
+        return 1;
+    }
+
+    // Text after the change moved
+    int64_t delta = (int64_t)len - oldLen;
+    for(uint32_t i = 0; i < elementCount; i++) {
+        if(i >= index && i < last) {
+            continue;
+        }
+        if(doc->spans[i].start >= changeEnd) {
+            doc->spans[i].start += delta;
+        }
+        if(doc->spans[i].end >= changeEnd) {
+            doc->spans[i].end += delta;
+        }
+    }
+
+    edit->full = 0;
+    edit->element = index;
+    edit->oldCount = last - index;
+    edit->newCount = doc->elementCount - elementCount;
+    return _HDL_SpliceElements(doc, index, last, elementCount, attrCount);
+}
+
+/**
+ * @brief Parses the input again after an edit
+ * 
+ * The old and new text are compared, if the change is inside one element only that element
+ * is parsed again and replaced in the document. Changes to definitions or outside the root element
+ * parse the whole document again
+ * 
+ * @param doc Document parsed from the old text, replaced on success and unchanged on failure
+ * @param old Text the document was parsed from
+ * @param oldLen Length of the old text
+ * @param data New text
+ * @param len Length of the new text
+ * @param edit Elements that changed
+ * @return int 0 on success
+ */
+int HDL_Reparse (struct HDL_ParseContext *ctx, struct HDL_Document *doc, const char *old, size_t oldLen, const char *data, size_t len, struct HDL_Edit *edit) {
+    memset(edit, 0, sizeof(struct HDL_Edit));
+    if(len > UINT32_MAX || oldLen > UINT32_MAX) {
+        printf("Error: Input too large\r\n");
+        return 1;
+    }
+
+    // Changed range is what is left after the common prefix and suffix
+    size_t minLen = oldLen < len ? oldLen : len;
+    size_t prefix = 0;
+    while(prefix < minLen && old[prefix] == data[prefix]) {
+        prefix++;
+    }
+    if(prefix == oldLen && oldLen == len) {
+        return 0;
+    }
+    size_t suffix = 0;
+    while(suffix < minLen - prefix && old[oldLen - 1 - suffix] == data[len - 1 - suffix]) {
+        suffix++;
+    }
+
+    int32_t index = _HDL_FindEditedElement(doc, prefix, oldLen - suffix);
+    if(index >= 0 && _HDL_ReparseElement(ctx, doc, index, data, len, oldLen, oldLen - suffix, edit) == 0) {
+        return 0;
+    }
+
+    // Parse everything, old document is kept if the new text does not parse
+    struct HDL_Document n_doc;
+    if(HDL_Parse(ctx, data, len, &n_doc)) {
+        HDL_DocumentFree(&n_doc);
+        return 1;
+    }
+    edit->full = 1;
+    edit->element = 0;
+    edit->oldCount = doc->elementCount;
+    edit->newCount = n_doc.elementCount;
+    HDL_DocumentFree(doc);
+    *doc = n_doc;
+    // Symbol table points to the arena of the document
+    doc->symbols.arena = &doc->arena;
+    return 0;
+}
+
 void HDL_PrintElement (struct HDL_Document *doc, struct HDL_Element *element, int depth) {
     for(int i = 0; i < depth * 2; i++) {
         printf(" ");
     }
 
-    printf("%s: %s ", element->tag, element->content);
+    printf("%s: %s ", HDL_SymbolName(&doc->symbols, element->tag), doc->contents[element - doc->elements]);
     if(element->attrCount > 0) {
         printf("[");
     }
     for(int i = 0; i < element->attrCount; i++) {
-        struct HDL_Attr *attr = &element->attrs[i];
-        printf("%s = ", attr->key);
+        struct HDL_Attr *attr = &doc->attrs[element->attrStart + i];
+        printf("%s = ", HDL_SymbolName(&doc->symbols, attr->key));
         if(attr->count > 1) {
             printf("[");
         }
@@ -1098,6 +3686,9 @@ void HDL_PrintElement (struct HDL_Document *doc, struct HDL_Element *element, in
             case HDL_TYPE_I8:
             case HDL_TYPE_I16:
             case HDL_TYPE_I32:
+            case HDL_TYPE_I64:
+            case HDL_TYPE_U8:
+            case HDL_TYPE_U16:
             {
                 for(int i = 0; i < attr->count; i++) {
                     switch(attr->type) {
@@ -1113,6 +3704,17 @@ void HDL_PrintElement (struct HDL_Document *doc, struct HDL_Element *element, in
                         case HDL_TYPE_I32:
                             printf("%i", (((int32_t*)attr->value)[i]));
                             break;
+                        case HDL_TYPE_I64:
+                            printf("%lld", (long long)(((int64_t*)attr->value)[i]));
+                            break;
+                        case HDL_TYPE_U8:
+                            printf("%u", (((uint8_t*)attr->value)[i]));
+                            break;
+                        case HDL_TYPE_U16:
+                            printf("%u", (((uint16_t*)attr->value)[i]));
+                            break;
+                        default:
+                            break;
                     }
                     if(i < attr->count - 1) {
                         printf(", ");
@@ -1125,6 +3727,18 @@ void HDL_PrintElement (struct HDL_Document *doc, struct HDL_Element *element, in
                 printf("\"%s\"", (const char *)attr->value);
                 break;
             }
+            case HDL_TYPE_IMG:
+            {
+                printf("img %u", *(uint32_t*)attr->value);
+                break;
+            }
+            case HDL_TYPE_BIND:
+            {
+                printf("$%u", *(uint8_t*)attr->value);
+                break;
+            }
+            default:
+                break;
         }
         if(attr->count > 1) {
             printf("]");
@@ -1139,7 +3753,7 @@ void HDL_PrintElement (struct HDL_Document *doc, struct HDL_Element *element, in
     printf("\r\n");
 
     for(int i = 0; i < element->childCount; i++) {
-        HDL_PrintElement(doc, &doc->elements[element->children[i]], depth + 1);
+        HDL_PrintElement(doc, &doc->elements[doc->children[element->childStart + i]], depth + 1);
     }
 }
 
@@ -1163,6 +3777,9 @@ void HDL_PrintVars (struct HDL_Document *doc) {
             case HDL_TYPE_I8:
             case HDL_TYPE_I16:
             case HDL_TYPE_I32:
+            case HDL_TYPE_I64:
+            case HDL_TYPE_U8:
+            case HDL_TYPE_U16:
             {
                 for(int i = 0; i < _var->count; i++) {
                     switch(_var->type) {
@@ -1178,6 +3795,17 @@ void HDL_PrintVars (struct HDL_Document *doc) {
                         case HDL_TYPE_I32:
                             printf("%i", (((int32_t*)_var->value)[i]));
                             break;
+                        case HDL_TYPE_I64:
+                            printf("%lld", (long long)(((int64_t*)_var->value)[i]));
+                            break;
+                        case HDL_TYPE_U8:
+                            printf("%u", (((uint8_t*)_var->value)[i]));
+                            break;
+                        case HDL_TYPE_U16:
+                            printf("%u", (((uint16_t*)_var->value)[i]));
+                            break;
+                        default:
+                            break;
                     }
                     if(i < _var->count - 1) {
                         printf(", ");
@@ -1190,6 +3818,18 @@ void HDL_PrintVars (struct HDL_Document *doc) {
                 printf("\"%s\"", (const char *)_var->value);
                 break;
             }
+            case HDL_TYPE_IMG:
+            {
+                printf("img %u", *(uint32_t*)_var->value);
+                break;
+            }
+            case HDL_TYPE_BIND:
+            {
+                printf("$%u", *(uint8_t*)_var->value);
+                break;
+            }
+            default:
+                break;
         }
 
         printf(", ");
@@ -1,9 +1,11 @@
 #ifndef _HDL_PARSE_H
 #define _HDL_PARSE_H
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "hdl-arena.h"
+#include "hdl-symbol.h"
 
-// Maximum tagname length
-#define HDL_TAG_MAX_LENGTH          32
 // Maximum string length of an attribute key
 #define HDL_ATTR_KEY_MAX_LENGTH     32
 
@@ -18,6 +20,10 @@ enum HDL_Type {
     HDL_TYPE_I32        = 6,
     HDL_TYPE_IMG        = 7,
     HDL_TYPE_BIND       = 8,
+    HDL_TYPE_I64        = 9,
+    // Unsigned types are only written by the compiler, for values that fit them
+    HDL_TYPE_U8         = 10,
+    HDL_TYPE_U16        = 11,
 
     // Tell's how many types have been defined
     HDL_TYPE_COUNT
@@ -25,18 +31,155 @@ enum HDL_Type {
 
 extern uint8_t HDL_TYPE_SIZES[HDL_TYPE_COUNT];
 
+// Token kinds
+enum HDL_TokenKind {
+    // End of input
+    HDL_TOKEN_EOF       = 0,
+    // Single delimiter character
+    HDL_TOKEN_DELIMITER = 1,
+    // Name, number or other unquoted value
+    HDL_TOKEN_WORD      = 2,
+    // Quoted string, quotes included
+    HDL_TOKEN_STRING    = 3,
+    // Element content
+    HDL_TOKEN_CONTENT   = 4,
+    // Integer literal, decimal or 0x hex
+    HDL_TOKEN_INT       = 5,
+    // Decimal literal with a point
+    HDL_TOKEN_FLOAT     = 6
+};
+
+// Token, a span in the input data
+struct HDL_Token {
+    // Offset of the span in the input
+    uint32_t offset;
+    // Length of the span in the input
+    uint32_t length;
+    // Token kind (HDL_TokenKind)
+    uint8_t kind;
+    // Quote state at the start of the span
+    uint8_t quotes;
+    // Span has escapes or skipped whitespace, text must be decoded
+    uint8_t decode;
+};
+
+// Lexer fast path for runs of plain characters
+enum HDL_LexMode {
+    // Character by character
+    HDL_LEX_NONE,
+    // Scalar class table loop
+    HDL_LEX_SCALAR,
+    // 16 bytes at a time
+    HDL_LEX_SSE2,
+    // 32 bytes at a time
+    HDL_LEX_AVX2,
+    // Best supported by the CPU
+    HDL_LEX_AUTO
+};
+
+// Growable array of tokens
+struct HDL_TokenList {
+    struct HDL_Token *tokens;
+    uint32_t count;
+    // Count allocated (for block reallocation)
+    uint32_t allocated;
+};
+
+// Skip functions of a lexer mode, return the number of plain characters at the start of data
+struct HDL_LexSkip {
+    // Outside quotes
+    uint32_t (*word)(const char *data, uint32_t len);
+    // In quotes and element content
+    uint32_t (*text)(const char *data, uint32_t len);
+};
+
+// Lexer state, carried over chunk boundaries when streaming
+struct HDL_Lexer {
+    // Currently open block
+    struct HDL_Token block;
+    // Block is open
+    uint8_t open;
+    // 0 = not in quotes 1 = in single quotes 2 = in double quotes 3 = in element content
+    uint8_t inquotes;
+    // Last character lexed
+    char lastChar;
+    // Fast path for runs of plain characters
+    struct HDL_LexSkip skip;
+    // Blocks are pushed here
+    struct HDL_TokenList *out;
+    // Blocks of the same chunk lexed from the start of a line, NULL if not speculating
+    const struct HDL_TokenList *primary;
+    // Next primary block to compare against
+    uint32_t primary_pos;
+    // Index of the primary delimiter the lexer converged on, UINT32_MAX if not converged
+    uint32_t converged;
+};
+
+struct HDL_ModuleCache;
+struct HDL_Module;
+
+// State of a parse. Every parse and bitmap load goes through a context,
+// so documents can be parsed in parallel with one context per thread
+struct HDL_ParseContext {
+    // Directory of the input file with a trailing '/', relative image paths are resolved from here
+    char input_path[128];
+
+    // Lexer fast path mode
+    enum HDL_LexMode lex_mode;
+    // Number of lexer threads, 0 = one per CPU
+    int lex_threads;
+
+    // Input data, not owned by the parser (may be memory mapped) unless streaming
+    const char *source;
+    // Length of the input data
+    uint32_t source_len;
+    // Offset of the input data in the whole input, input before it has been dropped while streaming
+    uint32_t source_base;
+    // Streamed input file, NULL when parsing data in memory
+    FILE *stream;
+    // Buffer for the streamed input, holds the live blocks and the last chunk
+    char *stream_buffer;
+    // Allocated size of the stream buffer
+    uint32_t stream_allocated;
+    // All of the input has been lexed
+    uint8_t stream_eof;
+    // Reading or lexing the stream failed
+    uint8_t stream_error;
+    // Index of the first block in the block array, blocks before it have been dropped
+    uint32_t block_base;
+    // Highest block index requested by the parser
+    uint32_t block_max;
+    // Array of tokens (blocks), spans in the input data
+    struct HDL_TokenList block_list;
+    // Scratch buffer for decoded block text
+    char *scratch;
+    // Allocated size of the scratch buffer
+    uint32_t scratch_allocated;
+    // Lexer of the input
+    struct HDL_Lexer lexer;
+
+    // Cache of included modules, shared between contexts. NULL to parse every include
+    struct HDL_ModuleCache *modules;
+    // Module being parsed, files it loads are recorded as its dependencies. NULL when parsing a page
+    struct HDL_Module *module;
+    // Nesting depth of included modules
+    uint32_t include_depth;
+    // Context of the file that includes the file being parsed, NULL when parsing a page. Forms the include stack
+    struct HDL_ParseContext *includer;
+};
+
 // Attribute (key=value)
 struct HDL_Attr {
 
-    // Key 
-    char key[HDL_ATTR_KEY_MAX_LENGTH];
     // Attribute value
     void *value;
+    // Key, symbol id of the name
+    uint32_t key;
     // Attribute type
     enum HDL_Type type;
 
     // Count (if array)
-    uint8_t count;
+    uint32_t count;
 };
 
 // Variable/definition
@@ -49,36 +192,49 @@ struct HDL_Variable {
     // Variable type
     enum HDL_Type type;
     // Count (if array)
-    uint8_t count;
+    uint32_t count;
     // Is constant
     uint8_t isConst;
+    // Module the variable was merged from, index in HDL_Document.includes + 1. 0 if defined in the document
+    uint32_t module;
 };
 
 
-// Element structure
+// Element structure, only the fields needed to walk the tree. 
+// Content and parent are kept in separate document arrays
 struct HDL_Element {
 
-    // Tag
-    char tag[HDL_TAG_MAX_LENGTH];
+    // Tag, symbol id of the name
+    uint32_t tag;
 
-    // Content string
-    char *content;
-
-    // Attributes
-    struct HDL_Attr *attrs;
-    uint8_t attrCount;
-    uint8_t attrAllocCount;
+    // First attribute in the document attribute pool
+    uint32_t attrStart;
 
-    // Parent index, -1 if root
-    int parent;
+    // First child in the document child index array, children are stored in document order
+    uint32_t childStart;
+    uint32_t childCount;
 
-    // Array of children indices, can't be a pointer because document elements array might be reallocated
-    uint16_t *children;
-    uint16_t childCount;
-    uint16_t childAllocCount;
+    uint32_t attrCount;
     
 };
 
+// Text of an element in the input, from its '<' to the end of its closing tag
+struct HDL_Span {
+    uint32_t start;
+    uint32_t end;
+};
+
+// Elements replaced by an incremental re-parse, see HDL_Reparse
+struct HDL_Edit {
+    // Whole document was parsed again
+    uint8_t full;
+    // First replaced element, elements before it are unchanged
+    uint32_t element;
+    // Number of elements replaced and number of elements replacing them
+    uint32_t oldCount;
+    uint32_t newCount;
+};
+
 // HDL Colorspace 
 enum HDL_ColorSpace {
     HDL_COLORS_UNKNOWN,
@@ -93,14 +249,16 @@ enum HDL_ColorSpace {
 
 struct HDL_Bitmap {
     char name[32];
-    uint16_t id;
-    uint16_t size;
+    uint32_t id;
+    uint32_t size;
     uint16_t width;
     uint16_t height;
-    uint8_t sprite_width;
-    uint8_t sprite_height;
+    uint16_t sprite_width;
+    uint16_t sprite_height;
     uint8_t colorMode;
     uint8_t *data;
+    // Module the bitmap was merged from, index in HDL_Document.includes + 1. 0 if defined in the document
+    uint32_t module;
 };
 
 // Document structure 
@@ -108,21 +266,58 @@ struct HDL_Document {
 
     // Elements
     struct HDL_Element *elements;
-    uint16_t elementCount;
-    uint16_t elementAllocCount;
+    uint32_t elementCount;
+    uint32_t elementAllocCount;
+    // Deepest nesting of elements, root is 1
+    uint32_t maxDepth;
+
+    // Element content strings, NULL if no content
+    char **contents;
+    // Element parent indices, -1 if root
+    int32_t *parents;
+    // Element source spans, used to re-parse only the edited element
+    struct HDL_Span *spans;
+
+    // Attributes of all elements, attributes of an element are contiguous
+    struct HDL_Attr *attrs;
+    uint32_t attrCount;
+    uint32_t attrAllocCount;
+
+    // Child indices of all elements, indexed by HDL_Element.childStart
+    uint32_t *children;
+    uint32_t childAllocCount;
 
     // Variables
     struct HDL_Variable *vars;
-    uint16_t varCount;
-    uint16_t varAllocCount;
+    uint32_t varCount;
+    uint32_t varAllocCount;
 
     // Bitmaps
     struct HDL_Bitmap *bitmaps;
-    uint16_t bitmapCount;
-    uint16_t bitmapAllocCount;
+    uint32_t bitmapCount;
+    uint32_t bitmapAllocCount;
+
+    // Paths of the modules merged into the document and of the modules they include, a module is merged once
+    char **includes;
+    uint32_t includeCount;
+    uint32_t includeAllocCount;
+
+    // Names of variables, bitmaps, tags and attribute keys
+    struct HDL_SymbolTable symbols;
+
+    // Memory of the document, freed with HDL_DocumentFree
+    struct HDL_Arena arena;
 };
 
-int HDL_Parse (char *data, struct HDL_Document *doc);
+void HDL_ParseContextInit (struct HDL_ParseContext *ctx, const char *filename);
+int HDL_Parse (struct HDL_ParseContext *ctx, const char *data, size_t len, struct HDL_Document *doc);
+int HDL_ParseFile (struct HDL_ParseContext *ctx, FILE *file, struct HDL_Document *doc);
+int HDL_Reparse (struct HDL_ParseContext *ctx, struct HDL_Document *doc, const char *old, size_t oldLen, const char *data, size_t len, struct HDL_Edit *edit);
+int HDL_Tokenize (struct HDL_ParseContext *ctx, const char *data, size_t len, struct HDL_Token **tokens_out, uint32_t *count_out);
+int HDL_SetLexMode (struct HDL_ParseContext *ctx, enum HDL_LexMode mode);
+int HDL_SetLexThreads (struct HDL_ParseContext *ctx, int threads);
+void HDL_SetModuleCache (struct HDL_ParseContext *ctx, struct HDL_ModuleCache *cache);
+void HDL_DocumentFree (struct HDL_Document *doc);
 void HDL_PrintElement (struct HDL_Document *doc, struct HDL_Element *element, int depth);
 void HDL_PrintVars (struct HDL_Document *doc);
 
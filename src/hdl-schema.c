@@ -0,0 +1,391 @@
+#include "hdl-schema.h"
+#include "hdl-parse.h"
+#include "hdl-module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initial number of entries of a table
+#define HDL_SCHEMA_INITIAL_SIZE     16
+// Seeds tried for a bucket before the hash is given up on
+#define HDL_SCHEMA_MAX_SEED         65536
+// Longest schema file
+#define HDL_SCHEMA_MAX_FILE_SIZE    (1 << 20)
+
+// Value types of attributes
+static const struct {
+    const char *name;
+    enum HDL_Type type;
+    enum HDL_AttrEncoding encoding;
+} schema_types[] = {
+    { "int",    HDL_TYPE_I32,       HDL_ATTR_ENC_INT },
+    { "bool",   HDL_TYPE_BOOL,      HDL_ATTR_ENC_BYTE },
+    { "bind",   HDL_TYPE_BIND,      HDL_ATTR_ENC_BYTE },
+    { "img",    HDL_TYPE_IMG,       HDL_ATTR_ENC_UINT },
+    { "string", HDL_TYPE_STRING,    HDL_ATTR_ENC_STRING },
+    { "any",    HDL_TYPE_NULL,      HDL_ATTR_ENC_TYPED }
+};
+
+/**
+ * @brief Hashes a name with a seed
+ *
+ * @param name
+ * @param len
+ * @param seed
+ * @return uint32_t
+ */
+static uint32_t _HDL_SchemaHash (const char *name, size_t len, uint32_t seed) {
+    uint64_t h = HDL_Hash(name, len, HDL_HASH_INIT ^ (seed * 0x9E3779B97F4A7C15ull));
+    // FNV-1a mixes the last bytes poorly, short names differ in them
+    h ^= h >> 32;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+struct HDL_SchemaEntry *HDL_SchemaFind (const struct HDL_SchemaTable *table, const char *name, size_t len) {
+    if(table->count == 0 || table->seeds == NULL) {
+        return NULL;
+    }
+    uint32_t bucket = _HDL_SchemaHash(name, len, 0) % table->count;
+    struct HDL_SchemaEntry *entry = &table->entries[_HDL_SchemaHash(name, len, table->seeds[bucket]) % table->count];
+    if(entry->length != len || memcmp(entry->name, name, len) != 0) {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * @brief Builds the perfect hash of a table, buckets are placed largest first with the first seed that fits them
+ *
+ * @param table
+ * @return int 0 on success
+ */
+static int _HDL_SchemaBuild (struct HDL_SchemaTable *table) {
+    uint32_t n = table->count;
+    memset(table->byId, 0, sizeof(table->byId));
+    if(n == 0) {
+        return 0;
+    }
+
+    uint32_t *bucket = malloc(sizeof(uint32_t) * n);
+    uint32_t *sizes = calloc(n, sizeof(uint32_t));
+    uint32_t *order = malloc(sizeof(uint32_t) * n);
+    uint32_t *slots = malloc(sizeof(uint32_t) * n);
+    uint8_t *used = calloc(n, 1);
+    struct HDL_SchemaEntry *entries = malloc(sizeof(struct HDL_SchemaEntry) * n);
+    table->seeds = calloc(n, sizeof(uint32_t));
+    int err = bucket == NULL || sizes == NULL || order == NULL || slots == NULL || used == NULL || entries == NULL || table->seeds == NULL;
+    if(err) {
+        printf("Error: Out of memory\r\n");
+    }
+
+    for(uint32_t i = 0; !err && i < n; i++) {
+        bucket[i] = _HDL_SchemaHash(table->entries[i].name, table->entries[i].length, 0) % n;
+        sizes[bucket[i]]++;
+    }
+    // Buckets by size, largest first
+    for(uint32_t i = 0; !err && i < n; i++) {
+        uint32_t j = i;
+        while(j > 0 && sizes[order[j - 1]] < sizes[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for(uint32_t o = 0; !err && o < n && sizes[order[o]] > 0; o++) {
+        uint32_t b = order[o];
+        uint32_t seed = 1;
+        for(; seed < HDL_SCHEMA_MAX_SEED; seed++) {
+            uint32_t placed = 0;
+            for(uint32_t i = 0; i < n; i++) {
+                if(bucket[i] != b) {
+                    continue;
+                }
+                uint32_t slot = _HDL_SchemaHash(table->entries[i].name, table->entries[i].length, seed) % n;
+                if(used[slot]) {
+                    break;
+                }
+                used[slot] = 1;
+                slots[i] = slot;
+                placed++;
+            }
+            if(placed == sizes[b]) {
+                break;
+            }
+            // Undo a partial placement
+            for(uint32_t i = 0; i < n && placed > 0; i++) {
+                if(bucket[i] == b) {
+                    used[slots[i]] = 0;
+                    placed--;
+                }
+            }
+        }
+        if(seed == HDL_SCHEMA_MAX_SEED) {
+            printf("Error: Could not build the schema hash\r\n");
+            err = 1;
+        }
+        table->seeds[b] = seed;
+    }
+
+    if(!err) {
+        for(uint32_t i = 0; i < n; i++) {
+            entries[slots[i]] = table->entries[i];
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->allocCount = n;
+        entries = NULL;
+        for(uint32_t i = 0; i < n; i++) {
+            table->byId[table->entries[i].id] = &table->entries[i];
+        }
+    }
+
+    free(bucket);
+    free(sizes);
+    free(order);
+    free(slots);
+    free(used);
+    free(entries);
+    return err;
+}
+
+/**
+ * @brief Reads the next word of a line, a word in quotes may have spaces
+ *
+ * @param p Advanced past the word
+ * @param end End of the line
+ * @param len_out Length of the word
+ * @return const char* Word, NULL if the line has no more words
+ */
+static const char *_HDL_SchemaWord (const char **p, const char *end, size_t *len_out) {
+    const char *s = *p;
+    while(s < end && (*s == ' ' || *s == '\t' || *s == '\r')) {
+        s++;
+    }
+    if(s >= end || *s == '#') {
+        *p = end;
+        return NULL;
+    }
+    const char *e = s;
+    if(*s == '"') {
+        s++;
+        e = memchr(s, '"', end - s);
+        if(e == NULL) {
+            e = end;
+        }
+        *p = e < end ? e + 1 : end;
+    }
+    else {
+        while(e < end && *e != ' ' && *e != '\t' && *e != '\r' && *e != '#') {
+            e++;
+        }
+        *p = e;
+    }
+    *len_out = e - s;
+    return s;
+}
+
+/**
+ * @brief Parses an integer word
+ *
+ * @param word
+ * @param len
+ * @param value_out
+ * @return int 0 on success
+ */
+static int _HDL_SchemaInt (const char *word, size_t len, int64_t *value_out) {
+    char buffer[32];
+    if(len == 0 || len >= sizeof(buffer)) {
+        return 1;
+    }
+    memcpy(buffer, word, len);
+    buffer[len] = 0;
+    char *end = NULL;
+    *value_out = strtoll(buffer, &end, 0);
+    return *end != 0;
+}
+
+/**
+ * @brief Parses one declaration and adds it to its table
+ *
+ * @param schema
+ * @param line
+ * @param end End of the line
+ * @param filename
+ * @param lineNumber
+ * @return int 0 on success
+ */
+static int _HDL_SchemaLine (struct HDL_Schema *schema, const char *line, const char *end, const char *filename, uint32_t lineNumber) {
+    const char *p = line;
+    size_t len = 0;
+    const char *kind = _HDL_SchemaWord(&p, end, &len);
+    if(kind == NULL) {
+        // Empty line or comment
+        return 0;
+    }
+    struct HDL_SchemaTable *table = NULL;
+    if(len == 3 && memcmp(kind, "tag", 3) == 0) {
+        table = &schema->tags;
+    }
+    else if(len == 4 && memcmp(kind, "attr", 4) == 0) {
+        table = &schema->attrs;
+    }
+    else {
+        printf("Error: %s:%u: Expected 'tag' or 'attr'\r\n", filename, lineNumber);
+        return 1;
+    }
+
+    struct HDL_SchemaEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    const char *name = _HDL_SchemaWord(&p, end, &len);
+    if(name == NULL || len >= HDL_SCHEMA_NAME_MAX_LENGTH) {
+        printf("Error: %s:%u: Expected a name of at most %i characters\r\n", filename, lineNumber, HDL_SCHEMA_NAME_MAX_LENGTH - 1);
+        return 1;
+    }
+    memcpy(entry.name, name, len);
+    entry.length = len;
+
+    int64_t id = 0;
+    const char *word = _HDL_SchemaWord(&p, end, &len);
+    if(word == NULL || _HDL_SchemaInt(word, len, &id) || id < 0 || id > HDL_SCHEMA_MAX_ID) {
+        printf("Error: %s:%u: Expected an id from 0 to %i\r\n", filename, lineNumber, HDL_SCHEMA_MAX_ID);
+        return 1;
+    }
+    entry.id = id;
+
+    if(table == &schema->attrs) {
+        word = _HDL_SchemaWord(&p, end, &len);
+        int t = 0;
+        int typeCount = sizeof(schema_types) / sizeof(schema_types[0]);
+        while(word != NULL && t < typeCount && (strlen(schema_types[t].name) != len || memcmp(schema_types[t].name, word, len) != 0)) {
+            t++;
+        }
+        if(word == NULL || t == typeCount) {
+            printf("Error: %s:%u: Expected a type: int, bool, bind, img, string or any\r\n", filename, lineNumber);
+            return 1;
+        }
+        entry.type = schema_types[t].type;
+        entry.encoding = schema_types[t].encoding;
+
+        word = _HDL_SchemaWord(&p, end, &len);
+        if(word != NULL) {
+            entry.hasDefault = 1;
+            int bad = 0;
+            if(entry.type == HDL_TYPE_I32) {
+                bad = _HDL_SchemaInt(word, len, &entry.defaultInt);
+            }
+            else if(entry.type == HDL_TYPE_BOOL) {
+                bad = !((len == 4 && memcmp(word, "true", 4) == 0) || (len == 5 && memcmp(word, "false", 5) == 0));
+                entry.defaultInt = len == 4;
+            }
+            else if(entry.type == HDL_TYPE_STRING && len < HDL_SCHEMA_NAME_MAX_LENGTH) {
+                memcpy(entry.defaultString, word, len);
+            }
+            else {
+                bad = 1;
+            }
+            if(bad) {
+                printf("Error: %s:%u: Invalid default value\r\n", filename, lineNumber);
+                return 1;
+            }
+        }
+    }
+    if(_HDL_SchemaWord(&p, end, &len) != NULL) {
+        printf("Error: %s:%u: Unexpected value after the declaration\r\n", filename, lineNumber);
+        return 1;
+    }
+
+    for(uint32_t i = 0; i < table->count; i++) {
+        if(table->entries[i].length == entry.length && memcmp(table->entries[i].name, entry.name, entry.length) == 0) {
+            printf("Error: %s:%u: '%s' declared twice\r\n", filename, lineNumber, entry.name);
+            return 1;
+        }
+        if(table->entries[i].id == entry.id) {
+            printf("Error: %s:%u: Id %u of '%s' is used by '%s'\r\n", filename, lineNumber, entry.id, entry.name, table->entries[i].name);
+            return 1;
+        }
+    }
+    if(table->count >= table->allocCount) {
+        uint32_t n_alloc = table->allocCount ? table->allocCount * 2 : HDL_SCHEMA_INITIAL_SIZE;
+        struct HDL_SchemaEntry *n_entries = realloc(table->entries, sizeof(struct HDL_SchemaEntry) * n_alloc);
+        if(n_entries == NULL) {
+            printf("Error: Out of memory\r\n");
+            return 1;
+        }
+        table->entries = n_entries;
+        table->allocCount = n_alloc;
+    }
+    table->entries[table->count++] = entry;
+    if(entry.id + 1u > table->idCount) {
+        table->idCount = entry.id + 1;
+    }
+    return 0;
+}
+
+int HDL_SchemaLoad (struct HDL_Schema *schema, const char *data, size_t len, const char *filename) {
+    memset(schema, 0, sizeof(struct HDL_Schema));
+    const char *end = data + len;
+    uint32_t lineNumber = 1;
+    while(data < end) {
+        const char *eol = memchr(data, '\n', end - data);
+        if(eol == NULL) {
+            eol = end;
+        }
+        if(_HDL_SchemaLine(schema, data, eol, filename, lineNumber)) {
+            HDL_SchemaFree(schema);
+            return 1;
+        }
+        data = eol + 1;
+        lineNumber++;
+    }
+    if(_HDL_SchemaBuild(&schema->tags) || _HDL_SchemaBuild(&schema->attrs)) {
+        HDL_SchemaFree(schema);
+        return 1;
+    }
+    return 0;
+}
+
+int HDL_SchemaLoadFile (struct HDL_Schema *schema, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        printf("Error: Could not open schema file %s\r\n", path);
+        return 1;
+    }
+    char *data = malloc(HDL_SCHEMA_MAX_FILE_SIZE);
+    if(data == NULL) {
+        printf("Error: Out of memory\r\n");
+        fclose(file);
+        return 1;
+    }
+    size_t len = fread(data, 1, HDL_SCHEMA_MAX_FILE_SIZE, file);
+    int err = ferror(file) || !feof(file);
+    fclose(file);
+    if(err) {
+        printf("Error: Could not read schema file %s\r\n", path);
+        free(data);
+        return 1;
+    }
+    err = HDL_SchemaLoad(schema, data, len, path);
+    free(data);
+    return err;
+}
+
+/**
+ * @brief Frees a table
+ *
+ * @param table
+ */
+static void _HDL_SchemaTableFree (struct HDL_SchemaTable *table) {
+    if(table->entries != NULL)
+        free(table->entries);
+    if(table->seeds != NULL)
+        free(table->seeds);
+    memset(table, 0, sizeof(struct HDL_SchemaTable));
+}
+
+void HDL_SchemaFree (struct HDL_Schema *schema) {
+    _HDL_SchemaTableFree(&schema->tags);
+    _HDL_SchemaTableFree(&schema->attrs);
+}
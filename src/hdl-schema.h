@@ -0,0 +1,89 @@
+#ifndef _HDL_SCHEMA
+#define _HDL_SCHEMA
+#include <stdint.h>
+#include <stddef.h>
+#include "hdl-decode.h"
+
+// Maximum length of a tag or attribute name
+#define HDL_SCHEMA_NAME_MAX_LENGTH  32
+// Ids are written as a byte, 0xFF is the id of unknown names
+#define HDL_SCHEMA_MAX_ID           254
+
+// Declared tag or attribute
+struct HDL_SchemaEntry {
+    char name[HDL_SCHEMA_NAME_MAX_LENGTH];
+    uint32_t length;
+    // Id written to the output
+    uint8_t id;
+    // Value type of an attribute (HDL_Type), HDL_TYPE_NULL if values of any type are written with their type
+    uint8_t type;
+    // Value encoding of an attribute in the compact format
+    enum HDL_AttrEncoding encoding;
+    // Attributes set to the default value are not written
+    uint8_t hasDefault;
+    int64_t defaultInt;
+    char defaultString[HDL_SCHEMA_NAME_MAX_LENGTH];
+};
+
+// Tags or attributes with a minimal perfect hash of their names
+struct HDL_SchemaTable {
+    // Entries, in hash slot order once the table is built
+    struct HDL_SchemaEntry *entries;
+    uint32_t count;
+    uint32_t allocCount;
+    // Seed of each bucket, the name of a bucket is in slot hash(name, seed) % count
+    uint32_t *seeds;
+    // Entry of each id, NULL if not declared
+    struct HDL_SchemaEntry *byId[HDL_SCHEMA_MAX_ID + 1];
+    // Highest id + 1
+    uint32_t idCount;
+};
+
+// Tag and attribute vocabulary of the compiler
+struct HDL_Schema {
+    struct HDL_SchemaTable tags;
+    struct HDL_SchemaTable attrs;
+};
+
+/**
+ * @brief Loads a schema from text
+ *
+ * One declaration per line, # starts a comment:
+ *  tag <name> <id>
+ *  attr <name> <id> <type> [default]
+ * Types are int, bool, bind, img, string and any (written with a type byte)
+ *
+ * @param schema
+ * @param data
+ * @param len
+ * @param filename Name shown in errors
+ * @return int 0 on success
+ */
+int HDL_SchemaLoad (struct HDL_Schema *schema, const char *data, size_t len, const char *filename);
+
+/**
+ * @brief Loads a schema file
+ *
+ * @param schema
+ * @param path
+ * @return int 0 on success
+ */
+int HDL_SchemaLoadFile (struct HDL_Schema *schema, const char *path);
+
+/**
+ * @brief Frees a schema
+ *
+ * @param schema
+ */
+void HDL_SchemaFree (struct HDL_Schema *schema);
+
+/**
+ * @brief Finds a tag or attribute, in constant time
+ *
+ * @param table
+ * @param name Name, does not need to be null terminated
+ * @param len Length of the name
+ * @return struct HDL_SchemaEntry* NULL if not declared
+ */
+struct HDL_SchemaEntry *HDL_SchemaFind (const struct HDL_SchemaTable *table, const char *name, size_t len);
+#endif
@@ -0,0 +1,165 @@
+#include "hdl-symbol.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Initial number of symbols
+#define HDL_SYMBOLS_INITIAL_SIZE        64
+// Initial size of the string pool
+#define HDL_SYMBOL_STRINGS_INITIAL_SIZE 1024
+
+/**
+ * @brief FNV-1a hash of a name
+ *
+ * @param name
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t _HDL_SymbolHash (const char *name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int HDL_SymbolsInit (struct HDL_SymbolTable *table, struct HDL_Arena *arena) {
+    memset(table, 0, sizeof(struct HDL_SymbolTable));
+    table->arena = arena;
+
+    table->allocCount = HDL_SYMBOLS_INITIAL_SIZE;
+    table->symbols = HDL_ArenaAlloc(arena, sizeof(struct HDL_Symbol) * table->allocCount);
+
+    table->stringAllocSize = HDL_SYMBOL_STRINGS_INITIAL_SIZE;
+    table->strings = HDL_ArenaAlloc(arena, table->stringAllocSize);
+
+    // Index is kept at most half full
+    table->indexSize = HDL_SYMBOLS_INITIAL_SIZE * 2;
+    table->index = HDL_ArenaAlloc(arena, sizeof(uint32_t) * table->indexSize);
+
+    if(table->symbols == NULL || table->strings == NULL || table->index == NULL) {
+        // Out of memory
+        return 1;
+    }
+    memset(table->index, 0, sizeof(uint32_t) * table->indexSize);
+    return 0;
+}
+
+/**
+ * @brief Finds the index slot of a name
+ *
+ * @param table
+ * @param name
+ * @param len
+ * @param hash Hash of the name
+ * @return uint32_t Slot, empty if the name is not in the table
+ */
+static uint32_t _HDL_SymbolSlot (struct HDL_SymbolTable *table, const char *name, uint32_t len, uint32_t hash) {
+    uint32_t mask = table->indexSize - 1;
+    uint32_t slot = hash & mask;
+    while(table->index[slot] != 0) {
+        struct HDL_Symbol *symbol = &table->symbols[table->index[slot] - 1];
+        if(symbol->hash == hash && symbol->length == len && memcmp(table->strings + symbol->name, name, len) == 0) {
+            break;
+        }
+        // Linear probing
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * @brief Doubles the hash index
+ *
+ * @param table
+ * @return int 0 on success
+ */
+static int _HDL_SymbolGrowIndex (struct HDL_SymbolTable *table) {
+    uint32_t n_size = table->indexSize * 2;
+    uint32_t *n_index = HDL_ArenaAlloc(table->arena, sizeof(uint32_t) * n_size);
+    if(n_index == NULL) {
+        // Out of memory
+        return 1;
+    }
+    memset(n_index, 0, sizeof(uint32_t) * n_size);
+    table->index = n_index;
+    table->indexSize = n_size;
+
+    // Names are unique, so only empty slots need to be searched
+    for(uint32_t i = 0; i < table->count; i++) {
+        uint32_t slot = table->symbols[i].hash & (n_size - 1);
+        while(table->index[slot] != 0) {
+            slot = (slot + 1) & (n_size - 1);
+        }
+        table->index[slot] = i + 1;
+    }
+    return 0;
+}
+
+int32_t HDL_SymbolFind (struct HDL_SymbolTable *table, const char *name, uint32_t len) {
+    uint32_t slot = _HDL_SymbolSlot(table, name, len, _HDL_SymbolHash(name, len));
+    return (int32_t)table->index[slot] - 1;
+}
+
+int32_t HDL_SymbolIntern (struct HDL_SymbolTable *table, const char *name, uint32_t len) {
+    uint32_t hash = _HDL_SymbolHash(name, len);
+    uint32_t slot = _HDL_SymbolSlot(table, name, len, hash);
+    if(table->index[slot] != 0) {
+        // Already interned
+        return table->index[slot] - 1;
+    }
+
+    // Reallocate symbols if needed
+    if(table->count >= table->allocCount) {
+        uint32_t n_alloc = table->allocCount * 2;
+        struct HDL_Symbol *n_symbols = HDL_ArenaRealloc(table->arena, table->symbols,
+            sizeof(struct HDL_Symbol) * table->allocCount, sizeof(struct HDL_Symbol) * n_alloc);
+        if(n_symbols == NULL) {
+            // Out of memory
+            return -1;
+        }
+        table->symbols = n_symbols;
+        table->allocCount = n_alloc;
+    }
+
+    // Reallocate string pool if needed
+    if(table->stringSize + len + 1 > table->stringAllocSize) {
+        uint32_t n_alloc = table->stringAllocSize * 2 + len + 1;
+        char *n_strings = HDL_ArenaRealloc(table->arena, table->strings, table->stringAllocSize, n_alloc);
+        if(n_strings == NULL) {
+            // Out of memory
+            return -1;
+        }
+        table->strings = n_strings;
+        table->stringAllocSize = n_alloc;
+    }
+
+    int32_t id = table->count++;
+    struct HDL_Symbol *symbol = &table->symbols[id];
+    symbol->name = table->stringSize;
+    symbol->length = len;
+    symbol->hash = hash;
+    symbol->kind = HDL_SYMBOL_NONE;
+    symbol->index = 0;
+
+    memcpy(table->strings + table->stringSize, name, len);
+    table->strings[table->stringSize + len] = 0;
+    table->stringSize += len + 1;
+
+    table->index[slot] = id + 1;
+
+    if(table->count * 2 > table->indexSize) {
+        if(_HDL_SymbolGrowIndex(table)) {
+            table->index[slot] = 0;
+            table->count--;
+            table->stringSize -= len + 1;
+            return -1;
+        }
+    }
+    return id;
+}
+
+const char *HDL_SymbolName (struct HDL_SymbolTable *table, int32_t id) {
+    return table->strings + table->symbols[id].name;
+}
@@ -0,0 +1,87 @@
+#ifndef _HDL_SYMBOL
+#define _HDL_SYMBOL
+#include <stdint.h>
+#include "hdl-arena.h"
+
+// What a symbol is defined as
+enum HDL_SymbolKind {
+    // Interned name, not defined
+    HDL_SYMBOL_NONE = 0,
+    // #const
+    HDL_SYMBOL_VAR = 1,
+    // #img
+    HDL_SYMBOL_BITMAP = 2
+};
+
+// Interned name
+struct HDL_Symbol {
+    // Offset of the name in the string pool
+    uint32_t name;
+    // Length of the name
+    uint32_t length;
+    // Hash of the name
+    uint32_t hash;
+    // Definition (HDL_SymbolKind)
+    uint8_t kind;
+    // Index of the definition in the document
+    uint32_t index;
+};
+
+// Interned names with a hash index, symbol ids are indices to the symbol array
+struct HDL_SymbolTable {
+    // Symbols
+    struct HDL_Symbol *symbols;
+    uint32_t count;
+    uint32_t allocCount;
+
+    // Null terminated names
+    char *strings;
+    uint32_t stringSize;
+    uint32_t stringAllocSize;
+
+    // Open addressing hash index, symbol id + 1 or 0 if empty. Size is a power of 2
+    uint32_t *index;
+    uint32_t indexSize;
+
+    // Memory of the table
+    struct HDL_Arena *arena;
+};
+
+/**
+ * @brief Initializes an empty symbol table
+ *
+ * @param table
+ * @param arena Memory of the table, freed with the arena
+ * @return int 0 on success
+ */
+int HDL_SymbolsInit (struct HDL_SymbolTable *table, struct HDL_Arena *arena);
+
+/**
+ * @brief Finds a symbol
+ *
+ * @param table
+ * @param name Name, does not need to be null terminated
+ * @param len Length of the name
+ * @return int32_t Symbol id, -1 if not found
+ */
+int32_t HDL_SymbolFind (struct HDL_SymbolTable *table, const char *name, uint32_t len);
+
+/**
+ * @brief Interns a name, adds it to the table if not found
+ *
+ * @param table
+ * @param name Name, does not need to be null terminated
+ * @param len Length of the name
+ * @return int32_t Symbol id, -1 if out of memory
+ */
+int32_t HDL_SymbolIntern (struct HDL_SymbolTable *table, const char *name, uint32_t len);
+
+/**
+ * @brief Returns the name of a symbol
+ *
+ * @param table
+ * @param id Symbol id
+ * @return const char* Null terminated name
+ */
+const char *HDL_SymbolName (struct HDL_SymbolTable *table, int32_t id);
+#endif
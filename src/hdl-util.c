@@ -4,7 +4,6 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
-#include "hdl-cmp.h"
 
 struct __attribute__((packed)) _BMP_ColorEntry {
     uint8_t r;
@@ -63,7 +62,7 @@ void _HDL_PrintBitmapInfo (struct _BMP_Head *header) {
         header->fileHeader.pixelOffset);
 }
 
-int HDL_BitmapFromBMP (const char *filename, struct HDL_Bitmap *bitmap) {
+int HDL_BitmapFromBMP (struct HDL_ParseContext *ctx, const char *filename, struct HDL_Bitmap *bitmap, struct HDL_Arena *arena) {
     struct _BMP_Head bmp_header;
     char *ext = NULL;
     // Check extension
@@ -80,7 +79,7 @@ int HDL_BitmapFromBMP (const char *filename, struct HDL_Bitmap *bitmap) {
     }
     // Buffer to combine path and filename for relative paths
     char buff[256];
-    sprintf(buff, "%s%s", input_file_path, filename);
+    snprintf(buff, sizeof(buff), "%s%s", ctx->input_path, filename);
     FILE *file = fopen(buff, "r");
 
     if(file == NULL) {
@@ -124,7 +123,12 @@ int HDL_BitmapFromBMP (const char *filename, struct HDL_Bitmap *bitmap) {
     if(bitmap->sprite_height == 0) 
         bitmap->sprite_height = bitmap->height;
 
-    bitmap->data = malloc(bitmap->size);
+    bitmap->data = HDL_ArenaAlloc(arena, bitmap->size);
+    if(bitmap->data == NULL) {
+        printf("Out of memory\n");
+        fclose(file);
+        return 1;
+    }
     memset(bitmap->data, 0, bitmap->size);
     
     fseek(file, bmp_header.fileHeader.pixelOffset, SEEK_SET);
@@ -5,9 +5,11 @@
 /**
  * @brief Parses a BMP image to HDL_Bitmap
  * 
+ * @param ctx Parse context, relative paths are resolved from its input path
  * @param filename 
  * @param bitmap 
+ * @param arena Bitmap data is allocated from here
  * @return int 
  */
-int HDL_BitmapFromBMP (const char *filename, struct HDL_Bitmap *bitmap);
+int HDL_BitmapFromBMP (struct HDL_ParseContext *ctx, const char *filename, struct HDL_Bitmap *bitmap, struct HDL_Arena *arena);
 #endif
\ No newline at end of file
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "hdl-decode.h"
+
+// Round-trip tests of the compiler: generates documents, compiles them with hdl-cmp and walks the output.
+// Usage: hdl-test <hdl-cmp> <work directory>
+
+// Header fields, see compile() in hdl-cmp.c
+#define HDL_HEADER_SIZE             16
+#define HDL_HEADER_FLAGS            6
+#define HDL_HEADER_FLAG_WIDE        0x01
+#define HDL_HEADER_FLAG_DIRECTORY   0x02
+
+// Elements of the large document, a root and its children
+#define TEST_ELEMENT_COUNT          120000
+// Large bitmap, 75000 bytes of 1bpp data
+#define TEST_BITMAP_WIDTH           600
+#define TEST_BITMAP_HEIGHT          1000
+
+// Value sizes of the attribute types, indexed by HDL_Type
+static const uint8_t type_sizes[] = { 1, 1, 4, 0, 1, 2, 4, 0, 1, 8, 1, 2 };
+#define TYPE_STRING 3
+#define TYPE_I8     4
+#define TYPE_I16    5
+#define TYPE_I32    6
+#define TYPE_IMG    7
+
+// Compiler and directory the test files are written to
+static const char *compiler;
+static const char *workdir;
+static int failures = 0;
+
+// Compiled file being walked
+struct TestFile {
+    uint8_t *data;
+    size_t size;
+    // Next byte
+    size_t pos;
+    uint8_t wide;
+    uint32_t bitmapCount;
+    uint32_t elementCount;
+    // Set if the file ends early
+    uint8_t overrun;
+};
+
+// Element read from a file, only the first value of each attribute is kept
+struct TestElement {
+    uint8_t tag;
+    uint32_t attrCount;
+    uint8_t keys[16];
+    int64_t values[16];
+    uint32_t childCount;
+};
+
+// Bitmap read from a file
+struct TestBitmap {
+    uint32_t id;
+    uint32_t size;
+    uint16_t width;
+    uint16_t height;
+    uint8_t colorMode;
+    const uint8_t *data;
+};
+
+/**
+ * @brief Records a failed check
+ *
+ * @param test Name of the test
+ * @param ok Result of the check
+ * @param what Description of the check
+ * @return int 0 if the check passed
+ */
+static int check (const char *test, int ok, const char *what) {
+    if(!ok) {
+        printf("FAIL %s: %s\r\n", test, what);
+        failures++;
+    }
+    return !ok;
+}
+
+/**
+ * @brief Returns a path in the work directory
+ *
+ * @param name
+ * @return const char* Path, valid until the next call
+ */
+static const char *testPath (const char *name) {
+    static char path[512];
+    snprintf(path, sizeof(path), "%s/%s", workdir, name);
+    return path;
+}
+
+/**
+ * @brief Compiles a file of the work directory
+ *
+ * @param input Input file name
+ * @param output Output file name
+ * @param options Extra compiler options
+ * @return int 0 on success
+ */
+static int compileTest (const char *input, const char *output, const char *options) {
+    char command[2048];
+    char in[512];
+    char out[512];
+    // Paths are copied, testPath reuses its buffer
+    snprintf(in, sizeof(in), "%s", testPath(input));
+    snprintf(out, sizeof(out), "%s", testPath(output));
+    int n = snprintf(command, sizeof(command), "%s %s -o %s %s > %s 2>&1", compiler, options, out, in, testPath("compile.log"));
+    if(n < 0 || (size_t)n >= sizeof(command)) {
+        return 1;
+    }
+    return system(command) != 0;
+}
+
+/**
+ * @brief Reads a compiled file and its header
+ *
+ * @param name File name in the work directory
+ * @param file
+ * @return int 0 on success
+ */
+static int readTest (const char *name, struct TestFile *file) {
+    memset(file, 0, sizeof(struct TestFile));
+    FILE *f = fopen(testPath(name), "rb");
+    if(f == NULL) {
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file->data = malloc(len > 0 ? len : 1);
+    if(file->data == NULL || len < HDL_HEADER_SIZE || fread(file->data, 1, len, f) != (size_t)len) {
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+    file->size = len;
+
+    const uint8_t *h = file->data;
+    file->wide = h[HDL_HEADER_FLAGS] & HDL_HEADER_FLAG_WIDE;
+    if(file->wide) {
+        file->bitmapCount = h[8] | h[9] << 8 | h[10] << 16 | (uint32_t)h[11] << 24;
+        file->elementCount = h[12] | h[13] << 8 | h[14] << 16 | (uint32_t)h[15] << 24;
+    }
+    else {
+        file->bitmapCount = h[2];
+        file->elementCount = h[4] | h[5] << 8;
+    }
+    file->pos = HDL_HEADER_SIZE;
+    return 0;
+}
+
+/**
+ * @brief Reads a little endian field
+ *
+ * @param file
+ * @param size Size of the field in bytes
+ * @return uint64_t
+ */
+static uint64_t readField (struct TestFile *file, int size) {
+    if(file->pos + size > file->size) {
+        file->overrun = 1;
+        file->pos = file->size;
+        return 0;
+    }
+    uint64_t value = 0;
+    for(int b = 0; b < size; b++) {
+        value |= (uint64_t)file->data[file->pos++] << (b * 8);
+    }
+    return value;
+}
+
+/**
+ * @brief Reads a bitmap record
+ *
+ * @param file
+ * @param bmp
+ */
+static void readBitmap (struct TestFile *file, struct TestBitmap *bmp) {
+    bmp->id = readField(file, file->wide ? 4 : 2);
+    bmp->size = readField(file, file->wide ? 4 : 2);
+    bmp->width = readField(file, 2);
+    bmp->height = readField(file, 2);
+    readField(file, file->wide ? 2 : 1);
+    readField(file, file->wide ? 2 : 1);
+    bmp->colorMode = readField(file, 1);
+    bmp->data = file->data + file->pos;
+    if(file->pos + bmp->size > file->size) {
+        file->overrun = 1;
+        file->pos = file->size;
+        return;
+    }
+    file->pos += bmp->size;
+}
+
+/**
+ * @brief Reads an element record of the default attribute format
+ *
+ * @param file
+ * @param element
+ */
+static void readElement (struct TestFile *file, struct TestElement *element) {
+    element->tag = readField(file, 1);
+    // Content
+    while(readField(file, 1) != 0 && !file->overrun);
+
+    element->attrCount = readField(file, file->wide ? 4 : 1);
+    for(uint32_t i = 0; i < element->attrCount && !file->overrun; i++) {
+        uint8_t key = readField(file, 1);
+        uint8_t type = readField(file, 1);
+        uint32_t count = readField(file, file->wide ? 4 : 1);
+        int64_t value = 0;
+        for(uint32_t v = 0; v < count && !file->overrun; v++) {
+            int64_t n;
+            if(type == TYPE_STRING) {
+                while(readField(file, 1) != 0 && !file->overrun);
+                n = 0;
+            }
+            else if(type == TYPE_IMG) {
+                n = readField(file, file->wide ? 4 : 2);
+            }
+            else if(type < sizeof(type_sizes)) {
+                int size = type_sizes[type];
+                uint64_t bits = readField(file, size);
+                // Signed types are sign extended
+                if(type == TYPE_I8 || type == TYPE_I16 || type == TYPE_I32) {
+                    n = (int64_t)(bits << (64 - size * 8)) >> (64 - size * 8);
+                }
+                else {
+                    n = bits;
+                }
+            }
+            else {
+                file->overrun = 1;
+                return;
+            }
+            if(v == 0) {
+                value = n;
+            }
+        }
+        if(i < 16) {
+            element->keys[i] = key;
+            element->values[i] = value;
+        }
+    }
+    element->childCount = readField(file, file->wide ? 4 : 1);
+}
+
+/**
+ * @brief Pixel of the generated bitmaps
+ *
+ * @param x
+ * @param y
+ * @return int
+ */
+static int testPixel (int x, int y) {
+    return (x * 7 + y * 3) % 11 < 4 || (y / 40) % 3 == 0;
+}
+
+/**
+ * @brief Writes a document with an inline bitmap of testPixel
+ *
+ * @param name File name in the work directory
+ * @param width
+ * @param height
+ * @return int 0 on success
+ */
+static int writeBitmapDocument (const char *name, int width, int height) {
+    FILE *f = fopen(testPath(name), "w");
+    if(f == NULL) {
+        return 1;
+    }
+    fprintf(f, "#img TEST (%i, %i)\n", width, height);
+    char *row = malloc(width + 2);
+    if(row == NULL) {
+        fclose(f);
+        return 1;
+    }
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            row[x] = testPixel(x, y) ? '1' : '0';
+        }
+        row[width] = '\n';
+        row[width + 1] = 0;
+        fputs(row, f);
+    }
+    free(row);
+    fprintf(f, ";\n<box x=3>\n<box img=TEST y=4/>\n</box>\n");
+    return fclose(f) != 0;
+}
+
+/**
+ * @brief Checks a compiled bitmap document, its bitmap is decoded and compared to testPixel
+ *
+ * @param test Name of the test
+ * @param output Compiled file name
+ * @param width
+ * @param height
+ * @param wide Expected format
+ */
+static void checkBitmapDocument (const char *test, const char *output, int width, int height, int wide) {
+    struct TestFile file;
+    if(check(test, readTest(output, &file) == 0, "output can not be read")) {
+        free(file.data);
+        return;
+    }
+    check(test, file.wide == wide, wide ? "expected the wide format" : "expected the compact format");
+    check(test, file.bitmapCount == 1 && file.elementCount == 2, "header counts");
+
+    struct TestBitmap bmp;
+    readBitmap(&file, &bmp);
+    check(test, !file.overrun && bmp.id == 0 && bmp.width == width && bmp.height == height, "bitmap record");
+
+    uint32_t rowBytes = (width + 7) / 8;
+    uint8_t *pixels = malloc((size_t)rowBytes * height);
+    struct HDL_BitmapDecoder dec;
+    if(!file.overrun && pixels != NULL
+        && !check(test, HDL_DecoderInit(&dec, bmp.colorMode, bmp.data, bmp.size, bmp.width) == 0, "bitmap encoding")
+        && !check(test, HDL_DecodeBytes(&dec, pixels, (size_t)rowBytes * height) == 0, "bitmap does not decode")) {
+        int same = 1;
+        for(int y = 0; y < height && same; y++) {
+            for(int x = 0; x < width; x++) {
+                if(((pixels[y * rowBytes + x / 8] >> (7 - x % 8)) & 1) != testPixel(x, y)) {
+                    same = 0;
+                    break;
+                }
+            }
+        }
+        check(test, same, "decoded bitmap differs from the source");
+    }
+    free(pixels);
+
+    struct TestElement root, child;
+    readElement(&file, &root);
+    readElement(&file, &child);
+    check(test, !file.overrun && file.pos == file.size, "elements do not end the file");
+    check(test, root.attrCount == 1 && root.values[0] == 3 && root.childCount == 1, "root element");
+    check(test, child.attrCount == 2 && child.childCount == 0, "child element");
+    free(file.data);
+}
+
+/**
+ * @brief Small document stays in the compact format
+ */
+static void testCompact () {
+    const char *test = "compact";
+    if(check(test, writeBitmapDocument("compact.hdl", 16, 8) == 0, "input can not be written")
+        || check(test, compileTest("compact.hdl", "compact.bin", "") == 0, "compile failed")) {
+        return;
+    }
+    checkBitmapDocument(test, "compact.bin", 16, 8, 0);
+}
+
+/**
+ * @brief Bitmap of more than 64KB, raw and with each encoding
+ */
+static void testLargeBitmap () {
+    const char *test = "large bitmap";
+    if(check(test, writeBitmapDocument("bitmap.hdl", TEST_BITMAP_WIDTH, TEST_BITMAP_HEIGHT) == 0, "input can not be written")) {
+        return;
+    }
+    const char *encodings[] = { "raw", "packbits", "lz", "auto" };
+    for(int i = 0; i < 4; i++) {
+        char options[32];
+        char name[64];
+        snprintf(options, sizeof(options), "-z %s", encodings[i]);
+        snprintf(name, sizeof(name), "large bitmap (%s)", encodings[i]);
+        if(check(name, compileTest("bitmap.hdl", "bitmap.bin", options) == 0, "compile failed")) {
+            continue;
+        }
+        checkBitmapDocument(name, "bitmap.bin", TEST_BITMAP_WIDTH, TEST_BITMAP_HEIGHT, 1);
+    }
+}
+
+/**
+ * @brief Document of more than 65535 elements, walked through the directory
+ */
+static void testManyElements () {
+    const char *test = "many elements";
+    FILE *f = fopen(testPath("elements.hdl"), "w");
+    if(check(test, f != NULL, "input can not be written")) {
+        return;
+    }
+    fprintf(f, "<box>\n");
+    for(uint32_t i = 1; i < TEST_ELEMENT_COUNT; i++) {
+        fprintf(f, "<box x=%u/>\n", 1 + i % 30000);
+    }
+    fprintf(f, "</box>\n");
+    if(check(test, fclose(f) == 0, "input can not be written")
+        || check(test, compileTest("elements.hdl", "elements.bin", "-d") == 0, "compile failed")) {
+        return;
+    }
+
+    struct TestFile file;
+    if(check(test, readTest("elements.bin", &file) == 0, "output can not be read")) {
+        free(file.data);
+        return;
+    }
+    check(test, file.wide, "expected the wide format");
+    check(test, (file.data[HDL_HEADER_FLAGS] & HDL_HEADER_FLAG_DIRECTORY) != 0, "expected a directory");
+    if(check(test, file.bitmapCount == 0 && file.elementCount == TEST_ELEMENT_COUNT, "header counts")) {
+        free(file.data);
+        return;
+    }
+
+    // Elements follow the directory, each element is where the directory points
+    file.pos += 4 * (size_t)file.elementCount;
+    size_t directory = HDL_HEADER_SIZE;
+    uint32_t bad = 0;
+    for(uint32_t i = 0; i < file.elementCount && !file.overrun; i++) {
+        size_t at = file.pos;
+        file.pos = directory + 4 * (size_t)i;
+        uint32_t offset = readField(&file, 4);
+        file.pos = at;
+        struct TestElement element;
+        readElement(&file, &element);
+        if(offset != at) {
+            bad++;
+        }
+        else if(i == 0 && (element.attrCount != 0 || element.childCount != TEST_ELEMENT_COUNT - 1)) {
+            bad++;
+        }
+        else if(i > 0 && (element.attrCount != 1 || element.values[0] != 1 + i % 30000 || element.childCount != 0)) {
+            bad++;
+        }
+    }
+    check(test, !file.overrun && file.pos == file.size, "elements do not end the file");
+    check(test, bad == 0, "elements differ from the source");
+    free(file.data);
+}
+
+int main (int argc, char *argv[]) {
+    if(argc < 3) {
+        printf("Usage: hdl-test <hdl-cmp> <work directory>\r\n");
+        return 1;
+    }
+    compiler = argv[1];
+    workdir = argv[2];
+
+    testCompact();
+    testLargeBitmap();
+    testManyElements();
+
+    if(failures > 0) {
+        printf("%i checks failed\r\n", failures);
+        return 1;
+    }
+    printf("All tests passed\r\n");
+    return 0;
+}